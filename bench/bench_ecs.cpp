@@ -0,0 +1,632 @@
+/**
+ * bench/bench_ecs.cpp — ECS マイクロベンチマーク
+ *
+ * 30 システムのパイプラインを SystemScheduler::run (逐次) と
+ * run_parallel (競合グラフ + JobSystem) で実行し、フレーム時間を比較。
+ * 各システムは 8 種のコンポーネントから 1 つを書き込み 2 つを読む。
+ * 空システムだけのパイプラインでスケジューラ自体のオーバーヘッドも計測。
+ * 大量 spawn 時の 1 エンティティあたりの最悪レイテンシ (チャンク追加) も計測。
+ * add_component / remove_component による Archetype 遷移のコストも計測 (タグの付け外しも)。
+ * 10k パーティクル生成を spawn + add_component と spawn_batch で比較。
+ * 1M エンティティの Position += Velocity を for_each (std::function) と each で比較。
+ * Archetype 数が多い World でのアドホッククエリとキャッシュ済みクエリを比較。
+ * 500k エンティティの移動システムを each (単一スレッド) と par_each で比較。
+ * par_each からの CommandBuffer 記録 (スレッド別ストリーム) と適用のコストも計測。
+ * 6 コンポーネントの Entity に 3 つ追加するコマンド列の合成適用 (移動 1 回) も計測。
+ * 疎な書き込み時の全走査と changed<T>() フィルタ付き走査を比較。
+ * OnAdd / OnRemove トリガーを多数登録した状態での add / remove コストも計測。
+ * 頻繁に付け外しするコンポーネントを Archetype 格納と疎集合格納で比較。
+ * ChildOf の子列挙を全走査と関係索引 (each_source / targeting) で比較。
+ * 大量 despawn 後の compact (1ms 予算で分割) の所要フレーム数と解放量も計測。
+ * 1M エンティティの World スナップショット保存 / 読み込み時間も計測 (目標 10ms 未満)。
+ * 写像読み込み (map_snapshot) と、その後の初回全走査 (ページフォールト込み) も計測。
+ */
+#include <engine/core/types.hpp>
+#include <engine/core/log.hpp>
+#include <engine/core/reflection.hpp>
+#include <engine/core/task_graph.hpp>
+#include <engine/ecs/world.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <utility>
+
+using namespace engine;
+using namespace engine::ecs;
+using Clock = std::chrono::steady_clock;
+
+template <u32 N>
+struct Comp { f32 v[4]; };
+
+struct MarkerTag {};
+
+// スナップショット用の型登録 (テンプレート名は識別子にできないので別名で)
+using SnapPosition = Comp<0>;
+using SnapVelocity = Comp<1>;
+ENG_REFLECT_BEGIN(SnapPosition)
+ENG_REFLECT_END(SnapPosition)
+ENG_REFLECT_BEGIN(SnapVelocity)
+ENG_REFLECT_END(SnapVelocity)
+ENG_REFLECT_BEGIN(MarkerTag)
+ENG_REFLECT_END(MarkerTag)
+
+static constexpr u32 comp_kinds = 8;
+
+template <u32... Is>
+static TypeID comp_id_impl(u32 i, std::integer_sequence<u32, Is...>) {
+    TypeID ids[] = {type_id<Comp<Is>>()...};
+    return ids[i];
+}
+static TypeID comp_id(u32 i) {
+    return comp_id_impl(i, std::make_integer_sequence<u32, comp_kinds>{});
+}
+
+template <u32... Is>
+static void spawn_all(World& world, u32 count, std::integer_sequence<u32, Is...>) {
+    for (u32 i = 0; i < count; ++i) {
+        Entity e = world.spawn();
+        (world.add_component(e, Comp<Is>{{1.0f, 2.0f, 3.0f, static_cast<f32>(i)}}), ...);
+    }
+}
+
+// ── 合成ワークロード: dst = f(dst, a, b) を数ラウンド ───
+static void synthetic_work(World& world, TypeID dst, TypeID a, TypeID b) {
+    for (auto& m : world.query().execute()) {
+        auto* d  = static_cast<Comp<0>*>(m.archetype->chunk_column(m.chunk, dst));
+        auto* sa = static_cast<const Comp<0>*>(m.archetype->chunk_column(m.chunk, a));
+        auto* sb = static_cast<const Comp<0>*>(m.archetype->chunk_column(m.chunk, b));
+        for (u32 i = 0; i < m.count; ++i) {
+            for (u32 round = 0; round < 8; ++round) {
+                for (u32 k = 0; k < 4; ++k) {
+                    d[i].v[k] = std::sqrt(d[i].v[k] * d[i].v[k] + sa[i].v[k] * sb[i].v[k] + 1.0f);
+                }
+            }
+        }
+    }
+}
+
+static void build_pipeline(World& world, u32 systems) {
+    for (u32 s = 0; s < systems; ++s) {
+        TypeID w  = comp_id(s % comp_kinds);
+        TypeID r0 = comp_id((s * 3 + 1) % comp_kinds);
+        TypeID r1 = comp_id((s * 5 + 2) % comp_kinds);
+        if (r0 == w) r0 = comp_id((s + 4) % comp_kinds);
+        if (r1 == w) r1 = comp_id((s + 5) % comp_kinds);
+        world.scheduler().add_system({
+            "sys" + std::to_string(s), {r0, r1}, {w}, {},
+            [w, r0, r1](World& wd) { synthetic_work(wd, w, r0, r1); }
+        });
+    }
+}
+
+// ── 逐次 vs 並列スケジューラ ────────────────────────────
+static void bench_scheduler(u32 systems, u32 entities, u32 frames) {
+    World world;
+    spawn_all(world, entities, std::make_integer_sequence<u32, comp_kinds>{});
+    build_pipeline(world, systems);
+    JobSystem& js = global_job_system();
+
+    world.scheduler().run();
+    auto t0 = Clock::now();
+    for (u32 f = 0; f < frames; ++f) world.scheduler().run();
+    f64 serial = std::chrono::duration<f64, std::milli>(Clock::now() - t0).count() / frames;
+
+    world.scheduler().run_parallel(js);   // グラフ構築 + ウォームアップ
+    t0 = Clock::now();
+    for (u32 f = 0; f < frames; ++f) world.scheduler().run_parallel(js);
+    f64 parallel = std::chrono::duration<f64, std::milli>(Clock::now() - t0).count() / frames;
+
+    std::printf("  systems=%u entities=%u edges=%zu workers=%u\n",
+                systems, entities, world.scheduler().conflict_edges().size(), js.worker_count());
+    std::printf("    run()          %8.3f ms/frame\n", serial);
+    std::printf("    run_parallel() %8.3f ms/frame  (x%.2f)\n", parallel, serial / parallel);
+}
+
+// ── スケジューラ自体のオーバーヘッド ───────────────────
+static void bench_scheduler_overhead(u32 systems, u32 frames) {
+    World world;
+    for (u32 s = 0; s < systems; ++s) {
+        std::vector<std::string> after;
+        if (s > 0) after.push_back("sys" + std::to_string(s - 1));
+        world.scheduler().add_system({
+            "sys" + std::to_string(s), {}, {comp_id(s % comp_kinds)}, std::move(after), [](World&) {}
+        });
+    }
+    world.scheduler().run();
+
+    auto t0 = Clock::now();
+    for (u32 f = 0; f < frames; ++f) world.scheduler().run();
+    f64 us = std::chrono::duration<f64, std::micro>(Clock::now() - t0).count() / frames;
+    std::printf("  systems=%u  run() %8.3f us/frame (empty systems)\n", systems, us);
+}
+
+// ── spawn レイテンシ (カラム再確保のスパイク有無) ───────
+static void bench_spawn_latency(u32 count) {
+    World world;
+    f64 worst = 0.0;
+    auto t_all = Clock::now();
+    for (u32 i = 0; i < count; ++i) {
+        auto t0 = Clock::now();
+        Entity e = world.spawn();
+        world.add_component(e, Comp<0>{{1, 2, 3, 4}});
+        worst = std::max(worst, std::chrono::duration<f64, std::micro>(Clock::now() - t0).count());
+    }
+    f64 total = std::chrono::duration<f64, std::milli>(Clock::now() - t_all).count();
+    std::printf("  entities=%u  total %8.2f ms  worst %8.2f us  chunks=%zu (%zu KB)\n",
+                count, total, worst, world.chunk_pool().chunks_in_use(),
+                world.chunk_pool().bytes_reserved() / 1024);
+}
+
+// ── Archetype 遷移 (add / remove 各 1 回を 1 操作と数える) ──
+static void bench_add_remove(u32 entities, u32 ops) {
+    World world;
+    std::vector<Entity> es(entities);
+    for (auto& e : es) {
+        e = world.spawn();
+        world.add_component(e, Comp<0>{});
+        world.add_component(e, Comp<1>{});
+        world.add_component(e, Comp<2>{});
+    }
+    auto t0 = Clock::now();
+    for (u32 i = 0; i < ops / 2; ++i) {
+        Entity e = es[i % entities];
+        world.add_component(e, Comp<3>{{1, 2, 3, 4}});
+        world.remove_component<Comp<3>>(e);
+    }
+    f64 ms = std::chrono::duration<f64, std::milli>(Clock::now() - t0).count();
+    std::printf("  ops=%u (3 -> 4 -> 3 components)  %8.2f ms  %6.1f ns/op\n",
+                ops, ms, ms * 1e6 / ops);
+
+    // 同じ遷移をタグ (データなし) で
+    t0 = Clock::now();
+    for (u32 i = 0; i < ops / 2; ++i) {
+        Entity e = es[i % entities];
+        world.add_component(e, MarkerTag{});
+        world.remove_component<MarkerTag>(e);
+    }
+    ms = std::chrono::duration<f64, std::milli>(Clock::now() - t0).count();
+    std::printf("  ops=%u (3 -> 3+tag -> 3)          %8.2f ms  %6.1f ns/op\n",
+                ops, ms, ms * 1e6 / ops);
+}
+
+// ── OnAdd / OnRemove トリガー付きの Archetype 遷移 ───────
+static void bench_observers(u32 entities, u32 ops, u32 triggers_per_event) {
+    World world;
+    u64 notified = 0, calls = 0;
+    for (u32 t = 0; t < triggers_per_event; ++t) {
+        for (TriggerEvent ev : {TriggerEvent::OnAdd, TriggerEvent::OnRemove}) {
+            world.scheduler().add_trigger({"observer", type_id<Comp<3>>(), ev,
+                                           [&](World&, std::span<const Entity> es) {
+                                               ++calls;
+                                               notified += es.size();
+                                           }});
+        }
+    }
+    std::vector<Entity> es(entities);
+    for (auto& e : es) {
+        e = world.spawn();
+        world.add_component(e, Comp<0>{});
+        world.add_component(e, Comp<1>{});
+        world.add_component(e, Comp<2>{});
+    }
+    auto t0 = Clock::now();
+    for (u32 i = 0; i < ops / 2; ++i) {
+        Entity e = es[i % entities];
+        world.add_component(e, Comp<3>{{1, 2, 3, 4}});
+        world.remove_component<Comp<3>>(e);
+        if ((i + 1) % entities == 0) world.flush_observers();   // フレーム相当の区切り
+    }
+    world.flush_observers();
+    f64 ms = std::chrono::duration<f64, std::milli>(Clock::now() - t0).count();
+    std::printf("  ops=%u  triggers=%u  %8.2f ms  %6.1f ns/op  (handler calls %llu, entities %llu)\n",
+                ops, triggers_per_event * 2, ms, ms * 1e6 / ops,
+                static_cast<unsigned long long>(calls), static_cast<unsigned long long>(notified));
+}
+
+// ── 疎集合ストレージ (6 コンポーネントの Entity に Stunned を付け外し) ──
+struct Stunned { f32 remaining; };
+
+static void bench_sparse_toggle(u32 entities, u32 ops) {
+    for (StorageKind kind : {StorageKind::Table, StorageKind::SparseSet}) {
+        World world;
+        world.set_storage<Stunned>(kind);
+        auto spawned = world.spawn_batch<Comp<0>, Comp<1>, Comp<2>, Comp<3>, Comp<4>, Comp<5>>(entities);
+        std::vector<Entity> es(spawned.begin(), spawned.end());
+
+        auto t0 = Clock::now();
+        for (u32 i = 0; i < ops / 2; ++i) {
+            Entity e = es[i % entities];
+            world.add_component(e, Stunned{1.0f});
+            world.remove_component<Stunned>(e);
+        }
+        f64 toggle_ms = std::chrono::duration<f64, std::milli>(Clock::now() - t0).count();
+
+        // 1 割が Stunned の状態で Comp<0> + Stunned を走査
+        for (u32 i = 0; i < entities; i += 10) world.add_component(es[i], Stunned{1.0f});
+        f32 sum = 0;
+        t0 = Clock::now();
+        for (u32 f = 0; f < 100; ++f) {
+            world.each<const Comp<0>, Stunned>([&](const Comp<0>& c, Stunned& s) { s.remaining -= c.v[0]; sum += s.remaining; });
+        }
+        f64 query_us = std::chrono::duration<f64, std::micro>(Clock::now() - t0).count() / 100;
+        std::printf("  %-9s toggle %6.1f ns/op   query (10%% stunned) %7.1f us  (sink=%.0f)\n",
+                    kind == StorageKind::Table ? "table" : "sparse", toggle_ms * 1e6 / ops, query_us,
+                    static_cast<f64>(sum));
+    }
+}
+
+// ── パーティクルバースト (3 コンポーネント) ─────────────
+static void bench_spawn_burst(u32 count, u32 rounds) {
+    f64 single = 0.0, batch = 0.0;
+    for (u32 r = 0; r < rounds; ++r) {
+        World a, b;
+        auto t0 = Clock::now();
+        for (u32 i = 0; i < count; ++i) {
+            Entity e = a.spawn();
+            a.add_component(e, Comp<0>{{static_cast<f32>(i), 0, 0, 0}});
+            a.add_component(e, Comp<1>{{0, 1, 0, 0}});
+            a.add_component(e, Comp<2>{{1, 1, 1, 1}});
+        }
+        single += std::chrono::duration<f64, std::micro>(Clock::now() - t0).count();
+
+        t0 = Clock::now();
+        b.spawn_batch<Comp<0>, Comp<1>, Comp<2>>(count, [](u32 i, Comp<0>& p, Comp<1>& v, Comp<2>& c) {
+            p = {{static_cast<f32>(i), 0, 0, 0}};
+            v = {{0, 1, 0, 0}};
+            c = {{1, 1, 1, 1}};
+        });
+        batch += std::chrono::duration<f64, std::micro>(Clock::now() - t0).count();
+    }
+    std::printf("  count=%u  spawn+add x3 %8.1f us   spawn_batch %8.1f us  (x%.1f)\n",
+                count, single / rounds, batch / rounds, single / batch);
+}
+
+// ── クエリ反復: for_each (std::function) vs each (テンプレート) ──
+struct Position { f32 x, y, z; };
+struct Velocity { f32 x, y, z; };
+
+static void bench_query_iteration(u32 count, u32 frames) {
+    World world;
+    world.spawn_batch<Position, Velocity>(count, [](u32 i, Position& p, Velocity& v) {
+        p = {static_cast<f32>(i), 0, 0};
+        v = {1, 2, 3};
+    });
+    constexpr f32 dt = 1.0f / 60.0f;
+
+    auto t0 = Clock::now();
+    for (u32 f = 0; f < frames; ++f) {
+        world.query().with<Position, Velocity>().for_each<Position, Velocity>(
+            [](Entity, Position& p, Velocity& v) {
+                p.x += v.x * dt; p.y += v.y * dt; p.z += v.z * dt;
+            });
+    }
+    f64 old_ms = std::chrono::duration<f64, std::milli>(Clock::now() - t0).count() / frames;
+
+    t0 = Clock::now();
+    for (u32 f = 0; f < frames; ++f) {
+        world.each<Position, Velocity>([](Position& p, const Velocity& v) {
+            p.x += v.x * dt; p.y += v.y * dt; p.z += v.z * dt;
+        });
+    }
+    f64 new_ms = std::chrono::duration<f64, std::milli>(Clock::now() - t0).count() / frames;
+
+    std::printf("  entities=%u  for_each %7.3f ms   each %7.3f ms  (x%.1f)\n",
+                count, old_ms, new_ms, old_ms / new_ms);
+}
+
+// ── アドホック vs キャッシュ済みクエリ (多 Archetype) ────
+template <u32... Is>
+static void spawn_combination(World& world, u32 mask, std::integer_sequence<u32, Is...>) {
+    Entity e = world.spawn();
+    ((mask & (1u << Is) ? world.add_component(e, Comp<Is>{}) : void()), ...);
+}
+
+static void bench_cached_query(u32 frames) {
+    World world;
+    // 8 種の組み合わせで 255 Archetype、各 4 Entity
+    for (u32 mask = 1; mask < (1u << comp_kinds); ++mask) {
+        for (u32 k = 0; k < 4; ++k) {
+            spawn_combination(world, mask, std::make_integer_sequence<u32, comp_kinds>{});
+        }
+    }
+    Query cached = world.query().with<Comp<0>, Comp<1>, Comp<2>>().without<Comp<7>>().cached();
+    u64 sink = 0;
+
+    auto t0 = Clock::now();
+    for (u32 f = 0; f < frames; ++f) {
+        world.query().with<Comp<0>, Comp<1>, Comp<2>>().without<Comp<7>>()
+            .each<Comp<0>>([&](Comp<0>&) { ++sink; });
+    }
+    f64 adhoc = std::chrono::duration<f64, std::micro>(Clock::now() - t0).count() / frames;
+
+    t0 = Clock::now();
+    for (u32 f = 0; f < frames; ++f) {
+        cached.each<Comp<0>>([&](Comp<0>&) { ++sink; });
+    }
+    f64 cached_us = std::chrono::duration<f64, std::micro>(Clock::now() - t0).count() / frames;
+
+    std::printf("  archetypes=%u matching=%zu  ad-hoc %7.2f us   cached %7.2f us  (sink=%llu)\n",
+                world.archetype_count(), cached.archetypes().size(), adhoc, cached_us,
+                static_cast<unsigned long long>(sink));
+}
+
+// ── 並列クエリ (par_each) ───────────────────────────────
+static void bench_par_each(u32 count, u32 frames) {
+    World world;
+    world.spawn_batch<Position, Velocity>(count, [](u32 i, Position& p, Velocity& v) {
+        p = {static_cast<f32>(i), 0, 0};
+        v = {1, 2, 3};
+    });
+    Query moving = world.cached_query<Position, Velocity>();
+    constexpr f32 dt = 1.0f / 60.0f;
+    auto move = [](Position& p, const Velocity& v) {
+        // 1 エンティティあたりの計算量を実際の移動システム程度に増やす
+        f32 len = std::sqrt(v.x * v.x + v.y * v.y + v.z * v.z) + 1.0f;
+        p.x += v.x / len * dt; p.y += v.y / len * dt; p.z += v.z / len * dt;
+    };
+
+    auto t0 = Clock::now();
+    for (u32 f = 0; f < frames; ++f) moving.each<Position, Velocity>(move);
+    f64 seq_ms = std::chrono::duration<f64, std::milli>(Clock::now() - t0).count() / frames;
+
+    JobSystem& js = global_job_system();
+    moving.par_each<Position, Velocity>(move, js);   // ウォームアップ
+    t0 = Clock::now();
+    for (u32 f = 0; f < frames; ++f) moving.par_each<Position, Velocity>(move, js);
+    f64 par_ms = std::chrono::duration<f64, std::milli>(Clock::now() - t0).count() / frames;
+
+    std::printf("  entities=%u  workers=%u  each %7.3f ms   par_each %7.3f ms  (x%.2f)\n",
+                count, js.worker_count(), seq_ms, par_ms, seq_ms / par_ms);
+}
+
+// ── CommandBuffer 記録 / 適用 ───────────────────────────
+static void bench_command_buffer(u32 count, u32 frames) {
+    World world;
+    world.spawn_batch<Position, Velocity>(count);
+    Query moving = world.cached_query<Position, Velocity>();
+    CommandBuffer& cb = world.command_buffer();
+
+    f64 record_ms = 0.0, apply_ms = 0.0;
+    usize bytes = 0;
+    for (u32 f = 0; f < frames; ++f) {
+        auto t0 = Clock::now();
+        moving.par_each<Position>([](CommandBuffer& buf, Entity e, Position& p) {
+            buf.set_component(e, Position{p.x + 1.0f, p.y, p.z});
+        });
+        auto t1 = Clock::now();
+        bytes = cb.bytes_used();
+        world.flush_commands();
+        auto t2 = Clock::now();
+        record_ms += std::chrono::duration<f64, std::milli>(t1 - t0).count();
+        apply_ms  += std::chrono::duration<f64, std::milli>(t2 - t1).count();
+    }
+    std::printf("  commands=%u  record %7.3f ms  apply %7.3f ms  %5.1f B/cmd (12B コンポーネント)\n",
+                count, record_ms / frames, apply_ms / frames, static_cast<f64>(bytes) / count);
+}
+
+static void bench_command_coalesce(u32 count, u32 rounds) {
+    f64 best = 1e30;
+    CommandApplyStats stats;
+    for (u32 r = 0; r < rounds; ++r) {
+        World world;
+        // 既に 6 コンポーネントを持つ Entity に 3 つ追加 (逐次なら 3 回全カラムを移動)
+        auto ents = world.spawn_batch<Comp<0>, Comp<1>, Comp<2>, Comp<3>, Comp<4>, Comp<5>>(count);
+        CommandBuffer& cb = world.command_buffer();
+        for (u32 i = 0; i < count; ++i) {
+            cb.add_component(ents[i], Position{static_cast<f32>(i), 0, 0});
+            cb.add_component(ents[i], Velocity{1, 0, 0});
+            cb.add_component(ents[i], Comp<6>{});
+        }
+        auto t0 = Clock::now();
+        stats = world.flush_commands();
+        best = std::min(best, std::chrono::duration<f64, std::micro>(Clock::now() - t0).count());
+    }
+    std::printf("  entities=%u  apply %8.1f us  migrations=%u  saved=%u\n",
+                count, best, stats.migrations, stats.migrations_saved);
+}
+
+// ── 変更検知 (書き込みのあったチャンクのみ処理) ────────
+static void bench_changed_filter(u32 count, u32 dirty, u32 frames) {
+    World world;
+    auto ents = world.spawn_batch<Position, Velocity>(count);
+    std::vector<Entity> targets(ents.begin(), ents.end());
+    f64 full_ms = 0.0, changed_ms = 0.0;
+    u32 visited = 0;
+    auto sync = [](const Position& p, Velocity& v) { v.x = p.x; v.y = p.y; v.z = p.z; };
+    for (u32 f = 0; f < frames; ++f) {
+        world.clear_trackers();
+        // 疎な書き込み: dirty 個の Entity だけ動かす
+        for (u32 i = 0; i < dirty; ++i) world.get_component<Position>(targets[(i * 7919u + f) % count])->x += 1.0f;
+
+        auto t0 = Clock::now();
+        world.each<const Position, Velocity>(sync);
+        auto t1 = Clock::now();
+        visited = 0;
+        world.query().changed<Position>().each<const Position, Velocity>([&](const Position& p, Velocity& v) {
+            sync(p, v);
+            ++visited;
+        });
+        auto t2 = Clock::now();
+        full_ms    += std::chrono::duration<f64, std::milli>(t1 - t0).count();
+        changed_ms += std::chrono::duration<f64, std::milli>(t2 - t1).count();
+    }
+    std::printf("  entities=%u  dirty=%u  full %7.3f ms  changed %7.3f ms  (visited %u)\n",
+                count, dirty, full_ms / frames, changed_ms / frames, visited);
+}
+
+// ── 関係: 親ごとの子の列挙 ──────────────────────────────
+static void bench_children(u32 parents, u32 children, u32 lookups) {
+    World world;
+    std::vector<Entity> ps(parents);
+    for (u32 i = 0; i < parents; ++i) ps[i] = world.spawn();
+    world.spawn_batch<Comp<0>, ChildOf>(parents * children, [&](u32 i, Comp<0>& c, ChildOf& rel) {
+        c.v[0] = 1.0f;
+        rel.target = ps[i % parents];
+    });
+
+    // 索引なし: ChildOf を全走査して親が一致するものを拾う
+    f32 sum = 0;
+    auto t0 = Clock::now();
+    for (u32 l = 0; l < lookups; ++l) {
+        const Entity parent = ps[(l * 7) % parents];
+        world.each<const Comp<0>, const ChildOf>([&](const Comp<0>& c, const ChildOf& rel) {
+            if (rel.target == parent) sum += c.v[0];
+        });
+    }
+    f64 scan_us = std::chrono::duration<f64, std::micro>(Clock::now() - t0).count() / lookups;
+
+    t0 = Clock::now();
+    for (u32 l = 0; l < lookups; ++l) {
+        world.each_source<ChildOf>(ps[(l * 7) % parents], [&](Entity) { sum += 1.0f; });
+    }
+    f64 index_us = std::chrono::duration<f64, std::micro>(Clock::now() - t0).count() / lookups;
+
+    t0 = Clock::now();
+    for (u32 l = 0; l < lookups; ++l) {
+        world.query().targeting<ChildOf>(ps[(l * 7) % parents]).each<const Comp<0>>([&](const Comp<0>& c) {
+            sum += c.v[0];
+        });
+    }
+    f64 query_us = std::chrono::duration<f64, std::micro>(Clock::now() - t0).count() / lookups;
+    std::printf("  %u children of %u parents  scan %8.2f us   each_source %6.2f us   targeting %6.2f us"
+                "  (sink=%.0f)\n",
+                parents * children, parents, scan_us, index_us, query_us, static_cast<f64>(sum));
+}
+
+// ── 大量 despawn 後の整理 ───────────────────────────────
+static void bench_compact(u32 count, u32 kinds) {
+    World world;
+    std::vector<Entity> es;
+    es.reserve(count);
+    // kinds 種類の構成に散らし、1 種だけ残して despawn
+    for (u32 k = 0; k < kinds; ++k) {
+        auto spawned = world.spawn_batch<Comp<0>, Comp<1>>(count / kinds);
+        for (Entity e : spawned) {
+            if (k & 1)  world.add_component(e, Comp<2>{});
+            if (k & 2)  world.add_component(e, Comp<3>{});
+            if (k & 4)  world.add_component(e, Comp<4>{});
+            if (k & 8)  world.add_component(e, Comp<5>{});
+            if (k & 16) world.add_component(e, Comp<6>{});
+            if (k & 32) world.add_component(e, Comp<7>{});
+        }
+        es.insert(es.end(), spawned.begin(), spawned.end());
+    }
+    for (usize i = 0; i < es.size(); ++i) {
+        if (i >= count / kinds || (i & 1)) world.despawn(es[i]);
+    }
+    world.spawn_batch<Comp<0>, Comp<1>>(count / kinds / 4);   // 空き番号を再利用 → 行順が崩れる
+
+    const usize before = world.chunk_pool().bytes_reserved();
+    u32 frames = 0;
+    usize reclaimed = 0;
+    f64 worst_ms = 0.0;
+    CompactStats st;
+    auto t0 = Clock::now();
+    while (!st.done) {
+        auto f0 = Clock::now();
+        st = world.compact(1000.0, {.sort_rows = true});
+        worst_ms = std::max(worst_ms, std::chrono::duration<f64, std::milli>(Clock::now() - f0).count());
+        reclaimed += st.bytes_reclaimed;
+        ++frames;
+    }
+    f64 total_ms = std::chrono::duration<f64, std::milli>(Clock::now() - t0).count();
+    std::printf("  %u entities / %u archetypes  reserved %.1f MB -> %.1f MB  reclaimed %.1f MB\n"
+                "  compact %u frames (1ms budget)  worst %.2f ms  total %.2f ms  archetypes left %u\n",
+                count, kinds, before / 1048576.0, world.chunk_pool().bytes_reserved() / 1048576.0,
+                reclaimed / 1048576.0, frames, worst_ms, total_ms, world.archetype_count());
+}
+
+static void bench_snapshot(u32 count) {
+    World world;
+    world.spawn_batch<Comp<0>, Comp<1>>(count, [](u32 i, Comp<0>& p, Comp<1>& v) {
+        p = {{static_cast<f32>(i), 0, 0, 0}};
+        v = {{1, 1, 1, 1}};
+    });
+    world.spawn_batch<Comp<0>, MarkerTag>(count / 10);
+
+    auto ms = [](Clock::time_point t0) { return std::chrono::duration<f64, std::milli>(Clock::now() - t0).count(); };
+    std::vector<u8> bytes;
+    auto t0 = Clock::now();
+    bool saved = world.save_snapshot(bytes).has_value();
+    f64 save_ms = ms(t0);
+
+    World loaded;
+    t0 = Clock::now();
+    bool ok = loaded.load_snapshot(bytes).has_value();
+    f64 load_ms = ms(t0);
+
+    const std::string path = "/tmp/engine_bench_snapshot.bin";
+    (void)world.save_snapshot(path);
+    World from_file;
+    t0 = Clock::now();
+    bool file_ok = from_file.load_snapshot(path).has_value();
+    f64 file_ms = ms(t0);
+
+    World mapped;
+    t0 = Clock::now();
+    bool map_ok = mapped.map_snapshot(path).has_value();
+    f64 map_ms = ms(t0);
+    // 写像したカラムを初めて読む / 書くときのページフォールト
+    f32 sum = 0.0f;
+    t0 = Clock::now();
+    mapped.query().each<const Comp<0>>([&](const Comp<0>& p) { sum += p.v[0]; });
+    f64 first_read_ms = ms(t0);
+    t0 = Clock::now();
+    mapped.query().each<Comp<1>>([](Comp<1>& v) { v.v[0] += 1.0f; });
+    f64 first_write_ms = ms(t0);
+    std::remove(path.c_str());
+
+    std::printf("  %u entities  %.1f MB  save %.2f ms  load %.2f ms  load(file) %.2f ms  %s\n",
+                world.entity_count(), bytes.size() / 1048576.0, save_ms, load_ms, file_ms,
+                saved && ok && file_ok && loaded.entity_count() == world.entity_count() ? "ok" : "FAILED");
+    std::printf("  map %.2f ms (%zu pool chunks)  first read %.2f ms  first write (copy-on-write) %.2f ms  %s\n",
+                map_ms, mapped.chunk_pool().chunks_in_use(), first_read_ms, first_write_ms,
+                map_ok && mapped.entity_count() == world.entity_count() && sum > 0.0f ? "ok" : "FAILED");
+}
+
+int main() {
+    Logger::instance().set_level(LogLevel::Warn);
+    std::printf("=== SystemScheduler 30 システムパイプライン ===\n");
+    bench_scheduler(30, 10000, 50);
+    bench_scheduler_overhead(30, 100000);
+
+    std::printf("=== spawn + add_component レイテンシ ===\n");
+    bench_spawn_latency(1000000);
+
+    std::printf("=== add / remove_component ===\n");
+    bench_add_remove(10000, 1000000);
+    bench_observers(10000, 1000000, 16);
+    bench_sparse_toggle(10000, 1000000);
+
+    std::printf("=== パーティクルバースト生成 ===\n");
+    bench_spawn_burst(10000, 20);
+
+    std::printf("=== クエリ反復 (Position += Velocity * dt) ===\n");
+    bench_query_iteration(1000000, 20);
+
+    std::printf("=== キャッシュ済みクエリ ===\n");
+    bench_cached_query(10000);
+
+    std::printf("=== 並列クエリ (500k 移動システム) ===\n");
+    bench_par_each(500000, 50);
+
+    std::printf("=== CommandBuffer (par_each から set_component) ===\n");
+    bench_command_buffer(500000, 10);
+    bench_command_coalesce(10000, 10);
+
+    std::printf("=== 変更検知フィルタ ===\n");
+    bench_changed_filter(1000000, 100, 20);
+
+    std::printf("=== 関係 (ChildOf の子列挙) ===\n");
+    bench_children(1000, 100, 200);
+
+    std::printf("=== 大量 despawn 後の compact ===\n");
+    bench_compact(1000000, 64);
+
+    std::printf("=== World スナップショット ===\n");
+    bench_snapshot(1000000);
+    return 0;
+}
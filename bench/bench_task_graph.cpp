@@ -0,0 +1,170 @@
+/**
+ * bench/bench_task_graph.cpp — JobSystem マイクロベンチマーク
+ *
+ * ワーカー数ごとのスループット (jobs/sec) を計測。
+ * 各ジョブが子ジョブを2つ投入する二分木で、
+ * ローカル push / pop と steal の両経路に負荷をかける。
+ *
+ * 全ワーカーがパークした状態からの起床レイテンシも計測。
+ * 10k ノード TaskGraph の毎フレーム再構築コストと、
+ * compile 済みグラフの再実行コストを比較。
+ * Background 負荷下での High ジョブのレイテンシも計測。
+ */
+#include <engine/core/types.hpp>
+#include <engine/core/log.hpp>
+#include <engine/core/task_graph.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+using namespace engine;
+using Clock = std::chrono::steady_clock;
+
+// ── ジョブスループット ──────────────────────────────────
+static void bench_throughput(u32 workers, u32 job_count, u32 rounds) {
+    JobSystem js(workers);
+    std::vector<Job> jobs(job_count);
+    std::atomic<u32> sink{0};
+
+    for (u32 i = 0; i < job_count; ++i) {
+        jobs[i].func = [&, i] {
+            sink.fetch_add(1, std::memory_order_relaxed);
+            u32 l = 2 * i + 1, r = 2 * i + 2;
+            if (l < job_count) js.submit(&jobs[l]);
+            if (r < job_count) js.submit(&jobs[r]);
+        };
+    }
+
+    f64 best = 0.0;
+    for (u32 round = 0; round < rounds; ++round) {
+        for (auto& j : jobs) j.completed.store(false, std::memory_order_relaxed);
+        auto t0 = Clock::now();
+        js.submit(&jobs[0]);
+        js.wait_all();
+        f64 sec = std::chrono::duration<f64>(Clock::now() - t0).count();
+        best = std::max(best, job_count / sec);
+    }
+    std::printf("  workers=%2u  jobs=%u  %12.0f jobs/sec\n", workers, job_count, best);
+}
+
+// ── 起床レイテンシ ──────────────────────────────────────
+static void bench_wake_latency(u32 spin_budget, u32 samples) {
+    JobSystem js(JobSystemDesc{2, spin_budget});
+    std::vector<f64> lat;
+    lat.reserve(samples);
+
+    for (u32 s = 0; s < samples; ++s) {
+        // ワーカーが確実にパークするまで待つ
+        while (js.parked_count() < js.worker_count()) {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+        Job job;
+        Clock::time_point started;
+        job.func = [&] { started = Clock::now(); };
+        auto t0 = Clock::now();
+        js.submit(&job);
+        // 外部スレッドが実行しないよう wait() は使わない
+        while (!job.completed.load(std::memory_order_acquire)) {
+            std::this_thread::yield();
+        }
+        lat.push_back(std::chrono::duration<f64, std::micro>(started - t0).count());
+    }
+
+    std::sort(lat.begin(), lat.end());
+    std::printf("  spin=%4u  p50=%8.2f us  p99=%8.2f us  max=%8.2f us\n",
+                spin_budget, lat[lat.size() / 2], lat[lat.size() * 99 / 100], lat.back());
+}
+
+// ── TaskGraph 毎フレーム再構築 ─────────────────────────
+static void bench_graph_rebuild(u32 nodes, u32 frames) {
+    JobSystem js;
+    TaskGraph graph(js);
+    std::vector<Job*> handles(nodes);
+    std::atomic<u32> sink{0};
+
+    auto t0 = Clock::now();
+    for (u32 f = 0; f < frames; ++f) {
+        for (u32 i = 0; i < nodes; ++i) {
+            handles[i] = graph.add("node", [&sink] { sink.fetch_add(1, std::memory_order_relaxed); });
+            if (i > 0) graph.depends_on(handles[i], handles[(i - 1) / 2]);
+        }
+        graph.execute();
+        graph.clear();
+    }
+    f64 ms = std::chrono::duration<f64, std::milli>(Clock::now() - t0).count() / frames;
+    std::printf("  nodes=%u  %8.3f ms/frame (build + execute + clear)\n", nodes, ms);
+}
+
+// ── compile 済み TaskGraph の再実行 ─────────────────────
+static void bench_graph_compiled(u32 nodes, u32 frames) {
+    JobSystem js;
+    TaskGraph graph(js);
+    std::vector<Job*> handles(nodes);
+    std::atomic<u32> sink{0};
+    for (u32 i = 0; i < nodes; ++i) {
+        handles[i] = graph.add("node", [&sink] { sink.fetch_add(1, std::memory_order_relaxed); });
+        if (i > 0) graph.depends_on(handles[i], handles[(i - 1) / 2]);
+    }
+    graph.compile();
+
+    auto t0 = Clock::now();
+    for (u32 f = 0; f < frames; ++f) {
+        graph.execute();
+    }
+    f64 ms = std::chrono::duration<f64, std::milli>(Clock::now() - t0).count() / frames;
+    std::printf("  nodes=%u  %8.3f ms/frame (compiled, execute only)\n", nodes, ms);
+}
+
+// ── Background 負荷下の High レイテンシ ─────────────────
+static void bench_priority_latency(u32 background_workers, u32 samples) {
+    JobSystem js(JobSystemDesc{2, 256, background_workers});
+    constexpr u32 stream_jobs = 64;
+    std::vector<Job> stream(stream_jobs);
+    for (auto& j : stream) {
+        j.func = [] { std::this_thread::sleep_for(std::chrono::milliseconds(2)); };
+        js.submit(&j, JobPriority::Background);
+    }
+
+    std::vector<f64> lat;
+    lat.reserve(samples);
+    for (u32 s = 0; s < samples; ++s) {
+        Job job;
+        Clock::time_point started;
+        job.func = [&] { started = Clock::now(); };
+        auto t0 = Clock::now();
+        js.submit(&job, JobPriority::High);
+        while (!job.completed.load(std::memory_order_acquire)) std::this_thread::yield();
+        lat.push_back(std::chrono::duration<f64, std::micro>(started - t0).count());
+    }
+    js.wait_all();
+
+    std::sort(lat.begin(), lat.end());
+    std::printf("  background_workers=%u  p50=%8.2f us  p99=%8.2f us\n",
+                background_workers, lat[lat.size() / 2], lat[lat.size() * 99 / 100]);
+}
+
+int main() {
+    Logger::instance().set_level(LogLevel::Warn);
+    std::printf("=== JobSystem スループット ===\n");
+    u32 hw = std::max(1u, std::thread::hardware_concurrency());
+    for (u32 w = 1; w <= hw; w *= 2) {
+        bench_throughput(w, (1u << 18) - 1, 5);
+    }
+
+    std::printf("=== JobSystem 起床レイテンシ (パーク状態から) ===\n");
+    for (u32 spin : {0u, 256u, 4096u}) {
+        bench_wake_latency(spin, 200);
+    }
+
+    std::printf("=== TaskGraph 再構築 ===\n");
+    bench_graph_rebuild(10000, 100);
+    bench_graph_compiled(10000, 100);
+
+    std::printf("=== Background 負荷下の High ジョブ起動レイテンシ ===\n");
+    bench_priority_latency(0, 100);
+    bench_priority_latency(1, 100);
+    return 0;
+}
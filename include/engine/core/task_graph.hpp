@@ -1,87 +1,394 @@
 /**
  * engine/core/task_graph.hpp — Work-stealing タスクシステム
  *
- * JobSystem: ワーカースレッド群 + lock-free キュー
+ * JobSystem: ワーカースレッド群 + lock-free キュー (Chase-Lev)
  * TaskGraph: 依存関係のあるジョブのDAG実行
  */
 #pragma once
 
 #include "types.hpp"
+#include "work_stealing_deque.hpp"
 #include <functional>
 #include <thread>
 #include <atomic>
 #include <mutex>
-#include <condition_variable>
-#include <deque>
 #include <vector>
 #include <memory>
+#include <new>
 
 namespace engine {
 
+// ── ジョブ関数 (スモールバッファ最適化) ─────────────────
+// inline_size 以下のクロージャはヒープ確保せずインライン保持。
+// それを超えるクロージャのみヒープへフォールバックする。
+class JobFunc {
+public:
+    static constexpr usize inline_size = 48;
+
+    JobFunc() = default;
+    JobFunc(std::nullptr_t) {}
+
+    template <typename F>
+        requires (!std::same_as<std::remove_cvref_t<F>, JobFunc> &&
+                  std::invocable<std::remove_cvref_t<F>&>)
+    JobFunc(F&& f) { emplace(std::forward<F>(f)); }
+
+    JobFunc(JobFunc&& o) noexcept { move_from(o); }
+    JobFunc& operator=(JobFunc&& o) noexcept {
+        if (this != &o) { reset(); move_from(o); }
+        return *this;
+    }
+    JobFunc(const JobFunc&) = delete;
+    JobFunc& operator=(const JobFunc&) = delete;
+    ~JobFunc() { reset(); }
+
+    void operator()() { invoke_(storage_); }
+    explicit operator bool() const { return invoke_ != nullptr; }
+
+    void reset() {
+        if (manage_) manage_(nullptr, storage_);
+        invoke_ = nullptr;
+        manage_ = nullptr;
+    }
+
+private:
+    using InvokeFn = void (*)(void*);
+    using ManageFn = void (*)(void* dst, void* src);  // dst == nullptr なら破棄のみ
+
+    template <typename F>
+    void emplace(F&& f) {
+        using D = std::remove_cvref_t<F>;
+        if constexpr (std::is_same_v<D, std::function<void()>>) {
+            if (!f) return;
+        }
+        if constexpr (sizeof(D) <= inline_size && alignof(D) <= alignof(std::max_align_t) &&
+                      std::is_nothrow_move_constructible_v<D>) {
+            ::new (storage_) D(std::forward<F>(f));
+            invoke_ = [](void* p) { (*static_cast<D*>(p))(); };
+            manage_ = [](void* dst, void* src) {
+                auto* s = static_cast<D*>(src);
+                if (dst) ::new (dst) D(std::move(*s));
+                s->~D();
+            };
+        } else {
+            *reinterpret_cast<D**>(storage_) = new D(std::forward<F>(f));
+            invoke_ = [](void* p) { (**static_cast<D**>(p))(); };
+            manage_ = [](void* dst, void* src) {
+                if (dst) *static_cast<D**>(dst) = *static_cast<D**>(src);
+                else     delete *static_cast<D**>(src);
+            };
+        }
+    }
+
+    void move_from(JobFunc& o) {
+        if (o.manage_) o.manage_(storage_, o.storage_);
+        invoke_ = o.invoke_;
+        manage_ = o.manage_;
+        o.invoke_ = nullptr;
+        o.manage_ = nullptr;
+    }
+
+    alignas(std::max_align_t) u8 storage_[inline_size];
+    InvokeFn invoke_ = nullptr;
+    ManageFn manage_ = nullptr;
+};
+
+// ── ジョブ優先度 ────────────────────────────────────────
+// 優先度ごとに独立したレーン (デック + 投入口) を持ち、常に High → Normal
+// → Background の順で取り出す。
+enum class JobPriority : u8 {
+    High       = 0,   // フレームクリティカル (レイテンシ優先)
+    Normal     = 1,
+    Background = 2,   // ストリーミング / 解凍など、フレームを跨いでよい処理
+};
+
+inline constexpr u32 job_priority_count = 3;
+
 // ── ジョブ ──────────────────────────────────────────────
-using JobFunc = std::function<void()>;
+struct Job;
+
+// 依存先リストのノード (JobPool が所有する侵入型リスト)
+struct JobLink {
+    Job*     job  = nullptr;
+    JobLink* next = nullptr;
+};
 
 struct Job {
     JobFunc              func;
     std::atomic<i32>     unfinished_deps{0};
-    std::vector<Job*>    dependents;        // このジョブ完了後に発火
+    JobLink*             dependents = nullptr;  // このジョブ完了後に発火
     std::atomic<bool>    completed{false};
+    JobPriority          priority = JobPriority::Normal;
+
+    /// 再利用のため初期状態に戻す
+    void reset() {
+        func.reset();
+        unfinished_deps.store(0, std::memory_order_relaxed);
+        dependents = nullptr;
+        completed.store(false, std::memory_order_relaxed);
+        priority = JobPriority::Normal;
+    }
+};
+
+// ── フレームスコープのジョブプール ──────────────────────
+// Job / JobLink をチャンク単位で確保し、reset() 後は再利用する。
+// ウォームアップ後はヒープ確保ゼロ。
+class JobPool {
+public:
+    JobPool() = default;
+    JobPool(const JobPool&) = delete;
+    JobPool& operator=(const JobPool&) = delete;
+
+    [[nodiscard]] Job*     acquire_job();
+    [[nodiscard]] JobLink* acquire_link();
+
+    /// 払い出した全 Job / JobLink を解放 (メモリは保持)
+    void reset();
+
+    [[nodiscard]] u32 jobs_in_use() const  { return jobs_used_; }
+    [[nodiscard]] u32 job_capacity() const { return static_cast<u32>(job_chunks_.size()) * chunk_size; }
+
+private:
+    static constexpr u32 chunk_size = 256;
+
+    std::vector<std::unique_ptr<Job[]>>     job_chunks_;
+    std::vector<std::unique_ptr<JobLink[]>> link_chunks_;
+    u32 jobs_used_  = 0;
+    u32 links_used_ = 0;
+};
+
+// ── ジョブシステム設定 ──────────────────────────────────
+struct JobSystemDesc {
+    u32 worker_count = 0;     // 0 = コア数 - 1
+    u32 spin_budget  = 256;   // パーク前にジョブを探すスピン回数 (0 = 即パーク)
+    // Background 専用ワーカー数 (worker_count とは別に起動)。
+    // 1 以上の場合、通常ワーカーは Background ジョブを実行しない
+    // (長時間ジョブがフレームワーカーを塞がないようにする)。
+    u32 background_workers = 0;
+    // 各ワーカーの優先度別デックと外部スレッド用投入口の初期容量 (ジョブ数)。
+    // 1 フレームに積むジョブ数以上にしておけば、実行中に拡張 (確保) しない
+    u32 initial_capacity = 1024;
 };
 
 // ── ジョブシステム (Work-Stealing) ──────────────────────
 class JobSystem {
 public:
     explicit JobSystem(u32 worker_count = 0);
+    explicit JobSystem(const JobSystemDesc& desc);
     ~JobSystem();
 
     JobSystem(const JobSystem&) = delete;
     JobSystem& operator=(const JobSystem&) = delete;
 
-    /// ジョブをキューに投入
+    /// ジョブをキューに投入 (job->priority のレーンへ)
     void submit(Job* job);
 
+    /// 優先度を指定して投入
+    void submit(Job* job, JobPriority priority);
+
     /// ジョブの完了を待つ
     void wait(Job* job);
 
     /// 全ジョブ完了を待つ
     void wait_all();
 
-    /// ワーカー数
-    [[nodiscard]] u32 worker_count() const { return static_cast<u32>(workers_.size()); }
+    /// [begin, end) を再帰的に二分割して並列実行。fn(chunk_begin, chunk_end)
+    /// 分割は「自分のキューが空の時だけ」行う (Lazy Binary Splitting)。
+    /// grain = 0 でワーカー数から自動決定。呼び出しスレッドも実行に参加する。
+    /// fn は例外を投げてはならない。
+    template <typename F>
+    void parallel_for(u32 begin, u32 end, u32 grain, F&& fn);
+
+    /// 並列リダクション。map(chunk_begin, chunk_end) -> T を combine(T, T) -> T で畳み込む。
+    /// combine は結合的であること (左→右の順序は保持、分割位置は実行毎に異なる)。
+    template <typename T, typename Map, typename Combine>
+    T parallel_reduce(u32 begin, u32 end, u32 grain, T identity, Map&& map, Combine&& combine);
+
+    /// ワーカー数 (Background 専用ワーカーを除く)
+    [[nodiscard]] u32 worker_count() const { return frame_workers_; }
+
+    /// Background 専用ワーカー数
+    [[nodiscard]] u32 background_worker_count() const {
+        return static_cast<u32>(queues_.size()) - frame_workers_;
+    }
+
+    /// 呼び出しスレッドのスロット番号 [0, thread_slot_count())。
+    /// ワーカー以外のスレッドは全て最後のスロット (= thread_slot_count() - 1) を共有する。
+    [[nodiscard]] u32 current_worker() const;
+
+    /// ワーカー (Background 専用を含む) + 外部スレッド用 1 スロット
+    [[nodiscard]] u32 thread_slot_count() const { return static_cast<u32>(queues_.size()) + 1; }
+
+    /// パーク前のスピン回数 (実行中に変更可)
+    void set_spin_budget(u32 spins) { spin_budget_.store(spins, std::memory_order_relaxed); }
+    [[nodiscard]] u32 spin_budget() const { return spin_budget_.load(std::memory_order_relaxed); }
+
+    /// 現在パーク中のワーカー数 (Background 専用ワーカーを含む)
+    [[nodiscard]] u32 parked_count() const {
+        return lots_[0].parked.load(std::memory_order_relaxed) +
+               lots_[1].parked.load(std::memory_order_relaxed);
+    }
 
 private:
+    // 各ワーカーの優先度別ローカルデック
+    struct WorkerQueues {
+        explicit WorkerQueues(u32 capacity)
+            : lanes{WorkStealingDeque<Job>{capacity}, WorkStealingDeque<Job>{capacity},
+                    WorkStealingDeque<Job>{capacity}} {}
+        static_assert(job_priority_count == 3);
+        WorkStealingDeque<Job> lanes[job_priority_count];
+    };
+
+    // ワーカー以外のスレッドからの投入口 (所有者 push 制約のため)
+    // リングバッファ: 満杯時のみ拡張し、以後は確保しない
+    struct InjectQueue {
+        std::mutex        mutex;
+        std::vector<Job*> ring;
+        u64               head = 0;
+        u64               tail = 0;
+        std::atomic<u32>  count{0};
+
+        void push(Job* job);
+        Job* pop();
+        void reserve(usize jobs);   // 構築時のみ (ワーカー起動前)
+    };
+
+    // イベントカウント: パーク中ワーカーがいる時だけ submit が epoch を進めて起こす
+    struct ParkingLot {
+        alignas(64) std::atomic<u32> epoch{0};
+        alignas(64) std::atomic<u32> parked{0};
+    };
+
     void worker_loop(u32 id);
-    Job* steal();
+    void run_job(Job* job);
+    Job* next_job(u32 self);      // self == queues_.size() は外部スレッド
+    Job* steal(u32 self, u32 lane);
+    u32  lane_mask(u32 self) const;
+    u32  lot_index(u32 self) const;
+    bool has_work(u32 mask) const;
+    bool should_fork() const;
+    u32  auto_grain(u32 range) const;
+    void park(u32 self);
+    void wake_one(u32 lane);
+    [[nodiscard]] static JobPriority current_priority();
 
     std::vector<std::thread>   workers_;
-    std::vector<std::deque<Job*>> queues_;  // 各ワーカーのローカルキュー
-    std::mutex                  mutex_;
-    std::condition_variable     cv_;
+    std::vector<std::unique_ptr<WorkerQueues>> queues_;   // [0, frame_workers_) が通常ワーカー
+    u32                         frame_workers_ = 0;
+    InjectQueue                 inject_[job_priority_count];
+    ParkingLot                  lots_[2];   // 0: 通常ワーカー, 1: Background 専用
+    std::atomic<u32>            spin_budget_{256};
     std::atomic<bool>           shutdown_{false};
-    std::atomic<u32>            active_jobs_{0};
+    std::atomic<u32>            pending_jobs_{0};  // 投入済み・未完了のジョブ数
+
+    template <typename F>
+    void for_split(u32 b, u32 e, u32 grain, F& fn);
+
+    template <typename T, typename Map, typename Combine>
+    T reduce_split(u32 b, u32 e, u32 grain, const T& identity, Map& map, Combine& combine);
 };
 
+// ── parallel_for / parallel_reduce (fork-join) ──────────
+// 分割した右半分はスタック上の Job として投入し、左半分を自分で処理した後
+// wait() で回収する。盗まれていなければ自分のデックから LIFO で取り戻す。
+// 分割ジョブは実行中ジョブの優先度を引き継ぐ。
+
+template <typename F>
+void JobSystem::parallel_for(u32 begin, u32 end, u32 grain, F&& fn) {
+    if (begin >= end) return;
+    if (grain == 0) grain = auto_grain(end - begin);
+    for_split(begin, end, grain, fn);
+}
+
+template <typename F>
+void JobSystem::for_split(u32 b, u32 e, u32 grain, F& fn) {
+    while (e - b > grain) {
+        if (should_fork()) {
+            u32 mid = b + (e - b) / 2;
+            Job right;
+            right.priority = current_priority();
+            right.func = [this, mid, e, grain, &fn] { for_split(mid, e, grain, fn); };
+            submit(&right);
+            for_split(b, mid, grain, fn);
+            wait(&right);
+            return;
+        }
+        // 手元に未消化の分割がある → 1 チャンク処理してから再判定
+        fn(b, b + grain);
+        b += grain;
+    }
+    fn(b, e);
+}
+
+template <typename T, typename Map, typename Combine>
+T JobSystem::parallel_reduce(u32 begin, u32 end, u32 grain, T identity, Map&& map, Combine&& combine) {
+    if (begin >= end) return identity;
+    if (grain == 0) grain = auto_grain(end - begin);
+    return reduce_split(begin, end, grain, identity, map, combine);
+}
+
+template <typename T, typename Map, typename Combine>
+T JobSystem::reduce_split(u32 b, u32 e, u32 grain, const T& identity, Map& map, Combine& combine) {
+    T acc = identity;
+    while (e - b > grain) {
+        if (should_fork()) {
+            u32 mid = b + (e - b) / 2;
+            T right_result = identity;
+            struct Ctx { JobSystem* js; const T* identity; Map* map; Combine* combine; T* out; };
+            Ctx ctx{this, &identity, &map, &combine, &right_result};
+            Job right;
+            right.priority = current_priority();
+            right.func = [&ctx, mid, e, grain] {
+                *ctx.out = ctx.js->reduce_split(mid, e, grain, *ctx.identity, *ctx.map, *ctx.combine);
+            };
+            submit(&right);
+            T left = reduce_split(b, mid, grain, identity, map, combine);
+            wait(&right);
+            return combine(combine(std::move(acc), std::move(left)), std::move(right_result));
+        }
+        acc = combine(std::move(acc), map(b, b + grain));
+        b += grain;
+    }
+    return combine(std::move(acc), map(b, e));
+}
+
 // ── タスクグラフ (DAG) ──────────────────────────────────
+// 使い方は2通り:
+//   1) 毎フレーム add / depends_on → execute → clear
+//   2) 一度 add / depends_on → compile し、以後は毎フレーム execute のみ
+//      (依存カウンタを一括リセットして同じトポロジを再実行)
 class TaskGraph {
 public:
     explicit TaskGraph(JobSystem& js) : js_(js) {}
 
-    /// ノード追加 (名前 + 関数)
-    Job* add(std::string_view name, JobFunc func);
+    /// ノード追加 (名前 + 関数 + 優先度)
+    Job* add(std::string_view name, JobFunc func, JobPriority priority = JobPriority::Normal);
 
     /// 依存関係: before → after (before が完了してから after 実行)
     void depends_on(Job* after, Job* before);
 
-    /// グラフ実行 (全ノード完了まで待機)
+    /// トポロジを確定 (依存リストを連続配列へ平坦化, ルート/初期カウンタを記録)。
+    /// 以後 add / depends_on は clear() まで無効。
+    void compile();
+
+    /// グラフ実行 (全ノード完了まで待機)。compile 済みなら何度でも再実行可
     void execute();
 
-    /// リセット
+    /// リセット (Job は JobPool に返却され次フレームで再利用)
     void clear();
 
+    [[nodiscard]] u32  job_count() const { return static_cast<u32>(jobs_.size()); }
+    [[nodiscard]] bool compiled() const  { return compiled_; }
+
 private:
     JobSystem&               js_;
-    std::vector<std::unique_ptr<Job>> jobs_;
-    std::vector<Job*>        roots_;   // 依存なしのルートジョブ
+    JobPool                  pool_;
+    std::vector<Job*>        jobs_;
+    std::vector<Job*>        roots_;   // 依存なしのルートジョブ (compile / execute 時に収集)
+    // compile 結果
+    std::vector<i32>         initial_deps_;  // jobs_ と同順
+    std::vector<JobLink>     flat_links_;    // 各ジョブの依存先を連続配置
+    bool                     compiled_ = false;
 };
 
 // ── グローバルJobSystem ─────────────────────────────────
@@ -0,0 +1,126 @@
+/**
+ * engine/core/work_stealing_deque.hpp — Chase-Lev Work-Stealing デック
+ *
+ * 所有スレッドは bottom 側で push / pop (LIFO)、
+ * 他スレッドは top 側から CAS で steal (FIFO)。
+ * メモリオーダーは Lê et al. "Correct and Efficient Work-Stealing
+ * for Weak Memory Models" (PPoPP'13) に準拠。
+ */
+#pragma once
+
+#include "types.hpp"
+#include <atomic>
+#include <bit>
+#include <memory>
+#include <vector>
+
+namespace engine {
+
+template <typename T>
+class WorkStealingDeque {
+public:
+    explicit WorkStealingDeque(u32 capacity = 1024)
+        : buffer_(new Buffer(std::bit_ceil(capacity < 2 ? 2u : capacity)))
+    {
+        retired_.emplace_back(buffer_.load(std::memory_order_relaxed));
+    }
+
+    WorkStealingDeque(const WorkStealingDeque&) = delete;
+    WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+    /// 所有スレッドのみ: 末尾へ追加
+    void push(T* item) {
+        i64 b = bottom_.load(std::memory_order_relaxed);
+        i64 t = top_.load(std::memory_order_acquire);
+        Buffer* buf = buffer_.load(std::memory_order_relaxed);
+        if (b - t > static_cast<i64>(buf->capacity) - 1) {
+            buf = grow(buf, b, t);
+        }
+        buf->put(b, item);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom_.store(b + 1, std::memory_order_relaxed);
+    }
+
+    /// 所有スレッドのみ: 末尾から取り出し (空なら nullptr)
+    T* pop() {
+        i64 b = bottom_.load(std::memory_order_relaxed) - 1;
+        Buffer* buf = buffer_.load(std::memory_order_relaxed);
+        bottom_.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        i64 t = top_.load(std::memory_order_relaxed);
+
+        if (t > b) {
+            // 空
+            bottom_.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        T* item = buf->get(b);
+        if (t == b) {
+            // 最後の1要素 → thief と競合
+            if (!top_.compare_exchange_strong(t, t + 1,
+                    std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                item = nullptr;
+            }
+            bottom_.store(b + 1, std::memory_order_relaxed);
+        }
+        return item;
+    }
+
+    /// 任意スレッド: 先頭から盗む (空 or 競合負けなら nullptr)
+    T* steal() {
+        i64 t = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        i64 b = bottom_.load(std::memory_order_acquire);
+        if (t >= b) return nullptr;
+
+        Buffer* buf = buffer_.load(std::memory_order_acquire);
+        T* item = buf->get(t);
+        if (!top_.compare_exchange_strong(t, t + 1,
+                std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            return nullptr;
+        }
+        return item;
+    }
+
+    /// 概算サイズ (他スレッドからは目安のみ)
+    [[nodiscard]] i64 size_approx() const {
+        i64 b = bottom_.load(std::memory_order_relaxed);
+        i64 t = top_.load(std::memory_order_relaxed);
+        return b > t ? b - t : 0;
+    }
+
+    [[nodiscard]] bool empty_approx() const { return size_approx() == 0; }
+
+private:
+    struct Buffer {
+        usize                            capacity;
+        usize                            mask;
+        std::unique_ptr<std::atomic<T*>[]> slots;
+
+        explicit Buffer(usize cap)
+            : capacity(cap), mask(cap - 1), slots(new std::atomic<T*>[cap]) {}
+
+        T* get(i64 i) const {
+            return slots[static_cast<usize>(i) & mask].load(std::memory_order_relaxed);
+        }
+        void put(i64 i, T* item) {
+            slots[static_cast<usize>(i) & mask].store(item, std::memory_order_relaxed);
+        }
+    };
+
+    Buffer* grow(Buffer* old, i64 b, i64 t) {
+        auto* buf = new Buffer(old->capacity * 2);
+        for (i64 i = t; i < b; ++i) buf->put(i, old->get(i));
+        // 旧バッファは steal 中の thief が参照し得るため破棄まで保持
+        retired_.emplace_back(buf);
+        buffer_.store(buf, std::memory_order_release);
+        return buf;
+    }
+
+    alignas(64) std::atomic<i64>     top_{0};
+    alignas(64) std::atomic<i64>     bottom_{0};
+    alignas(64) std::atomic<Buffer*> buffer_;
+    std::vector<std::unique_ptr<Buffer>> retired_;  // 所有スレッドのみ変更
+};
+
+} // namespace engine
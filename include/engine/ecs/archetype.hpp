@@ -2,15 +2,20 @@
  * engine/ecs/archetype.hpp — Archetype テーブル
  *
  * Archetype = 同一コンポーネント構成を持つ Entity の集合。
- * SoA メモリ配置でキャッシュ効率を最大化。
+ * 16KB チャンク単位の SoA メモリ配置でキャッシュ効率を最大化。
+ * 行番号はチャンクを跨いだ通し番号 (row = chunk * chunk_capacity + 行)。
+ * 変更検知用に、チャンク × カラムごとに追加 / 変更 tick を保持する。
+ * タグ (サイズ 0) もカラム番号を持つが、チャンク内の領域はなく行ごとのコピーもしない。
  */
 #pragma once
 
 #include "entity.hpp"
 #include "component.hpp"
+#include "chunk.hpp"
 #include <vector>
 #include <unordered_map>
 #include <algorithm>
+#include <atomic>
 #include <span>
 
 namespace engine::ecs {
@@ -28,18 +33,73 @@ inline ArchetypeID compute_archetype_id(std::span<const TypeID> types) {
     return h;
 }
 
+class Archetype;
+
+// ── Archetype 遷移辺 (1 コンポーネントの add / remove) ──
+// 構造変更時は辺を 1 回引き、source_columns に従ってカラム単位で memcpy する。
+struct ArchetypeEdge {
+    Archetype*       target = nullptr;
+    std::vector<i32> source_columns;   // target のカラム j ← 元カラム番号 (-1 = ゼロ初期化)
+    i32              added_column = -1; // add 辺: 追加されたカラムの target 内番号
+};
+
+// ── 変更 tick ───────────────────────────────────────────
+// システム実行・トリガー・clear_trackers ごとに 1 進む。32bit では長時間稼働で一周し
+// (30 システム × 60Hz で約 27 日)、大小比較が逆転するため 64bit で持つ
+using Tick = u64;
+
+// ── チャンク × カラムの変更 tick ────────────────────────
+// チャンク内のいずれかの行で最後に追加 / 書き込みが行われた tick (0 = なし)。
+// 行の移動時は移動元の tick を引き継ぐため、フィルタは取りこぼさない (過検出はあり得る)
+struct ColumnTicks {
+    Tick added   = 0;
+    Tick changed = 0;
+
+    /// changed を tick 以上に引き上げる。並列システムや par_each 内の get_component が
+    /// 同じチャンクの同じカラムへ同時に書き込み得るので、CAS で最大値を取る
+    /// (added は構造変更時にしか書かれず、構造変更は単一スレッド)
+    void raise_changed(Tick tick) {
+        std::atomic_ref<Tick> ref(changed);
+        Tick cur = ref.load(std::memory_order_relaxed);
+        while (cur < tick && !ref.compare_exchange_weak(cur, tick, std::memory_order_relaxed)) {}
+    }
+    /// raise_changed と並行して読める changed (並列クエリ中のフィルタ判定用)
+    [[nodiscard]] Tick load_changed() const {
+        return std::atomic_ref<Tick>(const_cast<Tick&>(changed)).load(std::memory_order_relaxed);
+    }
+};
+
 // ── Archetype テーブル ──────────────────────────────────
 class Archetype {
 public:
-    Archetype() = default;
-    explicit Archetype(std::vector<ComponentInfo> components);
+    Archetype(std::vector<ComponentInfo> components, ChunkPool& pool);
+    ~Archetype();
 
-    /// エンティティを追加 (全コンポーネントはゼロ初期化)
-    u32 add_entity(Entity entity);
+    Archetype(const Archetype&) = delete;
+    Archetype& operator=(const Archetype&) = delete;
 
-    /// エンティティを削除 (swap-remove)
+    /// エンティティを追加 (全コンポーネントはゼロ初期化、tick で追加扱い)
+    u32 add_entity(Entity entity, Tick tick);
+
+    /// 複数エンティティを連続行に一括追加 (チャンクは一度に確保、ゼロ初期化)。
+    /// 戻り値は先頭行 — 追加分は [先頭行, 先頭行 + size) を占める
+    u32 add_entities(std::span<const Entity> entities, Tick tick);
+
+    /// 外部の行データを末尾に一括追加 (スナップショット読み込み用)。
+    /// columns[i] はカラム i の連続 count 行 (タグは無視)。戻り値は先頭行
+    u32 append_rows(const Entity* entities, std::span<const u8* const> columns, u32 count, Tick tick);
+
+    /// 外部のチャンク画像 (レイアウトはこの Archetype と同一) をそのまま末尾チャンクにする。
+    /// 末尾チャンクが満杯のときのみ呼べる。ブロックはプールに返さず、所有者が寿命を保証する
+    u32 adopt_chunk(u8* data, u32 rows, Tick tick);
+
+    /// エンティティを削除 (末尾行と swap-remove)
     void remove_entity(u32 row);
 
+    /// edge.target へ行を移動 (カラム再配置表で一括コピー後、元行を swap-remove)。
+    /// 新しく増えたカラムは tick で追加扱い。戻り値は target 内の新しい行
+    u32 move_entity(u32 row, const ArchetypeEdge& edge, Tick tick);
+
     /// コンポーネントデータ取得
     [[nodiscard]] void*       get_component(u32 row, TypeID comp_id);
     [[nodiscard]] const void* get_component(u32 row, TypeID comp_id) const;
@@ -48,24 +108,110 @@ public:
     void set_component(u32 row, TypeID comp_id, const void* data);
 
     /// このArchetypeが特定コンポーネントを含むか
-    [[nodiscard]] bool has_component(TypeID comp_id) const;
+    [[nodiscard]] bool has_component(TypeID comp_id) const { return column_index(comp_id) >= 0; }
+
+    /// カラム番号 (component_infos() の添字)。含まない場合は -1
+    [[nodiscard]] i32 column_index(TypeID comp_id) const { return column_of(component_index(comp_id)); }
+
+    /// コンポーネントインデックス → カラム番号 (密な表を 1 回引くだけ)
+    [[nodiscard]] i32 column_of(u32 comp_index) const {
+        return comp_index < column_table_.size() ? column_table_[comp_index] : -1;
+    }
 
-    /// カラム (SoA) を直接取得
-    [[nodiscard]] ComponentColumn*       column(TypeID comp_id);
-    [[nodiscard]] const ComponentColumn* column(TypeID comp_id) const;
+    /// 構成コンポーネントのビットセット署名
+    [[nodiscard]] const ComponentMask& signature() const { return signature_; }
+
+    /// 行 × カラム番号で直接アクセス (ハッシュ検索なし)
+    [[nodiscard]] void* component_at(u32 row, u32 column) { return row_ptr(row, column); }
+
+    // ── 変更 tick ───────────────────────────────────────
+    [[nodiscard]] ColumnTicks& column_ticks(u32 chunk, u32 column) {
+        return ticks_[chunk * components_.size() + column];
+    }
+    [[nodiscard]] const ColumnTicks& column_ticks(u32 chunk, u32 column) const {
+        return ticks_[chunk * components_.size() + column];
+    }
+    /// row を含むチャンクの column を tick で変更済みにする
+    void mark_changed(u32 row, u32 column, Tick tick) {
+        column_ticks(row / chunk_capacity_, column).raise_changed(tick);
+    }
+    /// row を含むチャンクの column を tick で追加済みにする (構造変更と同じく単一スレッド)
+    void mark_added(u32 row, u32 column, Tick tick) {
+        ColumnTicks& t = column_ticks(row / chunk_capacity_, column);
+        t.added   = std::max(t.added, tick);
+        t.changed = std::max(t.changed, tick);
+    }
+
+    // ── 遷移辺キャッシュ (World が構築) ────────────────
+    [[nodiscard]] const ArchetypeEdge* add_edge(TypeID comp_id) const;
+    [[nodiscard]] const ArchetypeEdge* remove_edge(TypeID comp_id) const;
+    const ArchetypeEdge& set_add_edge(TypeID comp_id, ArchetypeEdge edge);
+    const ArchetypeEdge& set_remove_edge(TypeID comp_id, ArchetypeEdge edge);
+    /// 破棄される Archetype を指す辺を削除 (targets はアドレス順にソート済み)
+    void drop_edges_to(std::span<Archetype* const> targets);
+
+    // ── メモリ整理 (World::compact から) ────────────────
+    /// チャンク表 / tick 表の確保量 (チャンク本体は ChunkPool 側で数える)
+    [[nodiscard]] usize heap_bytes() const {
+        return chunks_.capacity() * sizeof(Chunk) + ticks_.capacity() * sizeof(ColumnTicks);
+    }
+    /// チャンク表 / tick 表の余剰容量を返し、減ったバイト数を返す
+    usize shrink();
+    /// 2 行の Entity と値を入れ替える (呼び出し側は両行の行番号を更新すること)。
+    /// 別チャンク間では両チャンクの tick を大きい方に揃える (過検出側)
+    void swap_rows(u32 a, u32 b);
+
+    // ── チャンクアクセス (クエリ / 並列反復の単位) ──────
+    [[nodiscard]] u32 chunk_count() const    { return static_cast<u32>(chunks_.size()); }
+    [[nodiscard]] u32 chunk_capacity() const { return chunk_capacity_; }
+    [[nodiscard]] u32 chunk_size(u32 chunk) const { return chunks_[chunk].count; }
+    [[nodiscard]] std::span<const Entity> chunk_entities(u32 chunk) const {
+        return {reinterpret_cast<const Entity*>(chunks_[chunk].data), chunks_[chunk].count};
+    }
+    /// チャンク内カラム先頭 (含まない場合は nullptr)
+    [[nodiscard]] void*       chunk_column(u32 chunk, TypeID comp_id);
+    [[nodiscard]] const void* chunk_column(u32 chunk, TypeID comp_id) const;
+    [[nodiscard]] void* chunk_column_at(u32 chunk, u32 column) {
+        return chunks_[chunk].data + column_offsets_[column];
+    }
+    /// チャンク先頭 (Entity 配列) とカラム位置 — チャンク画像の書き出し用
+    [[nodiscard]] const u8* chunk_data(u32 chunk) const { return chunks_[chunk].data; }
+    [[nodiscard]] u32   column_offset(u32 column) const { return column_offsets_[column]; }
+    [[nodiscard]] usize chunk_bytes() const { return chunk_bytes_; }
+
+    [[nodiscard]] Entity entity(u32 row) const {
+        return chunk_entities(row / chunk_capacity_)[row % chunk_capacity_];
+    }
 
     [[nodiscard]] ArchetypeID id() const { return id_; }
     [[nodiscard]] u32         count() const { return entity_count_; }
-    [[nodiscard]] std::span<const Entity>         entities() const { return {entities_.data(), entity_count_}; }
     [[nodiscard]] const std::vector<ComponentInfo>& component_infos() const { return components_; }
 
 private:
+    void push_chunk();
+    void pop_chunk();
+    void release_chunk(const Chunk& c);
+    void mark_added_chunk(u32 chunk, Tick tick);
+
+    [[nodiscard]] u8* row_ptr(u32 row, u32 column) const {
+        const Chunk& c = chunks_[row / chunk_capacity_];
+        return c.data + column_offsets_[column] + (row % chunk_capacity_) * components_[column].size;
+    }
+
     ArchetypeID                            id_ = 0;
     std::vector<ComponentInfo>             components_;
-    std::unordered_map<TypeID, u32>        comp_index_;   // TypeID → カラムindex
-    std::vector<ComponentColumn>           columns_;
-    std::vector<Entity>                    entities_;
+    ComponentMask                          signature_;
+    std::vector<i16>                       column_table_;  // コンポーネントインデックス → カラム (-1 = なし)
+    ChunkPool*                             pool_ = nullptr;
+    std::vector<u32>                       column_offsets_;  // チャンク先頭からのカラム位置
+    std::vector<u32>                       data_columns_;    // タグ以外のカラム番号 (行単位の処理対象)
+    u32                                    chunk_capacity_ = 0;
+    usize                                  chunk_bytes_ = ChunkPool::chunk_bytes;
+    std::vector<Chunk>                     chunks_;          // 末尾以外は常に満杯
+    std::vector<ColumnTicks>               ticks_;           // chunk * カラム数 + カラム
     u32                                    entity_count_ = 0;
+    std::unordered_map<TypeID, ArchetypeEdge> add_edges_;
+    std::unordered_map<TypeID, ArchetypeEdge> remove_edges_;
 };
 
 } // namespace engine::ecs
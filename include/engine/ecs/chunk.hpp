@@ -0,0 +1,52 @@
+/**
+ * engine/ecs/chunk.hpp — Archetype チャンクと固定サイズチャンクプール
+ *
+ * Chunk = 1 Archetype の N エンティティ分の全カラムを収める 16KB ブロック。
+ * 先頭に Entity 配列、続いて各コンポーネントの SoA 配列を配置。
+ * エンティティ追加時は新チャンクを足すだけで既存データは移動しない。
+ */
+#pragma once
+
+#include <engine/core/types.hpp>
+#include <vector>
+
+namespace engine::ecs {
+
+// ── チャンク ────────────────────────────────────────────
+struct Chunk {
+    u8*  data   = nullptr;   // ChunkPool から取得したブロック
+    u32  count  = 0;         // 使用中の行数
+    bool mapped = false;     // スナップショットの写像内 (プールに返さない)
+};
+
+// ── チャンクプール (World 単位で共有) ──────────────────
+class ChunkPool {
+public:
+    static constexpr usize chunk_bytes = 16 * 1024;
+    static constexpr usize chunk_align = 64;
+
+    ChunkPool() = default;
+    ~ChunkPool();
+
+    ChunkPool(const ChunkPool&) = delete;
+    ChunkPool& operator=(const ChunkPool&) = delete;
+
+    /// bytes == chunk_bytes ならフリーリストから再利用。
+    /// 1 行が 16KB を超える Archetype 用の大きなブロックは直接確保する。
+    [[nodiscard]] u8* acquire(usize bytes = chunk_bytes);
+    void release(u8* block, usize bytes = chunk_bytes);
+
+    /// フリーリストのブロックを最大 max_blocks 個 OS に返却し、解放したバイト数を返す
+    usize trim(usize max_blocks = ~usize{0});
+
+    [[nodiscard]] usize chunks_in_use() const  { return in_use_; }
+    [[nodiscard]] usize chunks_free() const    { return free_.size(); }
+    [[nodiscard]] usize bytes_reserved() const { return reserved_bytes_; }
+
+private:
+    std::vector<u8*> free_;
+    usize            in_use_         = 0;
+    usize            reserved_bytes_ = 0;   // プール + 大ブロックの総確保量
+};
+
+} // namespace engine::ecs
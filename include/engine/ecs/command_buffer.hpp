@@ -3,14 +3,33 @@
  *
  * フレーム中の Entity 操作をキューに蓄積し、
  * フレーム境界で一括適用 → スレッドセーフ維持。
+ *
+ * 記録はスレッドごとのストリーム (線形アリーナ) に可変長レコードとして
+ * パックして追記する。記録時のロックはなく、apply で全ストリームをマージして適用する。
+ *
+ * 適用順は (記録元, ソートキー, ストリーム生成順, 記録順)。SystemScheduler は実行ごとに
+ * 各システムへ実行順位どおりの記録元を割り当て、par_each は呼び出し元の記録元を
+ * ワーカーへ引き継ぐ。したがってシステムからの記録は run_parallel でも run (逐次) と
+ * 同じ順に適用される。記録元とソートキーがともに等しい別スレッドの記録 (スケジューラ外の
+ * スレッドなど) だけは、ストリーム生成順 = 各スレッドの初回記録順に依存する。
+ *
+ * 適用時はコマンドを Entity ごとにまとめ、最終的なコンポーネント構成を
+ * 求めてから 1 回だけ Archetype を移動する。despawn より前の追加・削除は捨てる。
+ * ただし despawn と関係コンポーネント (ChildOf など) の変更は他の Entity に波及するため、
+ * その Entity のそれまでのコマンドとともに記録位置で適用する (逐次適用と同じ結果になる)。
+ * 元からあるコンポーネントの削除 → 再追加は移動しないが、OnRemove / OnAdd を両方通知し
+ * 追加 tick を刻む。存在しないコンポーネントの追加 → 削除は何も起きなかったものとして扱う。
  */
 #pragma once
 
 #include "entity.hpp"
+#include "component.hpp"
 #include <engine/core/types.hpp>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <thread>
 #include <vector>
-#include <functional>
-#include <mutex>
 
 namespace engine::ecs {
 
@@ -25,21 +44,73 @@ enum class CommandType : u8 {
     SetComponent,   // コンポーネント上書き
 };
 
-// ── 単一コマンド ────────────────────────────────────────
-struct Command {
+// ── パック済みレコードのヘッダ ──────────────────────────
+// レコード = ヘッダ + コンポーネントデータ (comp_size バイト)。8 バイト境界に詰める
+struct CommandHeader {
     CommandType  type;
+    u8           comp_align = 0;
+    u16          comp_index = 0;   // component_index (記録時に解決済み)
+    u32          comp_size  = 0;
     Entity       entity;
-    TypeID       comp_id     = 0;
-    usize        comp_size   = 0;
-    u8           data[256] = {};  // インライン POD データ (256B まで)
+    TypeID       comp_id    = 0;
+};
+
+// 一時 Entity (CommandBuffer::spawn の戻り値) は最上位ビットを立てた世代で見分け、
+// 残りのビットに apply / clear ごとに進む epoch を入れる。index は epoch 内の通し番号 (0 から)。
+// World は生存 Entity に最上位ビットの立った世代を払い出さない
+inline constexpr u32 temp_generation_bit = 0x8000'0000u;
+
+[[nodiscard]] constexpr bool is_temp_generation(u32 generation) {
+    return (generation & temp_generation_bit) != 0;
+}
+
+// ── 適用統計 ────────────────────────────────────────────
+struct CommandApplyStats {
+    u32 commands         = 0;   // 適用対象のコマンド数
+    u32 entities         = 0;   // コマンドを受けた既存 / 新規 Entity 数
+    u32 spawned          = 0;
+    u32 despawned        = 0;
+    u32 migrations       = 0;   // 実際に行った Archetype 移動
+    u32 migrations_saved = 0;   // 1 コマンドずつ適用した場合の移動回数との差
+    u32 discarded        = 0;   // despawn で打ち消された / 無効 Entity 宛てのコマンド
+};
+
+// ── スレッド別ストリーム ────────────────────────────────
+struct CommandStream {
+    // 同じ記録元 / ソートキーで記録されたレコードの区間
+    struct Segment {
+        u32   source;
+        u32   sort_key;
+        usize begin;
+    };
+
+    std::unique_ptr<u8[]> bytes;          // 線形アリーナ (満杯時のみ倍々で拡張)
+    usize                 size     = 0;
+    usize                 capacity = 0;
+    u32                   records  = 0;
+    std::vector<Segment>  segments;
+    u32                   source   = 0;   // 記録元 (SystemScheduler が実行順位を設定)
+    u32                   sort_key = 0;
+    u32                   order    = 0;   // 生成順 (記録元 / ソートキーが同じ区間のタイブレーク)
+    std::thread::id       owner;
+    CommandStream*        next     = nullptr;
+
+    /// n バイトを追記用に確保して先頭を返す
+    u8* append(usize n);
 };
 
 // ── CommandBuffer ────────────────────────────────────────
 class CommandBuffer {
 public:
-    CommandBuffer() = default;
+    CommandBuffer();
+    ~CommandBuffer();
+
+    CommandBuffer(const CommandBuffer&) = delete;
+    CommandBuffer& operator=(const CommandBuffer&) = delete;
 
-    /// Entity 生成予約
+    /// Entity 生成予約。戻り値の一時 Entity はこのバッファの次の apply / clear までのコマンドにだけ
+    /// 使える (それ以降に記録したコマンドは apply 時に破棄される)。
+    /// 正式な Entity は apply 後にクエリや関係から引くこと
     Entity spawn();
 
     /// Entity 破棄予約
@@ -48,53 +119,135 @@ public:
     /// コンポーネント追加
     template <Component T>
     void add_component(Entity entity, const T& comp) {
-        Command cmd;
-        cmd.type = CommandType::AddComponent;
-        cmd.entity = entity;
-        cmd.comp_id = type_id<T>();
-        cmd.comp_size = sizeof(T);
-        static_assert(sizeof(T) <= sizeof(cmd.data), "Component too large for inline buffer");
-        std::memcpy(cmd.data, &comp, sizeof(T));
-        push(cmd);
+        record(CommandType::AddComponent, entity, type_id<T>(), component_index<T>(), component_size_v<T>, alignof(T), &comp);
     }
 
     /// コンポーネント削除
     template <Component T>
     void remove_component(Entity entity) {
-        Command cmd;
-        cmd.type = CommandType::RemoveComponent;
-        cmd.entity = entity;
-        cmd.comp_id = type_id<T>();
-        push(cmd);
+        record(CommandType::RemoveComponent, entity, type_id<T>(), component_index<T>(), 0, 0, nullptr);
     }
 
     /// コンポーネント上書き
     template <Component T>
     void set_component(Entity entity, const T& comp) {
-        Command cmd;
-        cmd.type = CommandType::SetComponent;
-        cmd.entity = entity;
-        cmd.comp_id = type_id<T>();
-        cmd.comp_size = sizeof(T);
-        static_assert(sizeof(T) <= sizeof(cmd.data), "Component too large for inline buffer");
-        std::memcpy(cmd.data, &comp, sizeof(T));
-        push(cmd);
+        record(CommandType::SetComponent, entity, type_id<T>(), component_index<T>(), component_size_v<T>, alignof(T), &comp);
     }
 
-    /// World に一括適用
-    void apply(World& world);
+    /// 呼び出しスレッドのソートキーを設定。記録元が同じ記録はキー順に適用するため、
+    /// 並列記録でもキーを決めておけばスレッド割り当てに依存しない
+    void set_sort_key(u32 key);
+    [[nodiscard]] u32 sort_key();
+
+    /// 呼び出しスレッドの記録元を設定 (最優先の整列キー)。通常は SystemScheduler が設定する
+    void set_sort_source(u32 source);
+    [[nodiscard]] u32 sort_source();
+
+    /// 以前に払い出したどの記録元よりも後ろの連続 count 個を払い出し (戻り値は先頭)、
+    /// 呼び出しスレッドの記録元をその後ろへ進める。SystemScheduler が実行ごとに
+    /// 先頭 + 実行順位を各システムの記録元にする
+    u32 claim_sort_sources(u32 count);
+
+    /// 呼び出しスレッドの現在のキーの直後から count 個の連続キーを払い出し (戻り値は先頭)、
+    /// 呼び出しスレッドのキーをその後ろへ進める。par_each は作業番号ごとにこのキーで記録するので、
+    /// 呼び出し前後に同じスレッドで記録したコマンドとの順序が保たれる
+    u32 claim_sort_keys(u32 count);
 
-    /// バッファクリア
+    /// World に一括適用 (記録中のスレッドがないこと)。最後に World::flush_observers() を呼ぶ
+    CommandApplyStats apply(World& world);
+
+    /// バッファクリア (アリーナの容量は保持)
     void clear();
 
-    [[nodiscard]] usize pending() const { return commands_.size(); }
+    /// 記録済みコマンド数 (記録中は概算)
+    [[nodiscard]] usize pending() const;
+
+    /// 全ストリームの記録済みバイト数
+    [[nodiscard]] usize bytes_used() const;
 
 private:
-    void push(const Command& cmd);
+    CommandStream& local_stream();
+    void record(CommandType type, Entity entity, TypeID comp_id, u32 comp_index,
+                usize size, usize align, const void* data);
+    void apply_entity(World& world, u32 head, CommandApplyStats& stats);
+    // 関係コンポーネントの値 data 内の一時 Entity を temp_to_real_ で置き換える
+    void resolve_relation_target(World& world, u32 comp_index, u8* data) const;
+    // 現在の epoch の一時 Entity の世代
+    [[nodiscard]] u32 temp_generation() const {
+        return temp_generation_bit | temp_epoch_.load(std::memory_order_relaxed);
+    }
 
-    std::vector<Command> commands_;
-    std::mutex           mutex_;
-    u32                  next_temp_index_ = 0xFFFF0000;
+    // 適用順に並べたレコード区間 (apply 間で再利用)
+    struct MergeRange {
+        u32            source;
+        u32            sort_key;
+        u32            order;
+        usize          begin;
+        usize          end;
+        CommandStream* stream;
+    };
+
+    // Entity 単位にまとめるための参照 (同じ index のコマンドを適用順に連結)
+    static constexpr u32 no_op = ~0u;
+    struct EntityOp {
+        u64       entity;
+        const u8* record;
+        u32       next;
+    };
+    struct Chain {
+        u32 head;
+        u32 tail;
+    };
+
+    // 1 Entity 分のコンポーネントの最終状態
+    struct PendingComponent {
+        TypeID    id;
+        u32       index;   // component_index(id)
+        u32       size;
+        u16       align;
+        bool      initially_present;
+        bool      present;
+        const u8* data;   // 最後に書き込む値 (nullptr なら書き込みなし)
+        bool      reset = false;   // 元からあったものを削除した (最終的に残れば再追加)
+    };
+
+    std::atomic<CommandStream*> streams_{nullptr};   // 先頭追加のみの片方向リスト
+    std::atomic<u32>            stream_count_{0};
+    std::atomic<u32>            next_source_{1};      // 0 はスケジューラ外の既定値
+    std::atomic<u32>            next_temp_index_{0};
+    std::atomic<u32>            temp_epoch_{0};       // 一時 Entity の世代の下位ビット (apply / clear ごとに進む)
+    u64                         uid_;                 // スレッドローカルキャッシュの識別子
+
+    // apply の作業領域 (容量は保持して再利用)
+    std::vector<MergeRange>       merge_;
+    std::vector<Entity>           temp_to_real_;      // 添字 = 一時 Entity の index
+    std::vector<EntityOp>         ops_;
+    std::vector<Chain>            chains_;            // 添字 = Entity index
+    std::vector<PendingComponent> pending_;
+    std::vector<ComponentInfo>    adds_;
+    std::vector<u32>              removes_;
+};
+
+// ── 記録元 / ソートキーの一時切り替え ──────────────────
+class SortKeyScope {
+public:
+    SortKeyScope(CommandBuffer& cb, u32 source, u32 key)
+        : cb_(cb), source_(cb.sort_source()), key_(cb.sort_key()) {
+        cb.set_sort_source(source);
+        cb.set_sort_key(key);
+    }
+    ~SortKeyScope() {
+        cb_.set_sort_source(source_);
+        cb_.set_sort_key(key_);
+    }
+
+    SortKeyScope(const SortKeyScope&) = delete;
+    SortKeyScope& operator=(const SortKeyScope&) = delete;
+
+private:
+    CommandBuffer& cb_;
+    u32            source_;
+    u32            key_;
 };
 
 } // namespace engine::ecs
@@ -1,65 +1,118 @@
 /**
- * engine/ecs/component.hpp — コンポーネント型情報 + SoA ストレージ
+ * engine/ecs/component.hpp — コンポーネント型情報
+ *
+ * データ本体は Archetype のチャンク (chunk.hpp) に SoA で格納される。
+ * 各型には 0 から始まる連番 (コンポーネントインデックス) を振り、
+ * Archetype の署名ビットセットとカラム表の添字に使う。
+ * 空の型 (タグ) はサイズ 0 として扱い、署名にだけ現れる (チャンク内の領域なし)。
  */
 #pragma once
 
 #include <engine/core/types.hpp>
 #include <engine/core/memory.hpp>
+#include <bit>
 #include <cstring>
+#include <span>
+#include <type_traits>
 #include <vector>
 #include <cassert>
 
 namespace engine::ecs {
 
+// ── コンポーネントインデックス (プロセス全体で共有) ────
+inline constexpr u32 max_component_types = 256;
+inline constexpr u32 invalid_component_index = ~0u;
+
+/// TypeID の連番を返す (初出時に採番、スレッドセーフ)
+u32 component_index(TypeID id);
+
+/// 型付き版 — 2 回目以降は静的変数の読み出しのみ
+template <Component T>
+u32 component_index() {
+    static const u32 index = component_index(type_id<T>());
+    return index;
+}
+
 // ── コンポーネント型記述子 ──────────────────────────────
 struct ComponentInfo {
     TypeID      id;
-    usize       size;
+    usize       size;        // 0 = タグ (データなし)
     usize       alignment;
     const char* name;
+    u32         index = invalid_component_index;   // 未設定なら Archetype 生成時に解決
+
+    [[nodiscard]] bool is_tag() const { return size == 0; }
 };
 
-// コンパイル時にComponentInfoを生成
+/// 格納サイズ (空の型は sizeof が 1 でも 0 バイト)
+template <Component T>
+inline constexpr usize component_size_v = std::is_empty_v<T> ? 0 : sizeof(T);
+
+// ComponentInfoを生成
 template <Component T>
-constexpr ComponentInfo make_component_info(const char* name = "Unknown") {
-    return ComponentInfo{type_id<T>(), sizeof(T), alignof(T), name};
+ComponentInfo make_component_info(const char* name = "Unknown") {
+    return ComponentInfo{type_id<T>(), component_size_v<T>, alignof(T), name, component_index<T>()};
 }
 
-// ── SoA カラム (1つのコンポーネント型のデータ列) ────────
-class ComponentColumn {
-public:
-    ComponentColumn() = default;
-    ComponentColumn(usize elem_size, usize elem_align, u32 capacity = 64);
-    ~ComponentColumn();
-
-    ComponentColumn(ComponentColumn&& o) noexcept;
-    ComponentColumn& operator=(ComponentColumn&& o) noexcept;
-    ComponentColumn(const ComponentColumn&) = delete;
-    ComponentColumn& operator=(const ComponentColumn&) = delete;
-
-    /// 末尾に要素追加 (POD memcpy)
-    void push_back(const void* data);
-
-    /// インデックスでアクセス
-    [[nodiscard]] void*       at(u32 index);
-    [[nodiscard]] const void* at(u32 index) const;
-
-    /// 末尾の要素と入れ替えて削除 (swap-remove)
-    void swap_remove(u32 index);
-
-    [[nodiscard]] u32   count() const    { return count_; }
-    [[nodiscard]] usize elem_size() const { return elem_size_; }
-    [[nodiscard]] void* raw()            { return data_; }
-    [[nodiscard]] const void* raw() const { return data_; }
-
-private:
-    void grow();
-
-    u8*   data_      = nullptr;
-    usize elem_size_ = 0;
-    usize elem_align_= 0;
-    u32   count_     = 0;
-    u32   capacity_  = 0;
+// ── コンポーネント集合のビットセット (Archetype 署名) ──
+// 固定長なので包含 / 除外判定は数ワードの AND と比較で済む (SIMD 化しやすい)。
+struct ComponentMask {
+    static constexpr u32 word_count = max_component_types / 64;
+
+    alignas(32) u64 words[word_count] = {};
+
+    void set(u32 index)         { words[index >> 6] |=  (1ULL << (index & 63)); }
+    void reset(u32 index)       { words[index >> 6] &= ~(1ULL << (index & 63)); }
+    [[nodiscard]] bool test(u32 index) const { return (words[index >> 6] >> (index & 63)) & 1; }
+
+    /// other の全ビットを含むか
+    [[nodiscard]] bool contains_all(const ComponentMask& other) const {
+        u64 missing = 0;
+        for (u32 w = 0; w < word_count; ++w) missing |= other.words[w] & ~words[w];
+        return missing == 0;
+    }
+
+    /// other と 1 ビットでも重なるか
+    [[nodiscard]] bool intersects(const ComponentMask& other) const {
+        u64 common = 0;
+        for (u32 w = 0; w < word_count; ++w) common |= other.words[w] & words[w];
+        return common != 0;
+    }
+
+    [[nodiscard]] bool empty() const { return !intersects(*this); }
+
+    /// 共通部分 / 差集合
+    [[nodiscard]] ComponentMask operator&(const ComponentMask& other) const {
+        ComponentMask r;
+        for (u32 w = 0; w < word_count; ++w) r.words[w] = words[w] & other.words[w];
+        return r;
+    }
+    [[nodiscard]] ComponentMask minus(const ComponentMask& other) const {
+        ComponentMask r;
+        for (u32 w = 0; w < word_count; ++w) r.words[w] = words[w] & ~other.words[w];
+        return r;
+    }
+
+    /// このマスクにあり minus にないビットごとに fn(index) を呼ぶ (昇順)
+    template <typename F>
+    void for_each_set(const ComponentMask& minus, F&& fn) const {
+        for (u32 w = 0; w < word_count; ++w) {
+            for (u64 bits = words[w] & ~minus.words[w]; bits; bits &= bits - 1) {
+                fn(w * 64 + static_cast<u32>(std::countr_zero(bits)));
+            }
+        }
+    }
+
+    [[nodiscard]] u64 hash() const {
+        u64 h = 0;
+        for (u32 w = 0; w < word_count; ++w) h = (h ^ words[w]) * 0x9E3779B97F4A7C15ULL;
+        return h;
+    }
+
+    bool operator==(const ComponentMask&) const = default;
 };
 
+/// TypeID 列からビットセットを作る
+[[nodiscard]] ComponentMask make_component_mask(std::span<const TypeID> ids);
+
 } // namespace engine::ecs
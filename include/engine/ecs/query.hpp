@@ -3,24 +3,50 @@
  *
  * Query<Position, Velocity> で必要コンポーネントを指定し、
  * 該当する全 Archetype を横断して反復。
+ * each<Ts...>(f) は任意の呼び出し可能オブジェクトを受け取り、チャンク内の
+ * カラムポインタを直接走査する (std::function / ヒープ確保なし)。
+ * cached() で World に登録した Query は一致 Archetype リストを保持し、
+ * 新しい Archetype の生成時にだけ増分で照合される。
+ * par_each<Ts...>(f) は一致チャンクを JobSystem に分配して並列に走査する。
+ *
+ * 変更検知: 非 const の Ts で走査したチャンクはそのカラムの変更 tick を更新する
+ * (読むだけなら each<const T> とする)。changed<T>() / added<T>() は基準 tick
+ * 以降に書き込み / 追加のないチャンクを丸ごと飛ばす (判定はチャンク単位)。
+ *
+ * 疎集合 (World::set_storage) のコンポーネントも with / without / each の項に
+ * 混在できる。changed / added は Archetype 格納のコンポーネントのみ対象。
+ * targeting<R>(e) は関係 R の索引から e の参照元だけを走査する。
  */
 #pragma once
 
 #include "entity.hpp"
 #include "archetype.hpp"
+#include "relation.hpp"
+#include <engine/core/task_graph.hpp>
+#include <algorithm>
+#include <array>
 #include <functional>
+#include <memory>
+#include <span>
+#include <tuple>
+#include <type_traits>
+#include <utility>
 
 namespace engine::ecs {
 
 class World; // forward declaration
+class CommandBuffer;
 
-// ── QueryResult: 1つの Archetype 分のマッチ結果 ────────
+// ── QueryResult: 1チャンク分のマッチ結果 ────────────────
 struct QueryMatch {
     Archetype*            archetype;
-    u32                   count;
-    std::vector<void*>    columns;  // 要求コンポーネントのカラムポインタ
+    u32                   chunk;    // archetype 内のチャンク番号
+    u32                   count;    // チャンク内の行数
+    std::vector<void*>    columns;  // 要求コンポーネントのチャンク内カラムポインタ
 };
 
+class Query;
+
 // ── QueryBuilder ────────────────────────────────────────
 class QueryBuilder {
 public:
@@ -30,6 +56,7 @@ public:
     template <Component... Ts>
     QueryBuilder& with() {
         (required_.push_back(type_id<Ts>()), ...);
+        (required_mask_.set(component_index<Ts>()), ...);
         return *this;
     }
 
@@ -37,22 +64,188 @@ public:
     template <Component... Ts>
     QueryBuilder& without() {
         (excluded_.push_back(type_id<Ts>()), ...);
+        (excluded_mask_.set(component_index<Ts>()), ...);
+        return *this;
+    }
+
+    /// 基準 tick 以降に書き込まれたチャンクのみ (with<Ts...>() を含む)
+    template <Component... Ts>
+    QueryBuilder& changed() {
+        with<Ts...>();
+        (changed_.push_back(component_index<Ts>()), ...);
+        return *this;
+    }
+
+    /// 基準 tick 以降にコンポーネントが追加されたチャンクのみ (with<Ts...>() を含む)
+    template <Component... Ts>
+    QueryBuilder& added() {
+        with<Ts...>();
+        (added_.push_back(component_index<Ts>()), ...);
         return *this;
     }
 
-    /// クエリ実行 — マッチする全Archetypeを返す
+    /// 関係 R で target を参照する Entity のみ (with<R>() を含む)。
+    /// 走査は target の参照元の数に比例する。execute / cached には反映されない
+    template <Relation R>
+    QueryBuilder& targeting(Entity target) {
+        with<R>();
+        relation_index_ = component_index<R>();
+        relation_       = target;
+        has_relation_   = true;
+        return *this;
+    }
+
+    /// changed / added の基準 tick を指定 (既定は World::last_change_tick())
+    QueryBuilder& since(Tick tick) {
+        since_ = tick;
+        has_since_ = true;
+        return *this;
+    }
+
+    /// クエリ実行 — マッチする全 Archetype の全チャンクを返す。
+    /// 疎集合の条件 (changed / added を含む) は評価せず、そのカラムは nullptr になる (each / for_each を使う)
     [[nodiscard]] std::vector<QueryMatch> execute() const;
 
     /// for_each: 各Entity の全コンポーネントに対してコールバック
     template <Component... Ts>
-    void for_each(std::function<void(Entity, Ts&...)> func) const;
+    void for_each(std::type_identity_t<std::function<void(Entity, Ts&...)>> func) const;
+
+    /// each: func(Entity, Ts&...) または func(Ts&...) をインライン展開可能な形で呼ぶ。
+    /// Ts は暗黙に with<Ts...>() 扱い。反復中の構造変更は不可
+    template <Component... Ts, typename F>
+    void each(F&& func) const;
+
+    /// par_each: チャンク単位でジョブに分割して並列実行し、全チャンクの完了まで待つ。
+    /// func は each の形式に加えて func(CommandBuffer&, Entity, Ts&...) を受け付ける。
+    /// 渡される World::command_buffer() はスレッド別ストリームに記録され、
+    /// チャンク順をソートキーとして World::flush_commands で適用される。
+    /// func は複数スレッドから同時に呼ばれるため、他 Entity への書き込みは不可
+    template <Component... Ts, typename F>
+    void par_each(F&& func, JobSystem& js = global_job_system()) const;
+
+    /// World に登録した永続クエリを返す (同一条件なら既存の登録を共有)。
+    /// changed / added フィルタはキャッシュされない
+    [[nodiscard]] Query cached() const;
 
 private:
+    [[nodiscard]] Tick filter_since() const;
+
     World&             world_;
     std::vector<TypeID> required_;
     std::vector<TypeID> excluded_;
+    ComponentMask       required_mask_;
+    ComponentMask       excluded_mask_;
+    std::vector<u32>    changed_;     // コンポーネントインデックス
+    std::vector<u32>    added_;
+    Tick                since_     = 0;
+    bool                has_since_ = false;
+    u32                 relation_index_ = invalid_component_index;   // targeting の関係
+    Entity              relation_;                                  // targeting の参照先
+    bool                has_relation_ = false;
 };
 
+// ── each の 1 チャンク分ループ ──────────────────────────
+namespace detail {
+
+/// changed / added フィルタ (全条件を満たすチャンクのみ通す)。
+/// 疎集合の項は Archetype にカラムがないのでここでは判定せず、World が要素ごとに確かめる
+struct ChunkFilter {
+    std::span<const u32> changed;
+    std::span<const u32> added;
+    Tick                 since = 0;
+
+    [[nodiscard]] bool empty() const { return changed.empty() && added.empty(); }
+
+    [[nodiscard]] bool passes(const Archetype& arch, u32 chunk) const {
+        for (u32 idx : changed) {
+            i32 col = arch.column_of(idx);
+            if (col >= 0 && arch.column_ticks(chunk, static_cast<u32>(col)).load_changed() <= since) return false;
+        }
+        for (u32 idx : added) {
+            i32 col = arch.column_of(idx);
+            if (col >= 0 && arch.column_ticks(chunk, static_cast<u32>(col)).added <= since) return false;
+        }
+        return true;
+    }
+};
+
+/// 非 const で渡したカラムを tick で変更済みにする
+template <typename... Ts, usize... Is>
+inline void mark_written(Archetype& arch, u32 chunk, const std::array<i32, sizeof...(Ts)>& cols,
+                         Tick tick, std::index_sequence<Is...>) {
+    auto mark = [&](u32 col) { arch.column_ticks(chunk, col).raise_changed(tick); };
+    ((std::is_const_v<Ts> ? void() : mark(static_cast<u32>(cols[Is]))), ...);
+}
+
+template <typename... Ts, typename F, usize... Is>
+inline void each_chunk(Archetype& arch, u32 chunk, const std::array<i32, sizeof...(Ts)>& cols,
+                       F& func, std::index_sequence<Is...>) {
+    const u32 n = arch.chunk_size(chunk);
+    std::tuple<Ts*...> ptrs{static_cast<Ts*>(arch.chunk_column_at(chunk, static_cast<u32>(cols[Is])))...};
+    if constexpr (std::is_invocable_v<F&, Entity, Ts&...>) {
+        const Entity* entities = arch.chunk_entities(chunk).data();
+        for (u32 i = 0; i < n; ++i) func(entities[i], std::get<Is>(ptrs)[i]...);
+    } else {
+        static_assert(std::is_invocable_v<F&, Ts&...>,
+                      "each: func must accept (Entity, Ts&...) or (Ts&...)");
+        for (u32 i = 0; i < n; ++i) func(std::get<Is>(ptrs)[i]...);
+    }
+}
+
+template <typename... Ts, typename F>
+inline void each_archetype(Archetype& arch, F& func, Tick tick, const ChunkFilter& filter = {}) {
+    // カラム番号は Archetype ごとに 1 回だけ引く
+    std::array<i32, sizeof...(Ts)> cols{arch.column_of(component_index<Ts>())...};
+    for (i32 c : cols) if (c < 0) return;
+    for (u32 chunk = 0; chunk < arch.chunk_count(); ++chunk) {
+        if (!filter.empty() && !filter.passes(arch, chunk)) continue;
+        mark_written<Ts...>(arch, chunk, cols, tick, std::index_sequence_for<Ts...>{});
+        each_chunk<Ts...>(arch, chunk, cols, func, std::index_sequence_for<Ts...>{});
+    }
+}
+
+} // namespace detail
+
+// ── キャッシュ済みクエリ ────────────────────────────────
+// 状態は World が所有し、World の生存期間中有効。
+struct QueryState {
+    World*                  world = nullptr;
+    std::vector<TypeID>     required;     // ソート済み
+    std::vector<TypeID>     excluded;     // ソート済み
+    ComponentMask           required_mask;
+    ComponentMask           excluded_mask;
+    std::vector<Archetype*> archetypes;   // 一致した Archetype (生成順、空を含む)
+};
+
+class Query {
+public:
+    Query() = default;
+
+    /// 一致 Archetype のみを走査 (全 Archetype の照合は行わない)
+    template <Component... Ts, typename F>
+    void each(F&& func) const;
+
+    /// QueryBuilder::par_each と同じ (一致 Archetype のチャンクのみを分配)
+    template <Component... Ts, typename F>
+    void par_each(F&& func, JobSystem& js = global_job_system()) const;
+
+    [[nodiscard]] std::span<Archetype* const> archetypes() const { return state_->archetypes; }
+    [[nodiscard]] u32  entity_count() const;
+    [[nodiscard]] bool valid() const { return state_ != nullptr; }
+
+private:
+    friend class World;
+    explicit Query(const QueryState* state) : state_(state) {}
+
+    const QueryState* state_ = nullptr;
+};
+
+inline u32 Query::entity_count() const {
+    u32 n = 0;
+    for (Archetype* arch : state_->archetypes) n += arch->count();
+    return n;
+}
+
 // ── テンプレート実装は world.hpp インクルード後に定義 ────
 
 } // namespace engine::ecs
@@ -0,0 +1,93 @@
+/**
+ * engine/ecs/relation.hpp — Entity 間の関係 (リレーション)
+ *
+ * 関係コンポーネント R は参照先 Entity をメンバ target に持つ通常のコンポーネント。
+ * World::register_relation<R>() で登録すると、World が target → 参照元の索引を
+ * 構造変更と同時に更新する。索引は Entity index で引く侵入リスト
+ * (参照先ごとの先頭 + 参照元ごとの前後リンク) で、参照元の列挙は結果数に比例する。
+ * 1 つの Entity が持てる参照先は関係の型ごとに 1 つ (ChildOf なら親は 1 つ)。
+ *
+ * World は ChildOf を RelationCleanup::Despawn で登録済みなので、World::despawn は
+ * 子孫 (ChildOf の参照元をたどった部分木) もまとめて despawn する。子を残して親子関係だけ
+ * 外したい場合は register_relation<ChildOf>(RelationCleanup::Remove) で切り替える。
+ */
+#pragma once
+
+#include "entity.hpp"
+#include <engine/core/types.hpp>
+#include <concepts>
+#include <cstddef>
+#include <vector>
+
+namespace engine::ecs {
+
+/// target メンバで参照先を指すコンポーネント
+template <typename R>
+concept Relation = Component<R> && requires(R r) {
+    { r.target } -> std::same_as<Entity&>;
+};
+
+// ── 既定の関係 ──────────────────────────────────────────
+/// 親子関係 (target = 親)。既定では親の despawn で子孫も despawn される
+/// (RelationCleanup::Remove に切り替えると子は残り、ChildOf だけが外れる)
+struct ChildOf {
+    Entity target;
+};
+
+// ── 参照先が破棄されたときの扱い ────────────────────────
+enum class RelationCleanup : u8 {
+    Remove,    // 参照元から関係コンポーネントを外す
+    Despawn,   // 参照元も despawn する (階層の連鎖削除)
+};
+
+// ── target → 参照元の索引 ───────────────────────────────
+class RelationIndex {
+public:
+    static constexpr u32 none = ~0u;
+
+    RelationIndex(u32 comp_index, usize target_offset, RelationCleanup cleanup)
+        : comp_index_(comp_index), target_offset_(target_offset), cleanup_(cleanup) {}
+
+    /// source の参照先を target にする (旧参照先からは外す)
+    void link(Entity source, Entity target);
+    /// source をどの参照先からも外す
+    void unlink(u32 source_index);
+
+    /// source の参照先 (なければ null)
+    [[nodiscard]] Entity target(u32 source_index) const {
+        return source_index < links_.size() ? links_[source_index].target : Entity::null();
+    }
+    /// target を参照する先頭の参照元 / 次の参照元 (Entity index、終端は none)
+    [[nodiscard]] u32 first_source(u32 target_index) const {
+        return target_index < links_.size() ? links_[target_index].first : none;
+    }
+    [[nodiscard]] u32 next_source(u32 source_index) const { return links_[source_index].next; }
+    [[nodiscard]] Entity source(u32 source_index) const { return links_[source_index].self; }
+    [[nodiscard]] u32 source_count(u32 target_index) const {
+        return target_index < links_.size() ? links_[target_index].count : 0;
+    }
+
+    [[nodiscard]] u32             comp_index() const    { return comp_index_; }
+    [[nodiscard]] usize           target_offset() const { return target_offset_; }
+    [[nodiscard]] RelationCleanup cleanup() const       { return cleanup_; }
+    void set_cleanup(RelationCleanup cleanup)           { cleanup_ = cleanup; }
+
+private:
+    // 添字 = Entity index。参照元としての情報 (self / target / next / prev) と
+    // 参照先としての情報 (first / count) を同じ要素に持つ
+    struct Link {
+        Entity self;
+        Entity target;
+        u32    next  = none;
+        u32    prev  = none;
+        u32    first = none;
+        u32    count = 0;
+    };
+
+    u32               comp_index_;
+    usize             target_offset_;   // コンポーネント内の target の位置
+    RelationCleanup   cleanup_;
+    std::vector<Link> links_;
+};
+
+} // namespace engine::ecs
@@ -0,0 +1,72 @@
+/**
+ * engine/ecs/snapshot.hpp — World スナップショットのバイナリ形式
+ *
+ * World::save_snapshot / load_snapshot が読み書きする。書き出し側のメモリ表現を
+ * そのまま並べ、読み込みは Entity 表の複製とチャンク単位のカラム memcpy で済む。
+ * TypeID はプロセスごとに変わるため、型は TypeRegistry の名前で記録する
+ * (ENG_REFLECT_BEGIN / END で登録した型のみ保存できる)。
+ *
+ * 配置 (ネイティブエンディアン、各セクションは 8 バイト境界):
+ *   SnapshotHeader
+ *   SnapshotType × type_count, 名前文字列 (name_bytes)
+ *   文字列表: 長さ u32 × string_count, 文字列を番号順に連結 (string_bytes)
+ *   世代 u32 × record_count, 生存ビット u64 × ceil(record_count / 64), 空き番号 u32 × free_count
+ *   疎集合ごとに SnapshotSparse, Entity × count, 値 × count
+ *   Archetype ごとに SnapshotArchetype, SnapshotColumn × column_count
+ *   チャンク画像 (data_offset から chunk_count × chunk_bytes、snapshot_page 境界)
+ * チャンク画像は書き出し側のチャンク (先頭に Entity 配列、続いて各カラム) そのもので、
+ * 読み込み側とレイアウトが違っても SnapshotColumn の offset からカラムを引ける。
+ * レイアウトが一致すれば World::map_snapshot は写像した画像をそのままチャンクとして使う
+ * (ページ境界に置くのはそのため)。
+ */
+#pragma once
+
+#include <engine/core/types.hpp>
+
+namespace engine::ecs {
+
+inline constexpr u32   snapshot_magic   = 0x53574A48;   // "HJWS"
+inline constexpr u32   snapshot_version = 2;
+inline constexpr usize snapshot_page    = 4096;         // チャンク画像の配置境界
+
+struct SnapshotHeader {
+    u32 magic;
+    u32 version;
+    u32 type_count;
+    u32 name_bytes;
+    u32 record_count;      // Entity index 0 (null) を含む
+    u32 free_count;
+    u32 sparse_count;
+    u32 archetype_count;
+    u32 string_count;      // World::intern の文字列表
+    u32 string_bytes;
+    u64 file_bytes;
+};
+
+struct SnapshotType {
+    u32 name_offset;       // 名前文字列セクション内の位置
+    u32 name_length;
+    u32 size;              // 格納サイズ (タグは 0)
+    u32 alignment;
+};
+
+struct SnapshotSparse {
+    u32 type;              // 型表の添字
+    u32 count;
+};
+
+struct SnapshotArchetype {
+    u32 column_count;
+    u32 entity_count;
+    u32 chunk_count;
+    u32 chunk_capacity;
+    u64 chunk_bytes;
+    u64 data_offset;       // 先頭チャンク画像のファイル内位置
+};
+
+struct SnapshotColumn {
+    u32 type;              // 型表の添字
+    u32 offset;            // チャンク画像内のカラム位置
+};
+
+} // namespace engine::ecs
@@ -0,0 +1,104 @@
+/**
+ * engine/ecs/sparse_set.hpp — 疎集合コンポーネントストレージ
+ *
+ * 頻繁に付け外しするコンポーネント (Stunned / Grounded / Selected など) 用。
+ * Entity index → 密配列位置の表を page_size 件単位のページで持ち、値は密配列に
+ * 詰めて格納する。追加 / 削除で Entity の Archetype は変わらず、密配列末尾との
+ * swap-remove だけで済む。ページは該当範囲の Entity が初めて入ったときに確保する。
+ * 変更検知の tick (追加 / 変更) は密配列の要素ごとに持ち、changed / added と OnChange は
+ * 要素単位で判定する (Archetype はチャンク単位)。
+ */
+#pragma once
+
+#include "entity.hpp"
+#include "component.hpp"
+#include "archetype.hpp"
+#include <engine/core/types.hpp>
+#include <memory>
+#include <span>
+#include <vector>
+
+namespace engine::ecs {
+
+// ── コンポーネントの格納方式 ────────────────────────────
+enum class StorageKind : u8 {
+    Table,       // Archetype のチャンク (既定)
+    SparseSet,   // Entity index 引きの疎集合 (Archetype 署名には現れない)
+};
+
+// ── SparseSet ───────────────────────────────────────────
+class SparseSet {
+public:
+    static constexpr u32 page_size = 4096;
+    static constexpr u32 npos      = ~0u;
+
+    explicit SparseSet(const ComponentInfo& info);
+    ~SparseSet();
+
+    SparseSet(const SparseSet&) = delete;
+    SparseSet& operator=(const SparseSet&) = delete;
+
+    /// Entity index → 密配列位置 (なければ npos)
+    [[nodiscard]] u32 dense_index(u32 index) const {
+        const u32 page = index / page_size;
+        if (page >= pages_.size() || !pages_[page]) return npos;
+        return pages_[page][index % page_size];
+    }
+    [[nodiscard]] bool contains(u32 index) const { return dense_index(index) != npos; }
+
+    /// 値へのポインタ (なければ nullptr)
+    [[nodiscard]] void* get(u32 index) {
+        const u32 d = dense_index(index);
+        return d == npos ? nullptr : at(d);
+    }
+    [[nodiscard]] const void* get(u32 index) const {
+        const u32 d = dense_index(index);
+        return d == npos ? nullptr : at(d);
+    }
+
+    /// 追加して値へのポインタを返す (新規はゼロ初期化して tick で追加扱い、既にあれば既存の値)。
+    /// inserted には新規に追加したかを返す
+    void* insert(Entity entity, Tick tick, bool* inserted = nullptr);
+
+    /// 削除 (末尾と swap-remove)。含まれていなければ false
+    bool erase(u32 index);
+
+    /// 全要素を削除 (ページと密配列の容量は保持)
+    void clear();
+
+    /// 空のページと密配列の余剰容量を解放し、解放したバイト数を返す
+    usize shrink();
+
+    // ── 密配列アクセス (クエリの走査起点) ──────────────
+    [[nodiscard]] u32 size() const { return static_cast<u32>(entities_.size()); }
+    [[nodiscard]] std::span<const Entity> entities() const { return entities_; }
+    /// 密配列 d 番目の値。タグは密配列の Entity を指す (空の型なので読み書きは発生しない)
+    [[nodiscard]] void* at(u32 d) {
+        return size_ ? data_ + static_cast<usize>(d) * size_ : static_cast<void*>(entities_.data() + d);
+    }
+    [[nodiscard]] const void* at(u32 d) const {
+        return size_ ? data_ + static_cast<usize>(d) * size_ : static_cast<const void*>(entities_.data() + d);
+    }
+
+    /// 密配列 d 番目の変更検知 tick
+    [[nodiscard]] const ColumnTicks& ticks(u32 d) const { return ticks_[d]; }
+    /// 書き込みを記録する (並列走査からも呼ばれるため最大値を取る)
+    void mark_changed(u32 d, Tick tick) { ticks_[d].raise_changed(tick); }
+    /// 追加扱いにする (削除 → 再追加が打ち消し合ったとき)
+    void mark_added(u32 d, Tick tick) { ticks_[d] = ColumnTicks{tick, tick}; }
+
+    [[nodiscard]] const ComponentInfo& info() const { return info_; }
+
+private:
+    void reserve_data(u32 capacity);
+
+    ComponentInfo                        info_;
+    usize                                size_ = 0;        // 要素サイズ (タグは 0)
+    std::vector<std::unique_ptr<u32[]>>  pages_;           // Entity index → 密配列位置
+    std::vector<Entity>                  entities_;        // 密配列の Entity
+    std::vector<ColumnTicks>             ticks_;           // 密配列の変更検知 tick
+    u8*                                  data_     = nullptr;
+    u32                                  capacity_ = 0;    // data_ の要素数
+};
+
+} // namespace engine::ecs
@@ -2,23 +2,36 @@
  * engine/ecs/system.hpp — システム (クエリベース並列実行)
  *
  * System: 名前付き関数 + クエリ条件
- * Scheduler: 依存関係に基づくシステム実行順序決定
+ * Scheduler: 依存関係に基づくシステム実行順序決定 (登録時のみ再計算)
+ *            reads / writes の競合グラフによる並列ディスパッチ
  * Reactive System: 変更検知トリガー
+ *   ハンドラは Entity ごとではなく、同じコンポーネント・イベントの Entity を
+ *   まとめた span で呼ばれる。
+ *   OnAdd / OnRemove は World がコンポーネントごとにキューへ溜め、
+ *   World::flush_observers() (CommandBuffer::apply とフレーム末で自動) で通知する。
+ *   OnRemove の通知時点でコンポーネントは既に外れている。
+ *   OnChange はフレーム (run / run_parallel) の最後に、前回の発火以降に
+ *   書き込まれたチャンクの Entity に対して呼ばれる
  */
 #pragma once
 
 #include "entity.hpp"
 #include "query.hpp"
 #include <engine/core/types.hpp>
+#include <engine/core/task_graph.hpp>
+#include <span>
 #include <string>
 #include <vector>
 #include <functional>
+#include <memory>
 
 namespace engine::ecs {
 
 class World;
 
 // ── システム定義 ────────────────────────────────────────
+// reads / writes は並列実行時の競合判定に使う。
+// 両方とも空のシステムはアクセス範囲不明として他の全システムと排他実行する。
 struct SystemDesc {
     std::string          name;
     std::vector<TypeID>  reads;       // 読み取りコンポーネント
@@ -27,6 +40,16 @@ struct SystemDesc {
     std::function<void(World&)> execute;
 };
 
+// ── システム実行時間 ────────────────────────────────────
+struct SystemTiming {
+    f64 last_us  = 0.0;    // 直近フレームの実行時間
+    f64 max_us   = 0.0;
+    f64 total_us = 0.0;
+    u64 runs     = 0;
+
+    [[nodiscard]] f64 average_us() const { return runs ? total_us / static_cast<f64>(runs) : 0.0; }
+};
+
 // ── リアクティブトリガー ────────────────────────────────
 enum class TriggerEvent : u8 {
     OnAdd,      // コンポーネント追加時
@@ -34,11 +57,13 @@ enum class TriggerEvent : u8 {
     OnRemove,   // コンポーネント削除時
 };
 
+// handler の span は呼び出し中のみ有効。OnAdd の通知までに破棄された Entity も
+// 含まれ得るので、必要なら World::alive で確認する
 struct ReactiveTrigger {
     std::string name;
     TypeID      component;
     TriggerEvent event;
-    std::function<void(World&, Entity)> handler;
+    std::function<void(World&, std::span<const Entity>)> handler;
 };
 
 // ── システムスケジューラ ────────────────────────────────
@@ -52,16 +77,57 @@ public:
     /// リアクティブトリガー登録
     void add_trigger(ReactiveTrigger trigger);
 
-    /// 全システムを依存順に実行
+    /// 全システムを依存順に実行 (最後に OnAdd / OnRemove を通知し、OnChange トリガーを発火)
     void run();
 
+    /// 競合しないシステムを JobSystem 上で並列実行 (全システム完了まで待機)。
+    /// 並列実行中の構造変更 (spawn / add_component 等) は CommandBuffer 経由で行うこと。
+    void run_parallel(JobSystem& js = global_job_system());
+
     /// 全システム名一覧
     [[nodiscard]] std::vector<std::string> system_names() const;
 
+    /// 実行順 (システムインデックスの平坦配列)。add_system / add_trigger 時のみ再計算
+    [[nodiscard]] const std::vector<u32>& schedule();
+
+    /// システムごとの実行時間 (インデックスは登録順 = system_names() と一致)
+    [[nodiscard]] const std::vector<SystemTiming>& timings() const { return timings_; }
+    void reset_timings();
+
+    /// 競合グラフの辺 (before, after) — 推移的に冗長な辺も含む
+    [[nodiscard]] const std::vector<std::pair<u32, u32>>& conflict_edges();
+
+    /// OnAdd / OnRemove トリガーへ 1 コンポーネント分のイベントを通知 (World から呼ばれる)
+    void dispatch_observers(TriggerEvent event, u32 comp_index, std::span<const Entity> entities);
+
 private:
+    void invalidate();
+    void rebuild_schedule();
+    void run_system(u32 idx, u32 source);
+    void build_edges();
+    void rebuild_graph(JobSystem& js);
+    void run_change_triggers();
+
     World&                          world_;
     std::vector<SystemDesc>         systems_;
     std::vector<ReactiveTrigger>    triggers_;
+    std::vector<SystemTiming>       timings_;
+    std::vector<Tick>               last_run_;           // システムごとの前回実行 tick
+    std::vector<Tick>               trigger_last_run_;   // トリガーごとの前回発火 tick
+    std::vector<Entity>             change_batch_;       // OnChange 対象の作業領域
+    // コンポーネントインデックス → OnAdd / OnRemove トリガー番号
+    std::vector<std::vector<u32>>   add_observers_;
+    std::vector<std::vector<u32>>   remove_observers_;
+
+    // 実行順 / 並列実行用キャッシュ (add_system / add_trigger で無効化)
+    bool                                 schedule_dirty_ = true;
+    std::vector<u32>                     order_;
+    bool                                 edges_dirty_ = true;
+    bool                                 graph_dirty_ = true;
+    std::vector<std::pair<u32, u32>>     edges_;
+    std::unique_ptr<TaskGraph>           graph_;
+    JobSystem*                           graph_js_ = nullptr;
+    u32                                  source_base_ = 0;   // 今回の実行の記録元 (+ 実行順位)
 };
 
 } // namespace engine::ecs
@@ -3,6 +3,14 @@
  *
  * Entity の生成・破棄・コンポーネント操作。
  * 複数 Archetype の管理とクエリの統合。
+ * set_storage<T>(StorageKind::SparseSet) を指定した型は Archetype ではなく疎集合に
+ * 格納し、付け外しで行を移動しない。クエリは両方の条件を混在できる。
+ * 関係コンポーネント (ChildOf など) は参照先 → 参照元の索引を World が保守する。
+ * 大量 despawn 後は compact(budget) を複数フレームに分けて呼び、空の Archetype や
+ * 余剰容量を解放する。
+ * 可変長の文字列は intern で World の文字列表に登録し、コンポーネントには番号だけを持たせる。
+ * save_snapshot / load_snapshot は World 全体をバイナリ形式 (snapshot.hpp) で読み書きする。
+ * map_snapshot はファイルを写像し、チャンク画像を書き込みまでその場で使う。
  */
 #pragma once
 
@@ -12,14 +20,27 @@
 #include "query.hpp"
 #include "command_buffer.hpp"
 #include "system.hpp"
+#include "sparse_set.hpp"
+#include "relation.hpp"
 #include <engine/core/types.hpp>
 
+#include <array>
+#include <atomic>
+#include <deque>
+#include <span>
+#include <tuple>
 #include <vector>
 #include <unordered_map>
 #include <memory>
+#include <string>
+#include <string_view>
 
 namespace engine::ecs {
 
+class SnapshotSink;
+
+inline constexpr u32 invalid_string = ~0u;
+
 // ── EntityRecord (各Entityの所在) ───────────────────────
 struct EntityRecord {
     Archetype* archetype = nullptr;
@@ -28,6 +49,28 @@ struct EntityRecord {
     bool       alive     = false;
 };
 
+// ── 変更 tick のスコープ (SystemScheduler がシステム実行ごとに設定) ──
+struct ChangeTickScope {
+    const World* world    = nullptr;
+    Tick         this_run = 0;   // 実行中の書き込みを刻印する tick
+    Tick         last_run = 0;   // 前回実行時の tick (changed / added の基準)
+};
+
+// ── World::compact の設定と結果 ─────────────────────────
+struct CompactOptions {
+    bool free_empty_archetypes = true;   // 空の Archetype を破棄 (遷移辺 / クエリから外す)
+    bool sort_rows             = false;  // 各 Archetype の行を Entity index 順に並べ替える
+    bool trim_chunk_pool       = true;   // 1 巡の最後に ChunkPool の空きブロックを OS に返す
+};
+
+struct CompactStats {
+    usize bytes_reclaimed   = 0;   // 解放したバイト数 (チャンク本体は trim 時に計上)
+    u32   archetypes_visited = 0;
+    u32   archetypes_freed  = 0;
+    u32   archetypes_sorted = 0;
+    bool  done              = false;   // 1 巡分の整理が完了した (次の呼び出しは新しい巡回)
+};
+
 // ── World ───────────────────────────────────────────────
 class World {
 public:
@@ -36,85 +79,509 @@ public:
 
     // ── Entity 操作 ─────────────────────────────────────
     Entity spawn();
+    /// entity を破棄する。Despawn 後始末の関係 (既定の ChildOf を含む) の参照元も連鎖して
+    /// 破棄するので、親を despawn すると部分木全体が消える。Remove 後始末の関係は参照元から
+    /// 関係コンポーネントを外すだけ (register_relation<ChildOf>(RelationCleanup::Remove) で切り替え)
     void   despawn(Entity entity);
     [[nodiscard]] bool alive(Entity entity) const;
 
+    // ── 格納方式 ────────────────────────────────────────
+    /// T の格納方式を指定する。T を初めて使う前に呼ぶこと (使用後の変更は無視)
+    template <Component T>
+    void set_storage(StorageKind kind) { set_storage_impl(make_component_info<T>(""), kind); }
+
+    [[nodiscard]] bool is_sparse(u32 comp_index) const { return sparse_mask_.test(comp_index); }
+    [[nodiscard]] const ComponentMask& sparse_mask() const { return sparse_mask_; }
+    /// 疎集合に格納するコンポーネントのストレージ (Archetype 格納なら nullptr)
+    [[nodiscard]] SparseSet* sparse_set(u32 comp_index) const {
+        return is_sparse(comp_index) ? sparse_[comp_index].get() : nullptr;
+    }
+
+    /// 同一構成の Entity を count 個まとめて生成 (中間 Archetype を経由しない)。
+    /// 行は連続して確保され、init(i, Ts&...) がチャンク内のデータを直接初期化する。
+    /// 戻り値は World 内部バッファを指し、次の spawn_batch / compact 呼び出しまで有効
+    template <Component... Ts, typename Init>
+    std::span<const Entity> spawn_batch(u32 count, Init&& init);
+
+    template <Component... Ts>
+    std::span<const Entity> spawn_batch(u32 count) {
+        return spawn_batch<Ts...>(count, [](u32, Ts&...) {});
+    }
+
+    /// raw 版 — コンポーネントはゼロ初期化
+    std::span<const Entity> spawn_batch_raw(u32 count, std::span<const ComponentInfo> comps);
+
     // ── コンポーネント操作 ──────────────────────────────
     template <Component T>
     void add_component(Entity entity, const T& comp) {
-        add_component_raw(entity, type_id<T>(), sizeof(T), alignof(T), &comp);
+        add_component_impl(entity, make_component_info<T>(""), &comp);
     }
 
     template <Component T>
     void remove_component(Entity entity) {
-        remove_component_raw(entity, type_id<T>());
+        remove_component_impl(entity, component_index<T>());
     }
 
+    /// 非 const 版は書き込みとみなし、変更 tick を更新する
     template <Component T>
     [[nodiscard]] T* get_component(Entity entity) {
-        return static_cast<T*>(get_component_raw(entity, type_id<T>()));
+        return static_cast<T*>(get_component_impl(entity, component_index<T>()));
     }
 
     template <Component T>
     [[nodiscard]] const T* get_component(Entity entity) const {
-        return static_cast<const T*>(get_component_raw(entity, type_id<T>()));
+        return static_cast<const T*>(get_component_impl(entity, component_index<T>()));
     }
 
     template <Component T>
     [[nodiscard]] bool has_component(Entity entity) const {
-        return has_component_raw(entity, type_id<T>());
+        return has_component_impl(entity, component_index<T>());
+    }
+
+    // ── 関係 ────────────────────────────────────────────
+    /// R を関係として登録し、参照先 → 参照元の索引を持つ (ChildOf は Despawn で登録済み)。
+    /// R を初めて使う前に呼ぶこと。登録済みの R なら後始末 cleanup だけを切り替える (いつでも可)。
+    /// target の書き換えは add_component / add_relation で行う
+    /// (get_component や each 経由の直接書き換えは索引に反映されない)
+    template <Relation R>
+    void register_relation(RelationCleanup cleanup = RelationCleanup::Remove) {
+        register_relation_impl(make_component_info<R>(""), offsetof(R, target), cleanup);
+    }
+
+    /// source → target の関係を張る (既にあれば参照先を付け替える)
+    template <Relation R>
+    void add_relation(Entity source, Entity target) {
+        R rel{};
+        rel.target = target;
+        add_component(source, rel);
+    }
+
+    template <Relation R>
+    void remove_relation(Entity source) { remove_component<R>(source); }
+
+    /// source の参照先 (関係がなければ null)
+    template <Relation R>
+    [[nodiscard]] Entity target_of(Entity source) const {
+        const RelationIndex* rel = relation_index(component_index<R>());
+        return rel && alive(source) ? rel->target(source.index()) : Entity::null();
+    }
+
+    /// target を参照する Entity ごとに fn(Entity) を呼ぶ (参照元の数に比例)。
+    /// fn 内で現在の参照元の関係を外してもよい
+    template <Relation R, typename F>
+    void each_source(Entity target, F&& fn) const {
+        const RelationIndex* rel = relation_index(component_index<R>());
+        if (!rel || !alive(target)) return;
+        for (u32 s = rel->first_source(target.index()); s != RelationIndex::none;) {
+            const u32 next = rel->next_source(s);
+            fn(rel->source(s));
+            s = next;
+        }
+    }
+
+    template <Relation R>
+    [[nodiscard]] u32 source_count(Entity target) const {
+        const RelationIndex* rel = relation_index(component_index<R>());
+        return rel && alive(target) ? rel->source_count(target.index()) : 0;
+    }
+
+    [[nodiscard]] const RelationIndex* relation_index(u32 comp_index) const {
+        return relation_mask_.test(comp_index) ? relations_[comp_index].get() : nullptr;
     }
 
     // ── クエリ ──────────────────────────────────────────
     QueryBuilder query() { return QueryBuilder{*this}; }
 
+    /// query().each<Ts...>(func) の短縮形
+    template <Component... Ts, typename F>
+    void each(F&& func) { QueryBuilder{*this}.each<Ts...>(std::forward<F>(func)); }
+
+    /// query().par_each<Ts...>(func, js) の短縮形
+    template <Component... Ts, typename F>
+    void par_each(F&& func, JobSystem& js = global_job_system()) {
+        QueryBuilder{*this}.par_each<Ts...>(std::forward<F>(func), js);
+    }
+
+    /// 永続クエリを登録 (同一条件の登録は共有)。以後の Archetype 生成時に増分照合
+    Query register_query(std::vector<TypeID> required, std::vector<TypeID> excluded);
+
+    template <Component... Ts>
+    Query cached_query() { return register_query({type_id<Ts>()...}, {}); }
+
+    // ── 変更検知 ────────────────────────────────────────
+    /// 書き込みを刻印する tick (システム実行中はそのシステムの実行 tick)
+    [[nodiscard]] Tick change_tick() const;
+
+    /// changed / added の既定の基準 tick。システム実行中は前回実行時、
+    /// それ以外は最後の clear_trackers() 時点
+    [[nodiscard]] Tick last_change_tick() const;
+
+    /// システム外での変更検知の区切り (フレーム末などで呼ぶ)
+    void clear_trackers();
+    /// 次に払い出す tick を next まで進める (戻しはしない)。長時間稼働後の状態の再現用
+    void advance_change_tick(Tick next);
+
+    /// 呼び出しスレッドをシステム実行中にする。戻り値は元のスコープ (end_system_ticks に渡す)
+    ChangeTickScope begin_system_ticks(Tick last_run);
+    /// スコープを戻し、終了したシステムの実行 tick を返す
+    Tick end_system_ticks(const ChangeTickScope& previous);
+
     // ── システム ────────────────────────────────────────
     SystemScheduler& scheduler() { return scheduler_; }
 
+    // ── 構造変更の通知 (OnAdd / OnRemove) ───────────────
+    /// comp_index の event をキューに溜めるようにする (SystemScheduler::add_trigger から呼ばれる)
+    void observe(TriggerEvent event, u32 comp_index);
+
+    /// 溜まったイベントをコンポーネントごとの Entity 列にまとめてトリガーへ通知する。
+    /// ハンドラ内の構造変更で生じたイベントも続けて通知する
+    void flush_observers();
+
     // ── コマンドバッファ ────────────────────────────────
     CommandBuffer& command_buffer() { return cmd_buffer_; }
-    void flush_commands();          // コマンドバッファを一括適用
+    CommandApplyStats flush_commands();   // コマンドバッファを一括適用
+
+    // ── メモリ整理 ──────────────────────────────────────
+    /// 小さな単位 (Archetype 1 つ・並べ替え 1 チャンク分・records_ 4096 件・疎集合 1 つ・
+    /// ChunkPool 64 ブロック) ごとに整理し、budget_us を超えた時点で中断する (次回は続きから)。
+    /// 1 回の呼び出しで少なくとも 1 単位は処理する。Archetype → Entity 空き番号 → 疎集合 →
+    /// ChunkPool の順に進み、最後の単位を終えた呼び出しで done を返す。
+    /// 予算で区切らない処理: 並べ替える Archetype の行順の計算 (行数 n に対し O(n log n)) と、
+    /// 空き番号の走査中に spawn / despawn された index の突き合わせ (その件数に比例)、
+    /// 呼び出しの最後にまとめて行う空の Archetype の破棄。
+    /// 呼び出しの間に並べ替え中の Archetype の行が増減したら、その並べ替えは打ち切る。
+    /// 反復 / システム実行中は呼ばないこと (行番号と Archetype が変わり得る)。
+    /// 破棄した Archetype は Query::archetypes() からも外れる
+    CompactStats compact(f64 budget_us, const CompactOptions& options = {});
+
+    // ── 文字列表 ────────────────────────────────────────
+    /// text を文字列表に登録して番号を返す (同じ文字列は同じ番号)。
+    /// 登録した文字列は World の破棄 (またはスナップショットの読み込み) まで残る
+    u32 intern(std::string_view text);
+    /// 登録済みの番号 (なければ invalid_string)。登録はしない
+    [[nodiscard]] u32 find_string(std::string_view text) const;
+    /// 番号 → 文字列 (範囲外なら空)。参照は文字列表が置き換わるまで有効
+    [[nodiscard]] std::string_view string(u32 id) const {
+        return id < strings_.size() ? std::string_view{strings_[id]} : std::string_view{};
+    }
+    [[nodiscard]] u32 string_count() const { return static_cast<u32>(strings_.size()); }
+
+    // ── スナップショット ────────────────────────────────
+    /// 全 Entity と Archetype / 疎集合のデータを out の末尾に書き出す。
+    /// 型は TypeRegistry の名前で記録する (未登録の型があれば NotFound)。文字列表も含み、
+    /// 番号は読み込み後も変わらない。変更 tick は含まない
+    Result<void> save_snapshot(std::vector<u8>& out) const;
+    Result<void> save_snapshot(const std::string& path) const;
+
+    /// 空の World にスナップショットを読み込む。Entity の index / 世代はそのまま復元する。
+    /// 読み込んだ行は追加扱いの tick を持ち、OnAdd は通知しない。関係の索引は読み込み後に
+    /// 作り直す (ChildOf 以外の関係は読み込み前に register_relation しておくこと)。
+    /// 画像全体を検証してから取り込むため、失敗時 (壊れた / 途中で切れたデータ) は World は空のまま
+    Result<void> load_snapshot(std::span<const u8> data);
+    Result<void> load_snapshot(const std::string& path);
+
+    /// スナップショットファイルを私的写像 (MAP_PRIVATE / FILE_MAP_COPY) して空の World に読み込む。
+    /// チャンクのレイアウトが一致する Archetype は画像をコピーせずそのままチャンクにし、
+    /// 最初の書き込みでページ単位に複製される (copy-on-write)。書き込まれないページは
+    /// 同じファイルを写像した他プロセスと共有される。一致しない Archetype は load_snapshot と
+    /// 同じく複製する。写像は World の破棄まで保持する (失敗時はすぐに解除する)
+    Result<void> map_snapshot(const std::string& path);
 
     // ── 統計 ────────────────────────────────────────────
     [[nodiscard]] u32 entity_count() const { return alive_count_; }
     [[nodiscard]] u32 archetype_count() const { return static_cast<u32>(archetypes_.size()); }
+    [[nodiscard]] const ChunkPool& chunk_pool() const { return chunk_pool_; }
 
     // ── 内部 (QueryBuilder / CommandBuffer から呼ばれる) ──
     std::vector<Archetype*> find_archetypes_with(const std::vector<TypeID>& required,
                                                   const std::vector<TypeID>& excluded);
 
+    /// 条件に合う空でない Archetype ごとに fn(Archetype&) を呼ぶ (確保なし)
+    template <typename F>
+    void visit_archetypes(const ComponentMask& required, const ComponentMask& excluded, F&& fn) {
+        for (auto& [_, arch] : archetypes_) {
+            if (arch->count() > 0 && archetype_matches(*arch, required, excluded)) fn(*arch);
+        }
+    }
+
+    // ── 疎集合の条件を含むクエリ ────────────────────────
+    // 必須の疎集合があれば最小のものの密配列を起点に Entity を辿り、Archetype 側の条件
+    // (Archetype ごとに 1 回判定) と残りの疎集合を確かめる。除外だけなら Archetype の
+    // チャンクを走査して行ごとに除外する
+    struct MixedTerms {
+        static constexpr u32 max_sparse_terms = 8;
+        ComponentMask arch_required;
+        ComponentMask arch_excluded;
+        SparseSet*    driver = nullptr;            // 最小の必須疎集合
+        u32           driver_index = invalid_component_index;
+        SparseSet*    with[max_sparse_terms]    = {};   // driver 以外の必須疎集合
+        SparseSet*    without[max_sparse_terms] = {};
+        u32           with_count    = 0;
+        u32           without_count = 0;
+    };
+
+    [[nodiscard]] bool involves_sparse(const ComponentMask& required, const ComponentMask& excluded) const {
+        return required.intersects(sparse_mask_) || excluded.intersects(sparse_mask_);
+    }
+    [[nodiscard]] MixedTerms split_terms(const ComponentMask& required, const ComponentMask& excluded) const;
+
+    template <typename... Ts, typename F>
+    void each_mixed(const MixedTerms& terms, F& func, const detail::ChunkFilter& filter, Tick tick);
+    template <typename... Ts, typename F>
+    void par_each_mixed(const MixedTerms& terms, F& func, const detail::ChunkFilter& filter, JobSystem& js);
+
+    /// 関係 rel_index で target を参照する Entity のうち、terms に合うものを走査 (参照元の数に比例)
+    template <typename... Ts, typename F>
+    void each_related(u32 rel_index, Entity target, const MixedTerms& terms, F& func,
+                      const detail::ChunkFilter& filter, Tick tick);
+    template <typename... Ts, typename F>
+    void par_each_related(u32 rel_index, Entity target, const MixedTerms& terms, F& func,
+                          const detail::ChunkFilter& filter, JobSystem& js);
+
     // raw API (CommandBuffer 向け public アクセサ)
     void  add_component_raw_public(Entity e, TypeID tid, usize size, usize align, const void* data)
-        { add_component_raw(e, tid, size, align, data); }
-    void  remove_component_raw_public(Entity e, TypeID tid) { remove_component_raw(e, tid); }
-    void* get_component_raw_public(Entity e, TypeID tid)    { return get_component_raw(e, tid); }
+        { add_component_impl(e, ComponentInfo{tid, size, align, "", component_index(tid)}, data); }
+    void  remove_component_raw_public(Entity e, TypeID tid) { remove_component_impl(e, component_index(tid)); }
+    void* get_component_raw_public(Entity e, TypeID tid)    { return get_component_impl(e, component_index(tid)); }
 
 private:
-    void add_component_raw(Entity e, TypeID tid, usize size, usize align, const void* data);
-    void remove_component_raw(Entity e, TypeID tid);
-    void* get_component_raw(Entity e, TypeID tid);
-    const void* get_component_raw(Entity e, TypeID tid) const;
-    bool has_component_raw(Entity e, TypeID tid) const;
+    friend class CommandBuffer;   // 適用時はコンポーネントインデックスで直接操作する
+
+    Entity allocate_entity();
+    void set_storage_impl(const ComponentInfo& info, StorageKind kind);
+    void remove_sparse(Entity e);
+    void register_relation_impl(const ComponentInfo& info, usize target_offset, RelationCleanup cleanup);
+    // 関係コンポーネントの現在値で索引を更新 (コンポーネントがなければ外す)
+    void relink(Entity e, u32 comp_index);
+    // e を参照元 / 参照先とする関係を片付ける (despawn 前)。Despawn 後始末の参照元は despawn_queue_ へ積む
+    void cleanup_relations(Entity e);
+    // 関係を見ずに e を Archetype / 疎集合から外して解放する
+    void destroy_entity(Entity e);
+    void write_component(Entity e, const ComponentInfo& info, const void* data);
+    // 合成適用で削除 → 再追加が打ち消し合ったコンポーネント: 逐次適用と同じ通知と追加 tick
+    void readd_component(Entity e, u32 comp_index);
+    // 空の Archetype を破棄し、それを指す遷移辺 / 移動辺キャッシュ / クエリの参照を消す
+    usize free_archetypes(std::span<Archetype* const> doomed);
+    // compact の 1 単位 (戻り値は解放したバイト数)
+    usize compact_archetype_step(const CompactOptions& options, CompactStats& stats,
+                                 std::vector<Archetype*>& doomed);
+    usize compact_sort_step(CompactStats& stats);
+    usize compact_records_step();
+    usize compact_pool_step(const CompactOptions& options, CompactStats& stats);
+    // 空き番号の走査済み範囲で index が再利用 / 解放されたら記録する (走査の最後に突き合わせる)
+    void note_compact_touched(u32 index) {
+        if (compact_.phase == CompactProgress::Phase::Records && index >= compact_.cursor) {
+            compact_.touched.push_back(index);
+        }
+    }
+    Result<void> write_snapshot(SnapshotSink& sink) const;
+    // in_place: data は snapshot_map_ の写像 — 一致するチャンク画像をそのまま使う
+    Result<void> read_snapshot(std::span<const u8> data, bool in_place);
+    void unmap_snapshot();
+
+    [[nodiscard]] static bool archetype_terms_match(const MixedTerms& t, const Archetype* arch) {
+        return arch ? archetype_matches(*arch, t.arch_required, t.arch_excluded) : t.arch_required.empty();
+    }
+    [[nodiscard]] static bool sparse_terms_match(const MixedTerms& t, u32 index) {
+        for (u32 i = 0; i < t.with_count; ++i)    if (!t.with[i]->contains(index)) return false;
+        for (u32 i = 0; i < t.without_count; ++i) if (t.without[i]->contains(index)) return false;
+        return true;
+    }
+    // 関係の参照元 1 件がクエリ条件 (driver を含む全項とチャンクフィルタ) に合うか
+    [[nodiscard]] bool related_row_matches(const MixedTerms& t, const detail::ChunkFilter& filter, Entity e) const;
+    // 1 行分の項 (疎集合ならページ表を引く)
+    template <typename T>
+    T& term_ref(Archetype* arch, u32 row, Entity e);
+    // changed / added の疎集合の項を要素ごとに確かめる (Archetype の項は ChunkFilter がチャンク単位で判定)
+    [[nodiscard]] bool sparse_filter_passes(const detail::ChunkFilter& filter, u32 index) const;
+    // Archetype の項のチャンク内カラム先頭 (疎集合の項は nullptr)。
+    // 行ごとに列を引かないよう、走査側はチャンクが切り替わったときだけ取り直す
+    template <typename... Ts>
+    [[nodiscard]] std::array<void*, sizeof...(Ts)> chunk_columns(Archetype* arch, u32 chunk);
+    // 疎集合の項の格納先 (Archetype の項は nullptr)。走査の開始時に 1 回だけ引く
+    template <typename... Ts>
+    [[nodiscard]] std::array<SparseSet*, sizeof...(Ts)> sparse_terms() const;
+    // Archetype の非 const 項をチャンク単位で変更済みにする
+    template <typename... Ts>
+    void mark_chunk(Archetype& arch, u32 chunk, Tick tick);
+    // 疎集合の非 const 項を要素ごとに tick で変更済みにして func を呼ぶ
+    // (Archetype の項は呼び出し側が mark_chunk で刻む)。slot はチャンク内の行、
+    // dense は起点の疎集合 driver 内の位置 (起点の項はページ表を引かない)
+    template <typename... Ts, typename F>
+    void visit_row(F& func, const std::array<void*, sizeof...(Ts)>& columns,
+                   const std::array<SparseSet*, sizeof...(Ts)>& sets, u32 slot, Entity e, Tick tick,
+                   const SparseSet* driver = nullptr, u32 dense = 0);
+    template <typename... Ts, typename F>
+    void visit_related(F& func, const EntityRecord& rec, Entity e, Tick tick, bool mark_table);
+    template <typename... Ts, typename F>
+    void each_mixed_range(const MixedTerms& terms, F& func, const detail::ChunkFilter& filter,
+                          Tick tick, u32 begin, u32 end);
+    template <typename... Ts, typename F>
+    void each_mixed_chunk(const MixedTerms& terms, F& func, const detail::ChunkFilter& filter,
+                          Archetype& arch, u32 chunk, Tick tick);
+    // 内部はコンポーネントインデックスで扱う (TypeID のハッシュ検索なし)
+    void add_component_impl(Entity e, const ComponentInfo& info, const void* data);
+    void remove_component_impl(Entity e, u32 comp_index);
+    void* get_component_impl(Entity e, u32 comp_index);
+    const void* get_component_impl(Entity e, u32 comp_index) const;
+    bool has_component_impl(Entity e, u32 comp_index) const;
+    // removes を外し adds を足した最終構成へ 1 回の移動で遷移する (追加分はゼロ初期化)。
+    // 移動辺は (移動元, 移動先の署名) ごとにキャッシュし、2 回目以降は 1 回の検索で済む
+    // 疎集合のコンポーネントはその場で付け外しする。戻り値は Archetype を移動したか
+    bool migrate_entity(Entity e, std::span<const ComponentInfo> adds, std::span<const u32> removes);
 
     Archetype* find_or_create_archetype(const std::vector<ComponentInfo>& comps);
+    static bool archetype_matches(const Archetype& arch, const ComponentMask& required,
+                                  const ComponentMask& excluded) {
+        return arch.signature().contains_all(required) && !arch.signature().intersects(excluded);
+    }
+    const ArchetypeEdge& add_edge(Archetype* src, const ComponentInfo& info);
+    const ArchetypeEdge& remove_edge(Archetype& src, TypeID tid);
+    void patch_swapped(Archetype* arch, u32 row);
+
+    // 未通知の構造変更イベント (コンポーネントインデックス別)
+    struct ObserverQueue {
+        ComponentMask                    observed;   // トリガーが登録されたコンポーネント
+        ComponentMask                    pending;    // Entity が溜まっているコンポーネント
+        std::vector<std::vector<Entity>> entities;   // 添字 = コンポーネントインデックス
+        bool                             active = false;
+    };
+    static void queue_event(ObserverQueue& q, u32 comp_index, Entity e) {
+        if (!q.active || !q.observed.test(comp_index)) return;
+        q.entities[comp_index].push_back(e);
+        q.pending.set(comp_index);
+    }
+    // set にあり minus にない監視対象コンポーネントそれぞれに entities を積む
+    static void queue_events(ObserverQueue& q, const ComponentMask& set, const ComponentMask& minus,
+                             std::span<const Entity> entities);
+    void dispatch_queue(ObserverQueue& q, TriggerEvent event);
 
     std::vector<EntityRecord>                     records_;
+    u8*                                           snapshot_map_ = nullptr;   // map_snapshot の写像 (~World で解除)
+    usize                                         snapshot_map_bytes_ = 0;
     std::vector<u32>                              free_indices_;
+    ChunkPool                                     chunk_pool_;   // archetypes_ より先に宣言 (後に破棄)
     std::unordered_map<ArchetypeID, std::unique_ptr<Archetype>> archetypes_;
+    std::unordered_map<TypeID, ArchetypeEdge>     root_edges_;   // コンポーネント無し → 1 コンポーネント
+    std::vector<Entity>                           batch_entities_;   // spawn_batch の戻り値
+    std::vector<Entity>                           despawn_queue_;    // despawn の連鎖作業列
+    // 文字列表 (deque なので登録しても既存の文字列は動かない)。検索は string_view のまま引く
+    struct StringHash {
+        using is_transparent = void;
+        usize operator()(std::string_view text) const { return std::hash<std::string_view>{}(text); }
+    };
+    std::deque<std::string>                       strings_;
+    std::unordered_map<std::string, u32, StringHash, std::equal_to<>> string_ids_;
+    std::vector<std::unique_ptr<QueryState>>      queries_;          // 登録済みクエリ
     u32                                           alive_count_ = 0;
+    std::atomic<Tick>                             change_tick_{1};   // 次に払い出す tick
+    Tick                                          tracker_tick_ = 0;
+    // migrate_entity の移動辺キャッシュ (移動元 Archetype, 移動先の署名) → 辺
+    struct MigrationKey {
+        const Archetype* source;
+        ComponentMask    target;
+        bool operator==(const MigrationKey&) const = default;
+    };
+    struct MigrationKeyHash {
+        usize operator()(const MigrationKey& k) const {
+            return static_cast<usize>(k.target.hash() ^ (reinterpret_cast<std::uintptr_t>(k.source) * 0x9E3779B97F4A7C15ULL));
+        }
+    };
+    std::unordered_map<MigrationKey, ArchetypeEdge, MigrationKeyHash> migrate_edges_;
+    ObserverQueue                                 on_add_;
+    ObserverQueue                                 on_remove_;
+    std::vector<Entity>                           observer_batch_;   // 通知中の Entity 列
+    std::vector<std::unique_ptr<SparseSet>>       sparse_;           // 添字 = コンポーネントインデックス
+    ComponentMask                                 sparse_mask_;
+    std::vector<std::unique_ptr<RelationIndex>>   relations_;        // 添字 = コンポーネントインデックス
+    ComponentMask                                 relation_mask_;
+    bool                                          flushing_observers_ = false;
+    // compact の巡回状態 (呼び出しをまたいで続きから再開する)
+    struct CompactProgress {
+        enum class Phase : u8 { Idle, Archetypes, Records, Sparse, Pool };
+        Phase                    phase = Phase::Idle;
+        std::vector<ArchetypeID> queue;            // 未処理の Archetype
+        bool                     sorting = false;  // sort_arch の行を並べ替え中
+        ArchetypeID              sort_arch = 0;
+        u32                      sort_count = 0;   // 開始時の行数 (変わったら打ち切る)
+        u32                      sort_row = 0;     // [0, sort_row) は並べ替え済み
+        std::vector<Entity>      sort_order;       // 目標の行順 (Entity index 順)
+        u32                      cursor = 0;       // records_ の走査位置 (末尾から降順、[cursor, 末尾) が走査済み)
+        std::vector<u32>         free;             // 走査済み範囲の空き番号 (降順)
+        std::vector<u32>         touched;          // 走査済み範囲で走査後に再利用 / 解放された index
+        u32                      sparse = 0;       // 次に縮める疎集合のコンポーネントインデックス
+    };
+    CompactProgress                               compact_;
     SystemScheduler                               scheduler_{*this};
     CommandBuffer                                 cmd_buffer_;
 };
 
+// ── World::spawn_batch テンプレート実装 ────────────────
+template <Component... Ts, typename Init>
+std::span<const Entity> World::spawn_batch(u32 count, Init&& init) {
+    const std::array<ComponentInfo, sizeof...(Ts)> infos{
+        make_component_info<Ts>("")...
+    };
+    std::span<const Entity> spawned = spawn_batch_raw(count, infos);
+    if constexpr (sizeof...(Ts) > 0) {
+        if (spawned.empty()) return spawned;
+        if ((is_sparse(component_index<Ts>()) || ...)) {
+            // 疎集合を含む構成は 1 件ずつ格納先を引く
+            for (u32 i = 0; i < count; ++i) {
+                const auto& rec = records_[spawned[i].index()];
+                init(i, term_ref<Ts>(rec.archetype, rec.row, spawned[i])...);
+            }
+        } else {
+            const auto& head = records_[spawned.front().index()];
+            Archetype* arch = head.archetype;
+            u32 first = head.row;
+            // チャンク境界ごとにカラムポインタを取り直して連続書き込み
+            for (u32 done = 0; done < count;) {
+                u32 row   = first + done;
+                u32 chunk = row / arch->chunk_capacity();
+                u32 start = row % arch->chunk_capacity();
+                u32 n     = std::min(arch->chunk_size(chunk) - start, count - done);
+                std::tuple<Ts*...> cols{static_cast<Ts*>(arch->chunk_column(chunk, type_id<Ts>())) + start...};
+                for (u32 i = 0; i < n; ++i) {
+                    init(done + i, std::get<Ts*>(cols)[i]...);
+                }
+                done += n;
+            }
+        }
+        // init で書かれた関係の参照先を索引へ
+        auto relink_all = [&](u32 idx) {
+            if (!relation_mask_.test(idx)) return;
+            for (Entity e : spawned) relink(e, idx);
+        };
+        (relink_all(component_index<Ts>()), ...);
+    }
+    return spawned;
+}
+
 // ── QueryBuilder::for_each テンプレート実装 ─────────────
 template <Component... Ts>
-void QueryBuilder::for_each(std::function<void(Entity, Ts&...)> func) const {
+void QueryBuilder::for_each(std::type_identity_t<std::function<void(Entity, Ts&...)>> func) const {
+    if (has_relation_ || world_.involves_sparse(required_mask_, excluded_mask_)) {
+        ComponentMask required = required_mask_;
+        (required.set(component_index<Ts>()), ...);
+        const detail::ChunkFilter filter{changed_, added_, filter_since()};
+        const World::MixedTerms terms = world_.split_terms(required, excluded_mask_);
+        if (has_relation_) {
+            world_.each_related<Ts...>(relation_index_, relation_, terms, func, filter, world_.change_tick());
+        } else {
+            world_.each_mixed<Ts...>(terms, func, filter, world_.change_tick());
+        }
+        return;
+    }
     auto matches = execute();
+    const Tick tick = world_.change_tick();
     for (auto& m : matches) {
-        auto entities = m.archetype->entities();
-        // 各コンポーネントのカラムポインタを取得
+        auto entities = m.archetype->chunk_entities(m.chunk);
+        std::array<i32, sizeof...(Ts)> cols{m.archetype->column_of(component_index<Ts>())...};
+        detail::mark_written<Ts...>(*m.archetype, m.chunk, cols, tick, std::index_sequence_for<Ts...>{});
+        // チャンク内の各コンポーネントのカラムポインタを取得
         std::tuple<Ts*...> ptrs{
-            static_cast<Ts*>(m.archetype->column(type_id<Ts>())->raw())...
+            static_cast<Ts*>(m.archetype->chunk_column(m.chunk, type_id<Ts>()))...
         };
         for (u32 i = 0; i < m.count; ++i) {
             func(entities[i], (std::get<Ts*>(ptrs)[i])...);
@@ -122,4 +589,375 @@ void QueryBuilder::for_each(std::function<void(Entity, Ts&...)> func) const {
     }
 }
 
+// ── QueryBuilder::each テンプレート実装 ────────────────
+template <Component... Ts, typename F>
+void QueryBuilder::each(F&& func) const {
+    ComponentMask required = required_mask_;
+    (required.set(component_index<Ts>()), ...);
+    const detail::ChunkFilter filter{changed_, added_, filter_since()};
+    const Tick tick = world_.change_tick();
+    if (has_relation_) {
+        world_.each_related<Ts...>(relation_index_, relation_, world_.split_terms(required, excluded_mask_),
+                                   func, filter, tick);
+        return;
+    }
+    if (world_.involves_sparse(required, excluded_mask_)) {
+        world_.each_mixed<Ts...>(world_.split_terms(required, excluded_mask_), func, filter, tick);
+        return;
+    }
+    world_.visit_archetypes(required, excluded_mask_, [&](Archetype& arch) {
+        detail::each_archetype<Ts...>(arch, func, tick, filter);
+    });
+}
+
+template <Component... Ts, typename F>
+void Query::each(F&& func) const {
+    World& world = *state_->world;
+    const Tick tick = world.change_tick();
+    if (world.involves_sparse(state_->required_mask, state_->excluded_mask)) {
+        ComponentMask required = state_->required_mask;
+        (required.set(component_index<Ts>()), ...);
+        world.each_mixed<Ts...>(world.split_terms(required, state_->excluded_mask), func, {}, tick);
+        return;
+    }
+    for (Archetype* arch : state_->archetypes) {
+        if (arch->count() > 0) detail::each_archetype<Ts...>(*arch, func, tick);
+    }
+}
+
+// ── par_each 共通実装 ───────────────────────────────────
+namespace detail {
+
+struct ChunkRef {
+    Archetype* archetype;
+    u32        chunk;
+};
+
+/// 全 Ts を持つ Archetype のチャンクを作業リストに積む
+template <typename... Ts>
+inline void collect_chunks(Archetype& arch, std::vector<ChunkRef>& work, const ChunkFilter& filter = {}) {
+    if (((arch.column_of(component_index<Ts>()) < 0) || ...)) return;
+    for (u32 chunk = 0; chunk < arch.chunk_count(); ++chunk) {
+        if (arch.chunk_size(chunk) == 0) continue;
+        if (!filter.empty() && !filter.passes(arch, chunk)) continue;
+        work.push_back(ChunkRef{&arch, chunk});
+    }
+}
+
+template <typename... Ts, typename F>
+void par_each_chunks(World& world, JobSystem& js, const std::vector<ChunkRef>& work, F& func) {
+    if (work.empty()) return;
+    // 書き込み tick は呼び出しスレッド (実行中システム) のものを使う
+    const Tick tick = world.change_tick();
+    // 作業番号ごとのソートキー (呼び出しスレッドの前後の記録との順序を保つ)
+    u32 key_base = 0;
+    u32 source   = 0;   // 呼び出し元 (実行中システム) の記録元をワーカーへ引き継ぐ
+    if constexpr (std::is_invocable_v<F&, CommandBuffer&, Entity, Ts&...>) {
+        key_base = world.command_buffer().claim_sort_keys(static_cast<u32>(work.size()));
+        source   = world.command_buffer().sort_source();
+    }
+    // 1 チャンク = 1 バッチ (チャンク容量で行数が固定される)
+    js.parallel_for(0, static_cast<u32>(work.size()), 1, [&](u32 begin, u32 end) {
+        for (u32 w = begin; w < end; ++w) {
+            Archetype& arch = *work[w].archetype;
+            std::array<i32, sizeof...(Ts)> cols{arch.column_of(component_index<Ts>())...};
+            mark_written<Ts...>(arch, work[w].chunk, cols, tick, std::index_sequence_for<Ts...>{});
+            if constexpr (std::is_invocable_v<F&, CommandBuffer&, Entity, Ts&...>) {
+                // 作業番号のキーで記録し、適用順をスレッド割り当てに依存させない
+                CommandBuffer& cb = world.command_buffer();
+                SortKeyScope scope{cb, source, key_base + w};
+                auto bound = [&](Entity e, Ts&... comps) { func(cb, e, comps...); };
+                each_chunk<Ts...>(arch, work[w].chunk, cols, bound, std::index_sequence_for<Ts...>{});
+            } else {
+                each_chunk<Ts...>(arch, work[w].chunk, cols, func, std::index_sequence_for<Ts...>{});
+            }
+        }
+    });
+}
+
+} // namespace detail
+
+template <Component... Ts, typename F>
+void QueryBuilder::par_each(F&& func, JobSystem& js) const {
+    ComponentMask required = required_mask_;
+    (required.set(component_index<Ts>()), ...);
+    const detail::ChunkFilter filter{changed_, added_, filter_since()};
+    if (has_relation_) {
+        world_.par_each_related<Ts...>(relation_index_, relation_, world_.split_terms(required, excluded_mask_),
+                                       func, filter, js);
+        return;
+    }
+    if (world_.involves_sparse(required, excluded_mask_)) {
+        world_.par_each_mixed<Ts...>(world_.split_terms(required, excluded_mask_), func, filter, js);
+        return;
+    }
+    std::vector<detail::ChunkRef> work;
+    world_.visit_archetypes(required, excluded_mask_, [&](Archetype& arch) {
+        detail::collect_chunks<Ts...>(arch, work, filter);
+    });
+    detail::par_each_chunks<Ts...>(world_, js, work, func);
+}
+
+template <Component... Ts, typename F>
+void Query::par_each(F&& func, JobSystem& js) const {
+    World& world = *state_->world;
+    if (world.involves_sparse(state_->required_mask, state_->excluded_mask)) {
+        ComponentMask required = state_->required_mask;
+        (required.set(component_index<Ts>()), ...);
+        world.par_each_mixed<Ts...>(world.split_terms(required, state_->excluded_mask), func, {}, js);
+        return;
+    }
+    std::vector<detail::ChunkRef> work;
+    for (Archetype* arch : state_->archetypes) {
+        if (arch->count() > 0) detail::collect_chunks<Ts...>(*arch, work);
+    }
+    detail::par_each_chunks<Ts...>(*state_->world, js, work, func);
+}
+
+// ── 疎集合を含むクエリのテンプレート実装 ───────────────
+template <typename T>
+T& World::term_ref(Archetype* arch, u32 row, Entity e) {
+    const u32 idx = component_index<T>();
+    if (is_sparse(idx)) return *static_cast<T*>(sparse_[idx]->get(e.index()));
+    return *static_cast<T*>(arch->component_at(row, static_cast<u32>(arch->column_of(idx))));
+}
+
+template <typename... Ts>
+std::array<void*, sizeof...(Ts)> World::chunk_columns(Archetype* arch, u32 chunk) {
+    auto column = [&](u32 idx) -> void* {
+        if (is_sparse(idx)) return nullptr;
+        return arch->chunk_column_at(chunk, static_cast<u32>(arch->column_of(idx)));
+    };
+    return {column(component_index<Ts>())...};
+}
+
+template <typename... Ts>
+std::array<SparseSet*, sizeof...(Ts)> World::sparse_terms() const {
+    return {sparse_set(component_index<Ts>())...};
+}
+
+template <typename... Ts>
+void World::mark_chunk(Archetype& arch, u32 chunk, Tick tick) {
+    auto mark = [&](u32 idx) {
+        if (!is_sparse(idx)) arch.column_ticks(chunk, static_cast<u32>(arch.column_of(idx))).raise_changed(tick);
+    };
+    ((std::is_const_v<Ts> ? void() : mark(component_index<Ts>())), ...);
+}
+
+template <typename... Ts, typename F>
+void World::visit_row(F& func, const std::array<void*, sizeof...(Ts)>& columns,
+                      const std::array<SparseSet*, sizeof...(Ts)>& sets, u32 slot, Entity e, Tick tick,
+                      const SparseSet* driver, u32 dense) {
+    auto ref = [&]<typename T>(std::type_identity<T>, void* column, SparseSet* set) -> T& {
+        if (!set) return static_cast<T*>(column)[slot];
+        const u32 d = set == driver ? dense : set->dense_index(e.index());
+        if constexpr (!std::is_const_v<T>) set->mark_changed(d, tick);
+        return *static_cast<T*>(set->at(d));
+    };
+    [&]<usize... Is>(std::index_sequence<Is...>) {
+        if constexpr (std::is_invocable_v<F&, Entity, Ts&...>) {
+            func(e, ref(std::type_identity<Ts>{}, columns[Is], sets[Is])...);
+        } else {
+            static_assert(std::is_invocable_v<F&, Ts&...>,
+                          "each: func must accept (Entity, Ts&...) or (Ts&...)");
+            func(ref(std::type_identity<Ts>{}, columns[Is], sets[Is])...);
+        }
+    }(std::index_sequence_for<Ts...>{});
+}
+
+template <typename... Ts, typename F>
+void World::each_mixed_range(const MixedTerms& t, F& func, const detail::ChunkFilter& filter,
+                             Tick tick, u32 begin, u32 end) {
+    std::span<const Entity> ents = t.driver->entities();
+    // 密配列上で同じ Archetype・同じチャンクの Entity は並びやすいので、
+    // 項の判定・チャンクフィルタ・カラム位置は切り替わり時にだけ引き直す
+    Archetype* arch = nullptr;
+    bool arch_ok = archetype_terms_match(t, nullptr);
+    u32  chunk = ~0u;
+    bool chunk_ok = true;
+    bool chunk_marked = true;
+    std::array<void*, sizeof...(Ts)> columns{};
+    const auto sets = sparse_terms<Ts...>();
+    for (u32 k = begin; k < end; ++k) {
+        const Entity e = ents[k];
+        const EntityRecord& rec = records_[e.index()];
+        if (rec.archetype != arch) {
+            arch = rec.archetype;
+            arch_ok = archetype_terms_match(t, arch);
+            chunk = ~0u;
+            chunk_ok = true;
+            chunk_marked = true;
+            columns = {};
+        }
+        if (!arch_ok || !sparse_terms_match(t, e.index())) continue;
+        u32 slot = 0;
+        if (arch) {
+            const u32 c = rec.row / arch->chunk_capacity();
+            slot = rec.row % arch->chunk_capacity();
+            if (c != chunk) {
+                chunk = c;
+                chunk_ok = filter.empty() || filter.passes(*arch, c);
+                chunk_marked = false;
+                columns = chunk_columns<Ts...>(arch, c);
+            }
+            if (!chunk_ok) continue;
+        }
+        if (!filter.empty() && !sparse_filter_passes(filter, e.index())) continue;
+        if (!chunk_marked) {
+            mark_chunk<Ts...>(*arch, chunk, tick);
+            chunk_marked = true;
+        }
+        visit_row<Ts...>(func, columns, sets, slot, e, tick, t.driver, k);
+    }
+}
+
+template <typename... Ts, typename F>
+void World::each_mixed_chunk(const MixedTerms& t, F& func, const detail::ChunkFilter& filter,
+                             Archetype& arch, u32 chunk, Tick tick) {
+    std::span<const Entity> ents = arch.chunk_entities(chunk);
+    const auto columns = chunk_columns<Ts...>(&arch, chunk);
+    const auto sets    = sparse_terms<Ts...>();
+    bool marked = false;
+    for (u32 i = 0; i < ents.size(); ++i) {
+        if (!sparse_terms_match(t, ents[i].index())) continue;
+        if (!filter.empty() && !sparse_filter_passes(filter, ents[i].index())) continue;
+        if (!marked) {
+            mark_chunk<Ts...>(arch, chunk, tick);
+            marked = true;
+        }
+        visit_row<Ts...>(func, columns, sets, i, ents[i], tick);
+    }
+}
+
+template <typename... Ts, typename F>
+void World::each_mixed(const MixedTerms& t, F& func, const detail::ChunkFilter& filter, Tick tick) {
+    if (t.driver) {
+        each_mixed_range<Ts...>(t, func, filter, tick, 0, t.driver->size());
+        return;
+    }
+    visit_archetypes(t.arch_required, t.arch_excluded, [&](Archetype& arch) {
+        for (u32 chunk = 0; chunk < arch.chunk_count(); ++chunk) {
+            if (!filter.empty() && !filter.passes(arch, chunk)) continue;
+            each_mixed_chunk<Ts...>(t, func, filter, arch, chunk, tick);
+        }
+    });
+}
+
+template <typename... Ts, typename F>
+void World::par_each_mixed(const MixedTerms& t, F& func, const detail::ChunkFilter& filter, JobSystem& js) {
+    constexpr u32 block = 256;   // 密配列を起点にする場合の 1 作業単位
+    const Tick tick = change_tick();
+    std::vector<detail::ChunkRef> work;
+    u32 jobs = 0;
+    if (t.driver) {
+        jobs = (t.driver->size() + block - 1) / block;
+    } else {
+        visit_archetypes(t.arch_required, t.arch_excluded, [&](Archetype& arch) {
+            detail::collect_chunks<>(arch, work, filter);
+        });
+        jobs = static_cast<u32>(work.size());
+    }
+    if (jobs == 0) return;
+
+    u32 key_base = 0;
+    u32 source   = 0;
+    if constexpr (std::is_invocable_v<F&, CommandBuffer&, Entity, Ts&...>) {
+        key_base = command_buffer().claim_sort_keys(jobs);
+        source   = command_buffer().sort_source();
+    }
+    js.parallel_for(0, jobs, 1, [&](u32 begin, u32 end) {
+        for (u32 w = begin; w < end; ++w) {
+            auto run = [&](auto& fn) {
+                if (t.driver) {
+                    // 別ジョブが同じチャンクに当たっても raise_changed は CAS なので重複して刻んでよい
+                    each_mixed_range<Ts...>(t, fn, filter, tick, w * block,
+                                            std::min(t.driver->size(), (w + 1) * block));
+                } else {
+                    each_mixed_chunk<Ts...>(t, fn, filter, *work[w].archetype, work[w].chunk, tick);
+                }
+            };
+            if constexpr (std::is_invocable_v<F&, CommandBuffer&, Entity, Ts&...>) {
+                CommandBuffer& cb = command_buffer();
+                SortKeyScope scope{cb, source, key_base + w};
+                auto bound = [&](Entity e, Ts&... comps) { func(cb, e, comps...); };
+                run(bound);
+            } else {
+                run(func);
+            }
+        }
+    });
+}
+
+// ── 関係で絞るクエリのテンプレート実装 ─────────────────
+template <typename... Ts, typename F>
+void World::visit_related(F& func, const EntityRecord& rec, Entity e, Tick tick, bool mark_table) {
+    // 参照元はチャンクに散らばるので 1 件ずつカラムを引く
+    Archetype* arch = rec.archetype;
+    const u32 chunk = arch ? rec.row / arch->chunk_capacity() : 0;
+    const u32 slot  = arch ? rec.row % arch->chunk_capacity() : 0;
+    if (arch && mark_table) mark_chunk<Ts...>(*arch, chunk, tick);
+    visit_row<Ts...>(func, arch ? chunk_columns<Ts...>(arch, chunk) : std::array<void*, sizeof...(Ts)>{},
+                     sparse_terms<Ts...>(), slot, e, tick);
+}
+
+template <typename... Ts, typename F>
+void World::each_related(u32 rel_index, Entity target, const MixedTerms& t, F& func,
+                         const detail::ChunkFilter& filter, Tick tick) {
+    const RelationIndex* rel = relation_index(rel_index);
+    if (!rel || !alive(target)) return;
+    for (u32 s = rel->first_source(target.index()); s != RelationIndex::none; s = rel->next_source(s)) {
+        const Entity e = rel->source(s);
+        if (!related_row_matches(t, filter, e)) continue;
+        const EntityRecord& rec = records_[s];
+        visit_related<Ts...>(func, rec, e, tick, true);
+    }
+}
+
+template <typename... Ts, typename F>
+void World::par_each_related(u32 rel_index, Entity target, const MixedTerms& t, F& func,
+                             const detail::ChunkFilter& filter, JobSystem& js) {
+    constexpr u32 block = 256;
+    const RelationIndex* rel = relation_index(rel_index);
+    if (!rel || !alive(target)) return;
+    std::vector<Entity> sources;
+    sources.reserve(rel->source_count(target.index()));
+    for (u32 s = rel->first_source(target.index()); s != RelationIndex::none; s = rel->next_source(s)) {
+        if (related_row_matches(t, filter, rel->source(s))) sources.push_back(rel->source(s));
+    }
+    const u32 count = static_cast<u32>(sources.size());
+    if (count == 0) return;
+
+    const u32 jobs = (count + block - 1) / block;
+    u32 key_base = 0;
+    u32 source   = 0;
+    if constexpr (std::is_invocable_v<F&, CommandBuffer&, Entity, Ts&...>) {
+        key_base = command_buffer().claim_sort_keys(jobs);
+        source   = command_buffer().sort_source();
+    }
+    // 参照元は複数チャンクに散らばるため、Archetype の書き込み tick は完了後に行ごとに刻む
+    const Tick tick = change_tick();
+    js.parallel_for(0, jobs, 1, [&](u32 begin, u32 end) {
+        for (u32 w = begin; w < end; ++w) {
+            auto run = [&](auto& fn) {
+                for (u32 k = w * block; k < std::min(count, (w + 1) * block); ++k) {
+                    visit_related<Ts...>(fn, records_[sources[k].index()], sources[k], tick, false);
+                }
+            };
+            if constexpr (std::is_invocable_v<F&, CommandBuffer&, Entity, Ts&...>) {
+                CommandBuffer& cb = command_buffer();
+                SortKeyScope scope{cb, source, key_base + w};
+                auto bound = [&](Entity e, Ts&... comps) { func(cb, e, comps...); };
+                run(bound);
+            } else {
+                run(func);
+            }
+        }
+    });
+
+    for (Entity e : sources) {
+        const EntityRecord& rec = records_[e.index()];
+        if (rec.archetype) mark_chunk<Ts...>(*rec.archetype, rec.row / rec.archetype->chunk_capacity(), tick);
+    }
+}
+
 } // namespace engine::ecs
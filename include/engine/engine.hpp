@@ -15,6 +15,7 @@
 // ── ECS ─────────────────────────────────────────────────
 #include <engine/ecs/entity.hpp>
 #include <engine/ecs/component.hpp>
+#include <engine/ecs/chunk.hpp>
 #include <engine/ecs/archetype.hpp>
 #include <engine/ecs/world.hpp>
 #include <engine/ecs/system.hpp>
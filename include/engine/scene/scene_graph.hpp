@@ -2,61 +2,89 @@
  * engine/scene/scene_graph.hpp — シーングラフ
  *
  * 親子階層構造 + ワールド行列の伝搬。
- * ECS Entity をノードに紐づけ。
+ * ノードは SceneNode コンポーネントを持つ ECS Entity で、親子は ecs::ChildOf 関係で表す。
+ * 子の列挙は World の関係索引を引くため子の数に比例し、グラフ側に親子の表は持たない。
+ * 親を despawn すると子孫も despawn される (ChildOf の既定の後始末)。
+ * 名前は World の文字列表に登録し、SceneName コンポーネントにはその番号を持つ。
+ * グラフの状態はすべて World にあり、World::save_snapshot / load_snapshot でそのまま保存・復元できる。
  */
 #pragma once
 
-#include <engine/ecs/entity.hpp>
+#include <engine/ecs/world.hpp>
 #include <engine/core/types.hpp>
+#include <functional>
 #include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
-#include <unordered_map>
 
 namespace engine::scene {
 
 using ecs::Entity;
 
-// ── SceneNode ───────────────────────────────────────────
+// ── SceneNode (コンポーネント) ──────────────────────────
 struct SceneNode {
-    Entity             entity;
-    std::string        name;
-    Entity             parent = Entity::null();
-    std::vector<Entity> children;
-    bool               active = true;
+    bool active = true;
+};
+
+// ── SceneName (コンポーネント) ──────────────────────────
+// 名前のあるノードだけが持つ。名前の長さに制限はなく、本体は World::string(id) で引く
+struct SceneName {
+    u32 id = ecs::invalid_string;
 };
 
 // ── SceneGraph ──────────────────────────────────────────
 class SceneGraph {
 public:
-    SceneGraph() = default;
+    explicit SceneGraph(ecs::World& world)
+        : world_(world),
+          nodes_(world.cached_query<SceneNode>()),
+          named_nodes_(world.cached_query<SceneNode, SceneName>()) {}
 
-    /// ノード追加
+    /// ノード追加 (entity に SceneNode を付け、parent が有効なら ChildOf を張る)
     Entity add_node(Entity entity, const std::string& name, Entity parent = Entity::null());
 
-    /// 親子関係変更
+    /// 親子関係変更 (null でルートへ)。自身の子孫を親にする変更は無視
     void reparent(Entity entity, Entity new_parent);
 
-    /// ノード削除 (子も再帰的に)
+    /// ノード削除 (子孫もまとめて)。グラフから外すだけで Entity は残る
     void remove_node(Entity entity);
 
-    /// ノード取得
-    [[nodiscard]] SceneNode*       find(Entity entity);
-    [[nodiscard]] const SceneNode* find(Entity entity) const;
+    /// ノード取得 (ノードでなければ nullptr)
+    [[nodiscard]] SceneNode*       find(Entity entity) { return world_.get_component<SceneNode>(entity); }
+    [[nodiscard]] const SceneNode* find(Entity entity) const {
+        return std::as_const(world_).get_component<SceneNode>(entity);
+    }
+
+    [[nodiscard]] bool contains(Entity entity) const { return world_.has_component<SceneNode>(entity); }
+    [[nodiscard]] Entity parent(Entity entity) const { return world_.target_of<ecs::ChildOf>(entity); }
+    [[nodiscard]] u32 child_count(Entity entity) const { return world_.source_count<ecs::ChildOf>(entity); }
 
-    /// 名前検索
-    [[nodiscard]] Entity find_by_name(const std::string& name) const;
+    /// 子ごとに fn(Entity) を呼ぶ (子の数に比例)
+    template <typename F>
+    void each_child(Entity entity, F&& fn) const { world_.each_source<ecs::ChildOf>(entity, fn); }
 
-    /// ルートノード一覧
-    [[nodiscard]] const std::vector<Entity>& roots() const { return roots_; }
+    /// ノード名 (ノードでないか無名なら空。World の文字列表を指す)
+    [[nodiscard]] std::string_view name(Entity entity) const;
+
+    /// 名前検索 (完全一致。文字列表の番号で名前付きノードの永続クエリを走査する)
+    [[nodiscard]] Entity find_by_name(std::string_view name) const;
+
+    /// ルートノード一覧 (親を持たないノード)
+    [[nodiscard]] std::vector<Entity> roots() const;
 
     /// 深さ優先でノード列挙
     void traverse(Entity root, std::function<void(Entity, u32 depth)> visitor) const;
 
-    [[nodiscard]] u32 node_count() const { return static_cast<u32>(nodes_.size()); }
+    /// ノード数 (SceneNode を持つ Archetype の行数の和。ノード数に依らない)
+    [[nodiscard]] u32 node_count() const { return nodes_.entity_count(); }
+
+    [[nodiscard]] ecs::World& world() const { return world_; }
 
 private:
-    std::unordered_map<u64, SceneNode> nodes_;   // Entity.id → Node
-    std::vector<Entity>                roots_;
+    ecs::World& world_;
+    ecs::Query  nodes_;         // SceneNode の永続クエリ
+    ecs::Query  named_nodes_;   // SceneNode + SceneName
 };
 
 } // namespace engine::scene
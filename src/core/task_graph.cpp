@@ -5,57 +5,190 @@
 #include <engine/core/log.hpp>
 #include <cassert>
 #include <algorithm>
+#include <bit>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 namespace engine {
 
 // ── JobSystem ───────────────────────────────────────────
 
-JobSystem::JobSystem(u32 worker_count) {
+namespace {
+// 現在のスレッドが属する JobSystem とワーカー index
+thread_local const JobSystem* t_owner    = nullptr;
+thread_local u32              t_index    = 0;
+thread_local u64              t_rng      = 0;
+thread_local JobPriority      t_priority = JobPriority::Normal;  // 実行中ジョブの優先度
+
+// xorshift64* (steal 対象のランダム選択用)
+u32 next_random() {
+    if (t_rng == 0) {
+        t_rng = reinterpret_cast<u64>(&t_rng) | 1;
+    }
+    t_rng ^= t_rng >> 12;
+    t_rng ^= t_rng << 25;
+    t_rng ^= t_rng >> 27;
+    return static_cast<u32>((t_rng * 2685821657736338717ULL) >> 32);
+}
+
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__)
+    _mm_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#else
+    std::this_thread::yield();
+#endif
+}
+
+constexpr u32 lane_bit(JobPriority p) { return 1u << static_cast<u32>(p); }
+constexpr u32 all_lanes = (1u << job_priority_count) - 1;
+} // namespace
+
+// ── InjectQueue ─────────────────────────────────────────
+
+void JobSystem::InjectQueue::push(Job* job) {
+    std::lock_guard lock(mutex);
+    usize cap = ring.size();
+    if (tail - head == cap) {
+        // 満杯 → 倍に拡張 (順序を保って詰め直す)
+        std::vector<Job*> grown(cap == 0 ? 1024 : cap * 2);   // ワーカーデックと同じ初期容量
+        for (u64 i = head; i < tail; ++i) {
+            grown[i - head] = ring[i & (cap - 1)];
+        }
+        tail -= head;
+        head = 0;
+        ring.swap(grown);
+    }
+    ring[tail++ & (ring.size() - 1)] = job;
+    count.fetch_add(1, std::memory_order_release);
+}
+
+void JobSystem::InjectQueue::reserve(usize jobs) {
+    std::lock_guard lock(mutex);
+    const usize cap = ring.size();
+    if (jobs <= cap) return;
+    std::vector<Job*> grown(std::bit_ceil(jobs));
+    for (u64 i = head; i < tail; ++i) {
+        grown[i - head] = ring[i & (cap - 1)];
+    }
+    tail -= head;
+    head = 0;
+    ring.swap(grown);
+}
+
+Job* JobSystem::InjectQueue::pop() {
+    if (count.load(std::memory_order_acquire) == 0) return nullptr;
+    std::lock_guard lock(mutex);
+    if (head == tail) return nullptr;
+    Job* job = ring[head++ & (ring.size() - 1)];
+    count.fetch_sub(1, std::memory_order_relaxed);
+    return job;
+}
+
+// ── JobSystem ───────────────────────────────────────────
+
+JobSystem::JobSystem(u32 worker_count)
+    : JobSystem(JobSystemDesc{worker_count}) {}
+
+JobSystem::JobSystem(const JobSystemDesc& desc) {
+    u32 worker_count = desc.worker_count;
     if (worker_count == 0) {
         worker_count = std::max(1u, std::thread::hardware_concurrency() - 1);
     }
-    queues_.resize(worker_count);
-    workers_.reserve(worker_count);
-    for (u32 i = 0; i < worker_count; ++i) {
+    frame_workers_ = worker_count;
+    u32 total = worker_count + desc.background_workers;
+    spin_budget_.store(desc.spin_budget, std::memory_order_relaxed);
+    queues_.reserve(total);
+    for (u32 i = 0; i < total; ++i) {
+        queues_.push_back(std::make_unique<WorkerQueues>(desc.initial_capacity));
+    }
+    for (auto& inject : inject_) inject.reserve(desc.initial_capacity);
+    workers_.reserve(total);
+    for (u32 i = 0; i < total; ++i) {
         workers_.emplace_back([this, i] { worker_loop(i); });
     }
-    ENG_INFO("JobSystem: %u workers started", worker_count);
+    ENG_INFO("JobSystem: %u workers (+%u background) started",
+             worker_count, desc.background_workers);
 }
 
 JobSystem::~JobSystem() {
     shutdown_.store(true, std::memory_order_release);
-    cv_.notify_all();
+    for (auto& lot : lots_) {
+        lot.epoch.fetch_add(1, std::memory_order_release);
+        lot.epoch.notify_all();
+    }
     for (auto& w : workers_) {
         if (w.joinable()) w.join();
     }
 }
 
+u32 JobSystem::current_worker() const {
+    return t_owner == this ? t_index : static_cast<u32>(queues_.size());
+}
+
+JobPriority JobSystem::current_priority() {
+    return t_priority;
+}
+
+// 取り出し対象レーン: Background 専用ワーカーは Background のみ。
+// 専用ワーカーがいる場合、それ以外 (外部スレッド含む) は Background を除外。
+u32 JobSystem::lane_mask(u32 self) const {
+    if (self >= frame_workers_ && self < queues_.size()) {
+        return lane_bit(JobPriority::Background);
+    }
+    return background_worker_count() > 0 ? all_lanes & ~lane_bit(JobPriority::Background)
+                                         : all_lanes;
+}
+
+u32 JobSystem::lot_index(u32 self) const {
+    return (self >= frame_workers_ && self < queues_.size()) ? 1 : 0;
+}
+
+void JobSystem::submit(Job* job, JobPriority priority) {
+    if (!job) return;
+    job->priority = priority;
+    submit(job);
+}
+
 void JobSystem::submit(Job* job) {
     if (!job) return;
     if (job->unfinished_deps.load(std::memory_order_acquire) <= 0) {
-        // 即座にキューへ
-        {
-            std::lock_guard lock(mutex_);
-            u32 idx = active_jobs_.fetch_add(1, std::memory_order_relaxed)
-                      % static_cast<u32>(queues_.size());
-            queues_[idx].push_back(job);
+        pending_jobs_.fetch_add(1, std::memory_order_relaxed);
+        u32 lane = static_cast<u32>(job->priority);
+        u32 self = current_worker();
+        if (self < queues_.size()) {
+            // ワーカー自身のデックへ (ロック無し)
+            queues_[self]->lanes[lane].push(job);
+        } else {
+            inject_[lane].push(job);
         }
-        cv_.notify_one();
+        wake_one(lane);
     }
     // deps > 0 の場合は、依存完了時に dependents 経由で投入される
 }
 
+void JobSystem::run_job(Job* job) {
+    JobPriority saved = t_priority;
+    t_priority = job->priority;
+    if (job->func) job->func();
+    t_priority = saved;
+    // 依存先に通知 (completed より先に行い、待機側の解放後アクセスを防ぐ)
+    for (JobLink* link = job->dependents; link; link = link->next) {
+        auto prev = link->job->unfinished_deps.fetch_sub(1, std::memory_order_acq_rel);
+        if (prev == 1) submit(link->job);
+    }
+    job->completed.store(true, std::memory_order_release);
+    pending_jobs_.fetch_sub(1, std::memory_order_acq_rel);
+}
+
 void JobSystem::wait(Job* job) {
     while (!job->completed.load(std::memory_order_acquire)) {
-        Job* stolen = steal();
-        if (stolen) {
-            if (stolen->func) stolen->func();
-            stolen->completed.store(true, std::memory_order_release);
-            // 依存先に通知
-            for (auto* dep : stolen->dependents) {
-                auto prev = dep->unfinished_deps.fetch_sub(1, std::memory_order_acq_rel);
-                if (prev == 1) submit(dep);
-            }
+        Job* next = next_job(current_worker());
+        if (next) {
+            run_job(next);
         } else {
             std::this_thread::yield();
         }
@@ -63,65 +196,114 @@ void JobSystem::wait(Job* job) {
 }
 
 void JobSystem::wait_all() {
-    // 全キューが空になるまで手伝う
-    while (true) {
-        bool all_empty = true;
-        {
-            std::lock_guard lock(mutex_);
-            for (auto& q : queues_) {
-                if (!q.empty()) { all_empty = false; break; }
-            }
-        }
-        if (all_empty) break;
-        Job* stolen = steal();
-        if (stolen) {
-            if (stolen->func) stolen->func();
-            stolen->completed.store(true, std::memory_order_release);
-            for (auto* dep : stolen->dependents) {
-                auto prev = dep->unfinished_deps.fetch_sub(1, std::memory_order_acq_rel);
-                if (prev == 1) submit(dep);
-            }
+    // 投入済みジョブが全て完了するまで手伝う
+    while (pending_jobs_.load(std::memory_order_acquire) > 0) {
+        Job* next = next_job(current_worker());
+        if (next) {
+            run_job(next);
         } else {
             std::this_thread::yield();
         }
     }
 }
 
-Job* JobSystem::steal() {
-    std::lock_guard lock(mutex_);
-    for (auto& q : queues_) {
-        if (!q.empty()) {
-            Job* job = q.front();
-            q.pop_front();
-            return job;
-        }
+// 優先度の高いレーンから: 自分のデック → 投入口 → 他ワーカーから steal
+Job* JobSystem::next_job(u32 self) {
+    u32 mask = lane_mask(self);
+    for (u32 lane = 0; lane < job_priority_count; ++lane) {
+        if (!(mask & (1u << lane))) continue;
+        Job* job = nullptr;
+        if (self < queues_.size()) job = queues_[self]->lanes[lane].pop();
+        if (!job) job = inject_[lane].pop();
+        if (!job) job = steal(self, lane);
+        if (job) return job;
     }
     return nullptr;
 }
 
+Job* JobSystem::steal(u32 self, u32 lane) {
+    u32 n = static_cast<u32>(queues_.size());
+    u32 start = next_random() % n;
+    for (u32 i = 0; i < n; ++i) {
+        u32 victim = (start + i) % n;
+        if (victim == self) continue;
+        if (Job* job = queues_[victim]->lanes[lane].steal()) return job;
+    }
+    return nullptr;
+}
+
+bool JobSystem::has_work(u32 mask) const {
+    for (u32 lane = 0; lane < job_priority_count; ++lane) {
+        if (!(mask & (1u << lane))) continue;
+        if (inject_[lane].count.load(std::memory_order_relaxed) > 0) return true;
+        for (auto& q : queues_) {
+            if (!q->lanes[lane].empty_approx()) return true;
+        }
+    }
+    return false;
+}
+
+// 自分のローカルキューが空 (= 直前の分割が盗まれた or まだ分割していない) なら分割する
+bool JobSystem::should_fork() const {
+    u32 lane = static_cast<u32>(t_priority);
+    u32 self = current_worker();
+    if (self < queues_.size()) return queues_[self]->lanes[lane].empty_approx();
+    return inject_[lane].count.load(std::memory_order_relaxed) == 0;
+}
+
+u32 JobSystem::auto_grain(u32 range) const {
+    u32 parts = 8 * (frame_workers_ + 1);
+    return std::max(1u, range / parts);
+}
+
+// ── パーク / 起床 (イベントカウント) ────────────────────
+//
+// park: epoch 読み取り → parked++ → fence → 仕事を再確認 → epoch 待機
+// wake: ジョブ公開 → fence → parked > 0 の時だけ epoch++ と notify
+// 双方の seq_cst fence により「ワーカーがジョブを見逃す」か
+// 「submit がパーク中ワーカーを見逃す」のどちらか一方しか起こらない。
+// 通常ワーカーと Background 専用ワーカーは別のイベントカウントで待つ
+// (取り出せないレーンの通知で起こされ、本来の通知を取りこぼさないため)。
+
+void JobSystem::park(u32 self) {
+    ParkingLot& lot = lots_[lot_index(self)];
+    u32 key = lot.epoch.load(std::memory_order_acquire);
+    lot.parked.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!has_work(lane_mask(self)) && !shutdown_.load(std::memory_order_acquire)) {
+        lot.epoch.wait(key, std::memory_order_acquire);   // タイムアウト無し (futex 等)
+    }
+    lot.parked.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void JobSystem::wake_one(u32 lane) {
+    bool background = lane == static_cast<u32>(JobPriority::Background) &&
+                      background_worker_count() > 0;
+    ParkingLot& lot = lots_[background ? 1 : 0];
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (lot.parked.load(std::memory_order_relaxed) == 0) return;
+    lot.epoch.fetch_add(1, std::memory_order_release);
+    lot.epoch.notify_one();
+}
+
 void JobSystem::worker_loop(u32 id) {
+    t_owner = this;
+    t_index = id;
+    u32 spins = 0;
     while (!shutdown_.load(std::memory_order_acquire)) {
-        Job* job = nullptr;
-        {
-            std::lock_guard lock(mutex_);
-            if (id < queues_.size() && !queues_[id].empty()) {
-                job = queues_[id].front();
-                queues_[id].pop_front();
-            }
-        }
-        if (!job) job = steal();
+        Job* job = next_job(id);
         if (job) {
-            if (job->func) job->func();
-            job->completed.store(true, std::memory_order_release);
-            for (auto* dep : job->dependents) {
-                auto prev = dep->unfinished_deps.fetch_sub(1, std::memory_order_acq_rel);
-                if (prev == 1) submit(dep);
-            }
+            run_job(job);
+            spins = 0;
+        } else if (spins < spin_budget_.load(std::memory_order_relaxed)) {
+            ++spins;
+            cpu_relax();
         } else {
-            std::unique_lock lock(mutex_);
-            cv_.wait_for(lock, std::chrono::milliseconds(1));
+            park(id);
+            spins = 0;
         }
     }
+    t_owner = nullptr;
 }
 
 JobSystem& global_job_system() {
@@ -129,40 +311,124 @@ JobSystem& global_job_system() {
     return sys;
 }
 
+// ── JobPool ─────────────────────────────────────────────
+
+Job* JobPool::acquire_job() {
+    if (jobs_used_ == job_chunks_.size() * chunk_size) {
+        job_chunks_.push_back(std::make_unique<Job[]>(chunk_size));
+    }
+    u32 i = jobs_used_++;
+    return &job_chunks_[i / chunk_size][i % chunk_size];
+}
+
+JobLink* JobPool::acquire_link() {
+    if (links_used_ == link_chunks_.size() * chunk_size) {
+        link_chunks_.push_back(std::make_unique<JobLink[]>(chunk_size));
+    }
+    u32 i = links_used_++;
+    return &link_chunks_[i / chunk_size][i % chunk_size];
+}
+
+void JobPool::reset() {
+    for (u32 i = 0; i < jobs_used_; ++i) {
+        job_chunks_[i / chunk_size][i % chunk_size].reset();
+    }
+    jobs_used_ = 0;
+    links_used_ = 0;
+}
+
 // ── TaskGraph ───────────────────────────────────────────
 
-Job* TaskGraph::add(std::string_view /*name*/, JobFunc func) {
-    auto job = std::make_unique<Job>();
+Job* TaskGraph::add(std::string_view /*name*/, JobFunc func, JobPriority priority) {
+    if (compiled_) {
+        ENG_WARN("TaskGraph: add() after compile() is ignored (call clear() first)");
+        return nullptr;
+    }
+    Job* job = pool_.acquire_job();
     job->func = std::move(func);
-    Job* ptr = job.get();
-    jobs_.push_back(std::move(job));
-    roots_.push_back(ptr);
-    return ptr;
+    job->priority = priority;
+    jobs_.push_back(job);
+    return job;
 }
 
 void TaskGraph::depends_on(Job* after, Job* before) {
     if (!after || !before) return;
+    if (compiled_) {
+        ENG_WARN("TaskGraph: depends_on() after compile() is ignored (call clear() first)");
+        return;
+    }
     after->unfinished_deps.fetch_add(1, std::memory_order_relaxed);
-    before->dependents.push_back(after);
-    // after はもはや root ではない
-    auto it = std::find(roots_.begin(), roots_.end(), after);
-    if (it != roots_.end()) roots_.erase(it);
+    JobLink* link = pool_.acquire_link();
+    link->job = after;
+    link->next = before->dependents;
+    before->dependents = link;
+}
+
+void TaskGraph::compile() {
+    if (compiled_) return;
+    usize n = jobs_.size();
+
+    roots_.clear();
+    initial_deps_.resize(n);
+    usize link_total = 0;
+    for (usize i = 0; i < n; ++i) {
+        i32 deps = jobs_[i]->unfinished_deps.load(std::memory_order_relaxed);
+        initial_deps_[i] = deps;
+        if (deps == 0) roots_.push_back(jobs_[i]);
+        for (JobLink* l = jobs_[i]->dependents; l; l = l->next) ++link_total;
+    }
+
+    // 依存リストを1本の配列へ詰め直す (実行時の走査が連続アクセスになる)
+    flat_links_.resize(link_total);
+    usize cursor = 0;
+    for (auto* job : jobs_) {
+        JobLink* head = nullptr;
+        JobLink* prev = nullptr;
+        for (JobLink* l = job->dependents; l; l = l->next) {
+            JobLink* flat = &flat_links_[cursor++];
+            flat->job = l->job;
+            flat->next = nullptr;
+            if (prev) prev->next = flat; else head = flat;
+            prev = flat;
+        }
+        job->dependents = head;
+    }
+    compiled_ = true;
 }
 
 void TaskGraph::execute() {
-    // ルートジョブを submit
+    if (compiled_) {
+        // カウンタを一括リセット (submit の release で各ワーカーに公開される)
+        for (usize i = 0; i < jobs_.size(); ++i) {
+            jobs_[i]->unfinished_deps.store(initial_deps_[i], std::memory_order_relaxed);
+            jobs_[i]->completed.store(false, std::memory_order_relaxed);
+        }
+    } else {
+        // ルートは submit 前に確定させる (実行中に deps が 0 になった
+        // 非ルートを二重投入しないため)
+        roots_.clear();
+        for (auto* job : jobs_) {
+            if (job->unfinished_deps.load(std::memory_order_relaxed) == 0) {
+                roots_.push_back(job);
+            }
+        }
+    }
     for (auto* root : roots_) {
         js_.submit(root);
     }
     // 全ジョブの完了を待機
-    for (auto& job : jobs_) {
-        js_.wait(job.get());
+    for (auto* job : jobs_) {
+        js_.wait(job);
     }
 }
 
 void TaskGraph::clear() {
+    pool_.reset();
     jobs_.clear();
     roots_.clear();
+    initial_deps_.clear();
+    flat_links_.clear();
+    compiled_ = false;
 }
 
 } // namespace engine
@@ -1,5 +1,5 @@
 /**
- * src/ecs/archetype.cpp — Archetype テーブル + ComponentColumn 実装
+ * src/ecs/archetype.cpp — Archetype テーブル (チャンクストレージ) 実装
  */
 #include <engine/ecs/archetype.hpp>
 #include <engine/core/log.hpp>
@@ -7,178 +7,312 @@
 #include <cstring>
 #include <algorithm>
 #include <cassert>
-#include <numeric>
-
-#ifdef _WIN32
-#include <malloc.h>
-static inline void* engine_aligned_alloc(size_t align, size_t size) {
-    return _aligned_malloc(size, align);
-}
-static inline void engine_aligned_free(void* ptr) {
-    _aligned_free(ptr);
-}
-#else
-static inline void* engine_aligned_alloc(size_t align, size_t size) {
-    return std::aligned_alloc(align, size);
-}
-static inline void engine_aligned_free(void* ptr) {
-    std::free(ptr);
-}
-#endif
 
 namespace engine::ecs {
 
-// ── ComponentColumn ─────────────────────────────────────
+namespace {
 
-ComponentColumn::ComponentColumn(usize elem_size, usize elem_align, u32 capacity)
-    : elem_size_(elem_size), elem_align_(elem_align), capacity_(capacity)
-{
-    if (capacity_ > 0) {
-        data_ = static_cast<u8*>(engine_aligned_alloc(elem_align_, elem_size_ * capacity_));
-        if (!data_) throw std::bad_alloc{};
+usize align_up(usize v, usize a) { return (v + a - 1) & ~(a - 1); }
+
+// 先頭に Entity 配列、続いて各カラム。cap 行分の総バイト数を返す。
+// タグはチャンク先頭を指す (空の型なので読み書きは発生しない)
+usize compute_layout(const std::vector<ComponentInfo>& comps, u32 cap,
+                     std::vector<u32>& offsets) {
+    usize off = sizeof(Entity) * cap;
+    offsets.resize(comps.size());
+    for (usize i = 0; i < comps.size(); ++i) {
+        if (comps[i].is_tag()) {
+            offsets[i] = 0;
+            continue;
+        }
+        off = align_up(off, comps[i].alignment);
+        offsets[i] = static_cast<u32>(off);
+        off += comps[i].size * cap;
     }
+    return off;
 }
 
-ComponentColumn::~ComponentColumn() {
-    if (data_) engine_aligned_free(data_);
-}
+} // namespace
 
-ComponentColumn::ComponentColumn(ComponentColumn&& o) noexcept
-    : data_(o.data_), elem_size_(o.elem_size_), elem_align_(o.elem_align_),
-      count_(o.count_), capacity_(o.capacity_)
+// ── Archetype ───────────────────────────────────────────
+
+Archetype::Archetype(std::vector<ComponentInfo> components, ChunkPool& pool)
+    : components_(std::move(components)), pool_(&pool)
 {
-    o.data_ = nullptr;
-    o.count_ = 0;
-    o.capacity_ = 0;
-}
+    // TypeID でソート (Archetype ID の一意性保証)
+    std::sort(components_.begin(), components_.end(),
+              [](auto& a, auto& b) { return a.id < b.id; });
 
-ComponentColumn& ComponentColumn::operator=(ComponentColumn&& o) noexcept {
-    if (this != &o) {
-        if (data_) engine_aligned_free(data_);
-        data_ = o.data_; elem_size_ = o.elem_size_; elem_align_ = o.elem_align_;
-        count_ = o.count_; capacity_ = o.capacity_;
-        o.data_ = nullptr; o.count_ = 0; o.capacity_ = 0;
+    // Archetype ID を計算
+    std::vector<TypeID> ids;
+    ids.reserve(components_.size());
+    for (auto& c : components_) ids.push_back(c.id);
+    id_ = compute_archetype_id(ids);
+
+    usize row_bytes = sizeof(Entity);
+    for (u32 i = 0; i < components_.size(); ++i) {
+        auto& c = components_[i];
+        assert(c.alignment <= ChunkPool::chunk_align);
+        if (c.index == invalid_component_index) c.index = component_index(c.id);
+        signature_.set(c.index);
+        if (c.index >= column_table_.size()) column_table_.resize(c.index + 1, -1);
+        column_table_[c.index] = static_cast<i16>(i);
+        if (!c.is_tag()) data_columns_.push_back(i);
+        row_bytes += c.size;
     }
-    return *this;
+
+    // 16KB に収まる最大行数 (カラム間のアライメント詰め物を考慮)
+    u32 cap = static_cast<u32>(ChunkPool::chunk_bytes / row_bytes);
+    while (cap > 0 && compute_layout(components_, cap, column_offsets_) > ChunkPool::chunk_bytes) {
+        --cap;
+    }
+    if (cap == 0) {
+        // 1 行が 16KB を超える → 1 行ずつの大きなブロック
+        cap = 1;
+        chunk_bytes_ = compute_layout(components_, cap, column_offsets_);
+        ENG_DEBUG("Archetype %016llx: row of %zu bytes exceeds chunk size",
+                  static_cast<unsigned long long>(id_), row_bytes);
+    }
+    chunk_capacity_ = cap;
 }
 
-void ComponentColumn::push_back(const void* data) {
-    if (count_ >= capacity_) grow();
-    std::memcpy(data_ + count_ * elem_size_, data, elem_size_);
-    ++count_;
+Archetype::~Archetype() {
+    for (auto& c : chunks_) release_chunk(c);
 }
 
-void* ComponentColumn::at(u32 index) {
-    assert(index < count_);
-    return data_ + index * elem_size_;
+void Archetype::release_chunk(const Chunk& c) {
+    if (!c.mapped) pool_->release(c.data, chunk_bytes_);
 }
 
-const void* ComponentColumn::at(u32 index) const {
-    assert(index < count_);
-    return data_ + index * elem_size_;
+void Archetype::push_chunk() {
+    chunks_.push_back(Chunk{pool_->acquire(chunk_bytes_), 0});
+    ticks_.resize(chunks_.size() * components_.size());
 }
 
-void ComponentColumn::swap_remove(u32 index) {
-    assert(index < count_);
-    if (index < count_ - 1) {
-        std::memcpy(data_ + index * elem_size_,
-                     data_ + (count_ - 1) * elem_size_,
-                     elem_size_);
-    }
-    --count_;
+void Archetype::pop_chunk() {
+    release_chunk(chunks_.back());
+    chunks_.pop_back();
+    ticks_.resize(chunks_.size() * components_.size());
 }
 
-void ComponentColumn::grow() {
-    u32 new_cap = capacity_ == 0 ? 64 : capacity_ * 2;
-    u8* new_data = static_cast<u8*>(engine_aligned_alloc(elem_align_, elem_size_ * new_cap));
-    if (!new_data) throw std::bad_alloc{};
-    if (data_ && count_ > 0) {
-        std::memcpy(new_data, data_, elem_size_ * count_);
+void Archetype::mark_added_chunk(u32 chunk, Tick tick) {
+    for (u32 i = 0; i < components_.size(); ++i) {
+        ColumnTicks& t = column_ticks(chunk, i);
+        t.added   = std::max(t.added, tick);
+        t.changed = std::max(t.changed, tick);
     }
-    if (data_) engine_aligned_free(data_);
-    data_ = new_data;
-    capacity_ = new_cap;
 }
 
-// ── Archetype ───────────────────────────────────────────
-
-Archetype::Archetype(std::vector<ComponentInfo> components)
-    : components_(std::move(components))
-{
-    // TypeID でソート (Archetype ID の一意性保証)
-    std::sort(components_.begin(), components_.end(),
-              [](auto& a, auto& b) { return a.id < b.id; });
+u32 Archetype::add_entity(Entity entity, Tick tick) {
+    if (chunks_.empty() || chunks_.back().count == chunk_capacity_) push_chunk();
+    Chunk& c = chunks_.back();
+    u32 r = c.count++;
+    reinterpret_cast<Entity*>(c.data)[r] = entity;
+    // 各カラムをゼロ初期化
+    for (u32 i : data_columns_) {
+        std::memset(c.data + column_offsets_[i] + r * components_[i].size, 0, components_[i].size);
+    }
+    mark_added_chunk(chunk_count() - 1, tick);
+    return entity_count_++;
+}
 
-    // Archetype ID を計算
-    std::vector<TypeID> ids;
-    ids.reserve(components_.size());
-    for (auto& c : components_) ids.push_back(c.id);
-    id_ = compute_archetype_id(ids);
+u32 Archetype::add_entities(std::span<const Entity> entities, Tick tick) {
+    u32 first = entity_count_;
+    u32 total = static_cast<u32>(entities.size());
+    u32 tail_free = chunks_.empty() ? 0 : chunk_capacity_ - chunks_.back().count;
+    if (total > tail_free) {
+        usize chunks = chunks_.size() + (total - tail_free + chunk_capacity_ - 1) / chunk_capacity_;
+        chunks_.reserve(chunks);
+        ticks_.reserve(chunks * components_.size());
+    }
 
-    // カラム作成
-    columns_.reserve(components_.size());
-    for (u32 i = 0; i < components_.size(); ++i) {
-        comp_index_[components_[i].id] = i;
-        columns_.emplace_back(components_[i].size, components_[i].alignment);
+    u32 done = 0;
+    while (done < total) {
+        if (chunks_.empty() || chunks_.back().count == chunk_capacity_) push_chunk();
+        Chunk& c = chunks_.back();
+        u32 n = std::min(chunk_capacity_ - c.count, total - done);
+        std::memcpy(reinterpret_cast<Entity*>(c.data) + c.count, entities.data() + done, n * sizeof(Entity));
+        for (u32 i : data_columns_) {
+            std::memset(c.data + column_offsets_[i] + c.count * components_[i].size, 0,
+                        n * components_[i].size);
+        }
+        mark_added_chunk(chunk_count() - 1, tick);
+        c.count += n;
+        done += n;
     }
+    entity_count_ += total;
+    return first;
 }
 
-u32 Archetype::add_entity(Entity entity) {
-    u32 row = entity_count_;
-    entities_.push_back(entity);
-    // 各カラムにゼロ初期化データを追加
-    for (auto& col : columns_) {
-        std::vector<u8> zeros(col.elem_size(), 0);
-        col.push_back(zeros.data());
+u32 Archetype::append_rows(const Entity* entities, std::span<const u8* const> columns, u32 count, Tick tick) {
+    assert(columns.size() == components_.size());
+    const u32 first = entity_count_;
+    for (u32 done = 0; done < count;) {
+        if (chunks_.empty() || chunks_.back().count == chunk_capacity_) push_chunk();
+        Chunk& c = chunks_.back();
+        const u32 n = std::min(chunk_capacity_ - c.count, count - done);
+        std::memcpy(reinterpret_cast<Entity*>(c.data) + c.count, entities + done, n * sizeof(Entity));
+        for (u32 i : data_columns_) {
+            const usize size = components_[i].size;
+            std::memcpy(c.data + column_offsets_[i] + c.count * size, columns[i] + done * size, n * size);
+        }
+        mark_added_chunk(chunk_count() - 1, tick);
+        c.count += n;
+        done += n;
     }
-    ++entity_count_;
-    return row;
+    entity_count_ += count;
+    return first;
+}
+
+u32 Archetype::adopt_chunk(u8* data, u32 rows, Tick tick) {
+    assert(chunks_.empty() || chunks_.back().count == chunk_capacity_);
+    assert(rows > 0 && rows <= chunk_capacity_);
+    const u32 first = entity_count_;
+    chunks_.push_back(Chunk{data, rows, true});
+    ticks_.resize(chunks_.size() * components_.size());
+    mark_added_chunk(chunk_count() - 1, tick);
+    entity_count_ += rows;
+    return first;
 }
 
 void Archetype::remove_entity(u32 row) {
     assert(row < entity_count_);
-    // swap-remove: 末尾と入れ替え
-    if (row < entity_count_ - 1) {
-        entities_[row] = entities_[entity_count_ - 1];
-    }
-    entities_.pop_back();
-    for (auto& col : columns_) {
-        col.swap_remove(row);
+    // swap-remove: 末尾行 (最終チャンク) と入れ替え
+    u32 last = entity_count_ - 1;
+    if (row < last) {
+        const u32 dst_chunk = row / chunk_capacity_;
+        const u32 src_chunk = last / chunk_capacity_;
+        Chunk& dst = chunks_[dst_chunk];
+        Chunk& src = chunks_[src_chunk];
+        reinterpret_cast<Entity*>(dst.data)[row % chunk_capacity_] =
+            reinterpret_cast<Entity*>(src.data)[last % chunk_capacity_];
+        for (u32 i : data_columns_) {
+            std::memcpy(row_ptr(row, i), row_ptr(last, i), components_[i].size);
+        }
+        if (dst_chunk != src_chunk) {
+            // 移ってきた行の tick を引き継ぐ (タグのカラムも含む)
+            for (u32 i = 0; i < components_.size(); ++i) {
+                ColumnTicks& d = column_ticks(dst_chunk, i);
+                const ColumnTicks& t = column_ticks(src_chunk, i);
+                d.added   = std::max(d.added, t.added);
+                d.changed = std::max(d.changed, t.changed);
+            }
+        }
     }
+    if (--chunks_.back().count == 0) pop_chunk();
     --entity_count_;
 }
 
+u32 Archetype::move_entity(u32 row, const ArchetypeEdge& edge, Tick tick) {
+    assert(row < entity_count_);
+    Archetype& dst = *edge.target;
+    if (dst.chunks_.empty() || dst.chunks_.back().count == dst.chunk_capacity_) dst.push_chunk();
+    const u32 dst_chunk = dst.chunk_count() - 1;
+    const u32 src_chunk = row / chunk_capacity_;
+    Chunk& c = dst.chunks_.back();
+    u32 r = c.count++;
+    u32 new_row = dst.entity_count_++;
+    reinterpret_cast<Entity*>(c.data)[r] = entity(row);
+    for (u32 j : dst.data_columns_) {
+        u8* out = c.data + dst.column_offsets_[j] + r * dst.components_[j].size;
+        i32 src = edge.source_columns[j];
+        if (src >= 0) std::memcpy(out, row_ptr(row, static_cast<u32>(src)), dst.components_[j].size);
+        else          std::memset(out, 0, dst.components_[j].size);
+    }
+    for (u32 j = 0; j < dst.components_.size(); ++j) {
+        i32 src = edge.source_columns[j];
+        ColumnTicks& d = dst.column_ticks(dst_chunk, j);
+        const Tick added   = src >= 0 ? column_ticks(src_chunk, static_cast<u32>(src)).added : tick;
+        const Tick changed = src >= 0 ? column_ticks(src_chunk, static_cast<u32>(src)).changed : tick;
+        d.added   = std::max(d.added, added);
+        d.changed = std::max(d.changed, changed);
+    }
+    remove_entity(row);
+    return new_row;
+}
+
 void* Archetype::get_component(u32 row, TypeID comp_id) {
-    auto it = comp_index_.find(comp_id);
-    if (it == comp_index_.end()) return nullptr;
-    return columns_[it->second].at(row);
+    assert(row < entity_count_);
+    i32 col = column_index(comp_id);
+    return col >= 0 ? row_ptr(row, static_cast<u32>(col)) : nullptr;
 }
 
 const void* Archetype::get_component(u32 row, TypeID comp_id) const {
-    auto it = comp_index_.find(comp_id);
-    if (it == comp_index_.end()) return nullptr;
-    return columns_[it->second].at(row);
+    assert(row < entity_count_);
+    i32 col = column_index(comp_id);
+    return col >= 0 ? row_ptr(row, static_cast<u32>(col)) : nullptr;
 }
 
 void Archetype::set_component(u32 row, TypeID comp_id, const void* data) {
-    void* dst = get_component(row, comp_id);
-    if (!dst || !data) return;
-    auto it = comp_index_.find(comp_id);
-    std::memcpy(dst, data, components_[it->second].size);
+    if (!data) return;
+    i32 col = column_index(comp_id);
+    if (col < 0) return;
+    std::memcpy(row_ptr(row, static_cast<u32>(col)), data, components_[col].size);
+}
+
+const ArchetypeEdge* Archetype::add_edge(TypeID comp_id) const {
+    auto it = add_edges_.find(comp_id);
+    return it != add_edges_.end() ? &it->second : nullptr;
+}
+
+const ArchetypeEdge* Archetype::remove_edge(TypeID comp_id) const {
+    auto it = remove_edges_.find(comp_id);
+    return it != remove_edges_.end() ? &it->second : nullptr;
+}
+
+const ArchetypeEdge& Archetype::set_add_edge(TypeID comp_id, ArchetypeEdge edge) {
+    return add_edges_.insert_or_assign(comp_id, std::move(edge)).first->second;
+}
+
+const ArchetypeEdge& Archetype::set_remove_edge(TypeID comp_id, ArchetypeEdge edge) {
+    return remove_edges_.insert_or_assign(comp_id, std::move(edge)).first->second;
+}
+
+void Archetype::drop_edges_to(std::span<Archetype* const> targets) {
+    auto doomed = [&](const auto& entry) {
+        return std::binary_search(targets.begin(), targets.end(), entry.second.target);
+    };
+    std::erase_if(add_edges_, doomed);
+    std::erase_if(remove_edges_, doomed);
+}
+
+// ── メモリ整理 ──────────────────────────────────────────
+
+usize Archetype::shrink() {
+    const usize before = heap_bytes();
+    chunks_.shrink_to_fit();
+    ticks_.shrink_to_fit();
+    return before - heap_bytes();
 }
 
-bool Archetype::has_component(TypeID comp_id) const {
-    return comp_index_.contains(comp_id);
+void Archetype::swap_rows(u32 a, u32 b) {
+    if (a == b) return;
+    const u32 ca = a / chunk_capacity_;
+    const u32 cb = b / chunk_capacity_;
+    std::swap(reinterpret_cast<Entity*>(chunks_[ca].data)[a % chunk_capacity_],
+              reinterpret_cast<Entity*>(chunks_[cb].data)[b % chunk_capacity_]);
+    for (u32 i : data_columns_) {
+        u8* pa = row_ptr(a, i);
+        std::swap_ranges(pa, pa + components_[i].size, row_ptr(b, i));
+    }
+    if (ca == cb) return;
+    const usize ncols = components_.size();
+    ColumnTicks* ta = &ticks_[ca * ncols];
+    ColumnTicks* tb = &ticks_[cb * ncols];
+    for (usize i = 0; i < ncols; ++i) {
+        ta[i].added   = tb[i].added   = std::max(ta[i].added, tb[i].added);
+        ta[i].changed = tb[i].changed = std::max(ta[i].changed, tb[i].changed);
+    }
 }
 
-ComponentColumn* Archetype::column(TypeID comp_id) {
-    auto it = comp_index_.find(comp_id);
-    return it != comp_index_.end() ? &columns_[it->second] : nullptr;
+void* Archetype::chunk_column(u32 chunk, TypeID comp_id) {
+    i32 col = column_index(comp_id);
+    return col >= 0 ? chunks_[chunk].data + column_offsets_[col] : nullptr;
 }
 
-const ComponentColumn* Archetype::column(TypeID comp_id) const {
-    auto it = comp_index_.find(comp_id);
-    return it != comp_index_.end() ? &columns_[it->second] : nullptr;
+const void* Archetype::chunk_column(u32 chunk, TypeID comp_id) const {
+    i32 col = column_index(comp_id);
+    return col >= 0 ? chunks_[chunk].data + column_offsets_[col] : nullptr;
 }
 
 } // namespace engine::ecs
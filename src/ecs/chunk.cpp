@@ -0,0 +1,68 @@
+/**
+ * src/ecs/chunk.cpp — チャンクプール実装
+ */
+#include <engine/ecs/chunk.hpp>
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+#ifdef _WIN32
+#include <malloc.h>
+static inline void* engine_aligned_alloc(size_t align, size_t size) {
+    return _aligned_malloc(size, align);
+}
+static inline void engine_aligned_free(void* ptr) {
+    _aligned_free(ptr);
+}
+#else
+static inline void* engine_aligned_alloc(size_t align, size_t size) {
+    return std::aligned_alloc(align, size);
+}
+static inline void engine_aligned_free(void* ptr) {
+    std::free(ptr);
+}
+#endif
+
+namespace engine::ecs {
+
+ChunkPool::~ChunkPool() {
+    trim();
+}
+
+u8* ChunkPool::acquire(usize bytes) {
+    ++in_use_;
+    if (bytes == chunk_bytes && !free_.empty()) {
+        u8* block = free_.back();
+        free_.pop_back();
+        return block;
+    }
+    // aligned_alloc はサイズがアライメントの倍数である必要がある
+    usize size = (bytes + chunk_align - 1) & ~(chunk_align - 1);
+    auto* block = static_cast<u8*>(engine_aligned_alloc(chunk_align, size));
+    if (!block) { --in_use_; throw std::bad_alloc{}; }
+    reserved_bytes_ += size;
+    return block;
+}
+
+void ChunkPool::release(u8* block, usize bytes) {
+    if (!block) return;
+    --in_use_;
+    if (bytes == chunk_bytes) {
+        free_.push_back(block);
+        return;
+    }
+    reserved_bytes_ -= (bytes + chunk_align - 1) & ~(chunk_align - 1);
+    engine_aligned_free(block);
+}
+
+usize ChunkPool::trim(usize max_blocks) {
+    const usize n = std::min(max_blocks, free_.size());
+    for (usize i = free_.size() - n; i < free_.size(); ++i) engine_aligned_free(free_[i]);
+    free_.resize(free_.size() - n);
+    if (free_.empty()) free_.shrink_to_fit();
+    const usize freed = n * chunk_bytes;
+    reserved_bytes_ -= freed;
+    return freed;
+}
+
+} // namespace engine::ecs
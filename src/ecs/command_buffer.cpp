@@ -4,77 +4,403 @@
 #include <engine/ecs/command_buffer.hpp>
 #include <engine/ecs/world.hpp>
 #include <engine/core/log.hpp>
+#include <algorithm>
 #include <cstring>
 
 namespace engine::ecs {
 
+namespace {
+
+std::atomic<u64> g_next_buffer_uid{1};
+
+// 直近に使ったバッファのストリーム (uid はアドレス再利用に備えた一意番号)
+struct StreamCache {
+    u64            uid    = 0;
+    CommandStream* stream = nullptr;
+};
+thread_local StreamCache t_stream_cache;
+
+constexpr usize record_align = 8;
+constexpr usize initial_stream_bytes = 4096;
+
+constexpr usize record_stride(usize payload) {
+    return (sizeof(CommandHeader) + payload + record_align - 1) & ~(record_align - 1);
+}
+
+} // namespace
+
+// ── CommandStream ───────────────────────────────────────
+
+u8* CommandStream::append(usize n) {
+    if (size + n > capacity) {
+        usize grown = std::max({capacity * 2, size + n, initial_stream_bytes});
+        auto fresh = std::make_unique<u8[]>(grown);
+        if (size) std::memcpy(fresh.get(), bytes.get(), size);
+        bytes = std::move(fresh);
+        capacity = grown;
+    }
+    u8* dst = bytes.get() + size;
+    size += n;
+    return dst;
+}
+
+// ── CommandBuffer ───────────────────────────────────────
+
+CommandBuffer::CommandBuffer()
+    : uid_(g_next_buffer_uid.fetch_add(1, std::memory_order_relaxed)) {}
+
+CommandBuffer::~CommandBuffer() {
+    CommandStream* s = streams_.load(std::memory_order_acquire);
+    while (s) {
+        CommandStream* next = s->next;
+        delete s;
+        s = next;
+    }
+}
+
+CommandStream& CommandBuffer::local_stream() {
+    if (t_stream_cache.uid == uid_) return *t_stream_cache.stream;
+
+    // ストリームは apply / clear でも削除しないため、ロックなしで走査できる
+    const auto self = std::this_thread::get_id();
+    CommandStream* head = streams_.load(std::memory_order_acquire);
+    for (CommandStream* s = head; s; s = s->next) {
+        if (s->owner == self) {
+            t_stream_cache = {uid_, s};
+            return *s;
+        }
+    }
+
+    auto* stream = new CommandStream();
+    stream->owner = self;
+    stream->order = stream_count_.fetch_add(1, std::memory_order_relaxed);
+    stream->next  = head;
+    while (!streams_.compare_exchange_weak(stream->next, stream,
+                                           std::memory_order_release, std::memory_order_acquire)) {}
+    t_stream_cache = {uid_, stream};
+    return *stream;
+}
+
+void CommandBuffer::record(CommandType type, Entity entity, TypeID comp_id, u32 comp_index,
+                           usize size, usize align, const void* data) {
+    CommandStream& s = local_stream();
+    if (s.segments.empty() || s.segments.back().sort_key != s.sort_key || s.segments.back().source != s.source) {
+        s.segments.push_back({s.source, s.sort_key, s.size});
+    }
+
+    CommandHeader header{type, static_cast<u8>(align), static_cast<u16>(comp_index),
+                         static_cast<u32>(size), entity, comp_id};
+    u8* dst = s.append(record_stride(size));
+    std::memcpy(dst, &header, sizeof(header));
+    if (size) std::memcpy(dst + sizeof(header), data, size);
+    ++s.records;
+}
+
 Entity CommandBuffer::spawn() {
-    Command cmd;
-    cmd.type = CommandType::Spawn;
     // 一時 Entity (apply 時に正式 ID が割り当てられる)
-    cmd.entity = Entity{next_temp_index_++, 0};
-    push(cmd);
-    return cmd.entity;
+    Entity temp{next_temp_index_.fetch_add(1, std::memory_order_relaxed), temp_generation()};
+    record(CommandType::Spawn, temp, 0, 0, 0, 0, nullptr);
+    return temp;
 }
 
 void CommandBuffer::despawn(Entity entity) {
-    Command cmd;
-    cmd.type = CommandType::Despawn;
-    cmd.entity = entity;
-    push(cmd);
+    record(CommandType::Despawn, entity, 0, 0, 0, 0, nullptr);
 }
 
-void CommandBuffer::apply(World& world) {
-    std::lock_guard lock(mutex_);
+void CommandBuffer::set_sort_key(u32 key) {
+    local_stream().sort_key = key;
+}
 
-    // 一時 Entity → 正式 Entity のマッピング
-    std::unordered_map<u64, Entity> temp_to_real;
+u32 CommandBuffer::sort_key() {
+    return local_stream().sort_key;
+}
+
+void CommandBuffer::set_sort_source(u32 source) {
+    local_stream().source = source;
+}
+
+u32 CommandBuffer::sort_source() {
+    return local_stream().source;
+}
 
-    for (auto& cmd : commands_) {
-        // 一時 Entity を正式 Entity に変換
-        Entity entity = cmd.entity;
-        auto it = temp_to_real.find(entity.id);
-        if (it != temp_to_real.end()) {
-            entity = it->second;
+u32 CommandBuffer::claim_sort_sources(u32 count) {
+    const u32 base = next_source_.fetch_add(count + 1, std::memory_order_relaxed);
+    local_stream().source = base + count;
+    return base;
+}
+
+u32 CommandBuffer::claim_sort_keys(u32 count) {
+    CommandStream& s = local_stream();
+    const u32 base = s.sort_key + 1;
+    s.sort_key = base + count;
+    return base;
+}
+
+CommandApplyStats CommandBuffer::apply(World& world) {
+    CommandApplyStats stats;
+
+    // ── マージ: (記録元, ソートキー, ストリーム生成順, 記録順) で全区間を整列 ──
+    merge_.clear();
+    for (CommandStream* s = streams_.load(std::memory_order_acquire); s; s = s->next) {
+        for (usize i = 0; i < s->segments.size(); ++i) {
+            usize end = i + 1 < s->segments.size() ? s->segments[i + 1].begin : s->size;
+            merge_.push_back({s->segments[i].source, s->segments[i].sort_key, s->order, s->segments[i].begin, end, s});
         }
+    }
+    std::sort(merge_.begin(), merge_.end(), [](const MergeRange& a, const MergeRange& b) {
+        if (a.source != b.source) return a.source < b.source;
+        if (a.sort_key != b.sort_key) return a.sort_key < b.sort_key;
+        if (a.order != b.order) return a.order < b.order;
+        return a.begin < b.begin;
+    });
 
-        switch (cmd.type) {
-            case CommandType::Spawn: {
-                Entity real = world.spawn();
-                temp_to_real[cmd.entity.id] = real;
-                break;
+    // ── spawn を適用順に実行し、一時 Entity → 正式 Entity の表を作る ──
+    // (spawn が記録されていなければ走査を省く)
+    for (CommandStream* s = streams_.load(std::memory_order_acquire); s; s = s->next) {
+        stats.commands += s->records;
+    }
+    const u32 temp_count = next_temp_index_.load(std::memory_order_relaxed);
+    const u32 temp_gen   = temp_generation();
+    temp_to_real_.assign(temp_count, Entity{});
+    for (const MergeRange& range : merge_) {
+        if (temp_count == 0) break;
+        const u8* base = range.stream->bytes.get();
+        for (usize off = range.begin; off < range.end;) {
+            CommandHeader cmd;
+            std::memcpy(&cmd, base + off, sizeof(cmd));
+            if (cmd.type == CommandType::Spawn) {
+                temp_to_real_[cmd.entity.index()] = world.spawn();
+                ++stats.spawned;
             }
-            case CommandType::Despawn:
-                world.despawn(entity);
-                break;
+            off += record_stride(cmd.comp_size);
+        }
+    }
+
+    // ── Entity index ごとに適用順のチェーンを作る (ソートなし) ──
+    // チェーンは最初の構造変更 (追加 / 削除 / despawn) から始める。それより前の
+    // 上書きは構成に影響しないため、走査中にその場で適用する。
+    ops_.clear();
+    for (const MergeRange& range : merge_) {
+        u8* base = range.stream->bytes.get();
+        for (usize off = range.begin; off < range.end;) {
+            CommandHeader cmd;
+            std::memcpy(&cmd, base + off, sizeof(cmd));
+            u8* rec = base + off;
+            off += record_stride(cmd.comp_size);
+            if (cmd.type == CommandType::Spawn) continue;
+
+            Entity e = cmd.entity;
+            if (is_temp_generation(e.generation())) {
+                if (e.generation() != temp_gen) {
+                    ++stats.discarded;   // 以前の apply / clear より前の一時 Entity
+                    continue;
+                }
+                e = temp_to_real_[e.index()];
+            }
+            // 関係の値に入った参照先も一時 Entity なら正式 Entity へ置き換える
+            // (即時の上書きと apply_entity のどちらもこの記録を読む)
+            if (cmd.type != CommandType::Despawn && cmd.type != CommandType::RemoveComponent &&
+                world.relation_mask_.test(cmd.comp_index)) {
+                resolve_relation_target(world, cmd.comp_index, rec + sizeof(cmd));
+            }
+
+            const bool chained = e.index() < chains_.size() && chains_[e.index()].head != no_op;
+            if (cmd.type == CommandType::SetComponent && !chained) {
+                if (void* dst = world.get_component_impl(e, cmd.comp_index)) {
+                    std::memcpy(dst, rec + sizeof(cmd), cmd.comp_size);
+                    if (world.relation_mask_.test(cmd.comp_index)) world.relink(e, cmd.comp_index);
+                } else {
+                    ++stats.discarded;
+                }
+                continue;
+            }
+
+            const u32 op = static_cast<u32>(ops_.size());
+            ops_.push_back({e.id, rec, no_op});
+            if (e.index() >= chains_.size()) chains_.resize(e.index() + 1, {no_op, no_op});
+            Chain& chain = chains_[e.index()];
+            if (chain.head == no_op) chain.head = op;
+            else                     ops_[chain.tail].next = op;
+            chain.tail = op;
+
+            // despawn と関係の変更は他の Entity の結果を左右する (連鎖 despawn / 参照先の生死) ので、
+            // それまでのチェーンごと記録位置で適用する
+            if (cmd.type == CommandType::Despawn || world.relation_mask_.test(cmd.comp_index)) {
+                apply_entity(world, chain.head, stats);
+                chain = {no_op, no_op};
+            }
+        }
+    }
+
+    // 最初の構造変更が現れた順に Entity 単位で適用
+    for (u32 op = 0; op < ops_.size(); ++op) {
+        Chain& chain = chains_[Entity{ops_[op].entity}.index()];
+        if (chain.head != op) continue;
+        apply_entity(world, op, stats);
+        chain = {no_op, no_op};
+    }
+
+    clear();
+    // 適用中に溜まった OnAdd / OnRemove をまとめて通知 (ハンドラの記録は次回の apply へ)
+    world.flush_observers();
+    return stats;
+}
+
+void CommandBuffer::resolve_relation_target(World& world, u32 comp_index, u8* data) const {
+    u8* slot = data + world.relations_[comp_index]->target_offset();
+    Entity target;
+    std::memcpy(&target, slot, sizeof(Entity));
+    if (!is_temp_generation(target.generation())) return;
+    // 別の epoch は以前の apply / clear より前の一時 Entity (無効な参照として relink が外す)
+    target = target.generation() == temp_generation() ? temp_to_real_[target.index()] : Entity{};
+    std::memcpy(slot, &target, sizeof(Entity));
+}
+
+void CommandBuffer::apply_entity(World& world, u32 head, CommandApplyStats& stats) {
+    // 同じ index の古い世代宛てのコマンドは無効 (生存できるのは 1 世代のみ)
+    Entity entity;
+    u32 group = 0;
+    for (u32 op = head; op != no_op; op = ops_[op].next) {
+        ++group;
+        if (!entity.valid() && world.alive(Entity{ops_[op].entity})) entity = Entity{ops_[op].entity};
+    }
+    ++stats.entities;
+    if (!entity.valid()) {
+        stats.discarded += group;
+        return;
+    }
+
+    // 単発コマンドは従来どおり個別に適用 (キャッシュ済み遷移辺を使う)
+    if (group == 1) {
+        CommandHeader cmd;
+        std::memcpy(&cmd, ops_[head].record, sizeof(cmd));
+        const u8* data = ops_[head].record + sizeof(cmd);
+        if (cmd.type == CommandType::Despawn) {
+            world.despawn(entity);
+            ++stats.despawned;
+            return;
+        }
+        const u32 index = cmd.comp_index;
+        const bool had = world.has_component_impl(entity, index);
+        const u32 move = world.is_sparse(index) ? 0 : 1;   // 疎集合は Archetype を移動しない
+        if (cmd.type == CommandType::AddComponent) {
+            stats.migrations += had ? 0 : move;
+            world.add_component_impl(entity, ComponentInfo{cmd.comp_id, cmd.comp_size, cmd.comp_align, "", index}, data);
+        } else if (cmd.type == CommandType::RemoveComponent) {
+            stats.migrations += had ? move : 0;
+            world.remove_component_impl(entity, index);
+        }
+        return;
+    }
 
+    // コマンド列をなぞって最終構成と書き込む値を求める
+    pending_.clear();
+    auto entry = [&](const CommandHeader& cmd) -> PendingComponent& {
+        for (auto& p : pending_) {
+            if (p.id == cmd.comp_id) return p;
+        }
+        u32 index = cmd.comp_index;
+        bool has = world.has_component_impl(entity, index);
+        return pending_.emplace_back(PendingComponent{cmd.comp_id, index, 0, 0, has, has, nullptr});
+    };
+    u32 sequential_moves = 0;   // 1 コマンドずつ適用した場合の移動回数
+    u32 applied = 0;
+    for (u32 op = head; op != no_op; op = ops_[op].next) {
+        if (ops_[op].entity != entity.id) {
+            ++stats.discarded;
+            continue;
+        }
+        CommandHeader cmd;
+        std::memcpy(&cmd, ops_[op].record, sizeof(cmd));
+        const u8* data = ops_[op].record + sizeof(cmd);
+        if (cmd.type == CommandType::Despawn) {
+            // despawn 以前の変更と以降のコマンドはすべて不要
+            world.despawn(entity);
+            ++stats.despawned;
+            stats.discarded += applied;
+            for (u32 rest = ops_[op].next; rest != no_op; rest = ops_[rest].next) ++stats.discarded;
+            stats.migrations_saved += sequential_moves;
+            return;
+        }
+        ++applied;
+        PendingComponent& p = entry(cmd);
+        switch (cmd.type) {
             case CommandType::AddComponent:
-                world.add_component_raw_public(entity, cmd.comp_id, cmd.comp_size, 8, cmd.data);
+                if (!p.present && !world.is_sparse(p.index)) ++sequential_moves;
+                p.present = true;
+                p.size = cmd.comp_size;
+                p.align = cmd.comp_align;
+                p.data = data;
                 break;
-
             case CommandType::RemoveComponent:
-                world.remove_component_raw_public(entity, cmd.comp_id);
+                if (p.present && !world.is_sparse(p.index)) ++sequential_moves;
+                if (p.present && p.initially_present) p.reset = true;
+                p.present = false;
+                p.data = nullptr;
                 break;
-
-            case CommandType::SetComponent: {
-                // get_component_raw + memcpy
-                void* ptr = world.get_component_raw_public(entity, cmd.comp_id);
-                if (ptr) std::memcpy(ptr, cmd.data, cmd.comp_size);
+            case CommandType::SetComponent:
+                // 持っていないコンポーネントへの上書きは無視
+                if (p.present) {
+                    p.size = cmd.comp_size;
+                    p.data = data;
+                }
                 break;
+            default:
+                break;
+        }
+    }
+
+    adds_.clear();
+    removes_.clear();
+    for (const auto& p : pending_) {
+        if (p.present && !p.initially_present) {
+            adds_.push_back(ComponentInfo{p.id, p.size, p.align, "", p.index});
+        } else if (!p.present && p.initially_present) {
+            removes_.push_back(p.index);
+        }
+    }
+    u32 moves = (!adds_.empty() || !removes_.empty()) &&
+                world.migrate_entity(entity, adds_, removes_) ? 1 : 0;
+    stats.migrations += moves;
+    stats.migrations_saved += sequential_moves > moves ? sequential_moves - moves : 0;
+
+    for (const auto& p : pending_) {
+        if (p.reset && p.present) world.readd_component(entity, p.index);
+        if (world.relation_mask_.test(p.index)) {
+            // 関係は最終的な値 (または削除) で索引を合わせる
+            if (p.present && p.data) {
+                if (void* dst = world.get_component_impl(entity, p.index)) std::memcpy(dst, p.data, p.size);
             }
+            world.relink(entity, p.index);
+            continue;
         }
+        if (!p.present || !p.data || p.size == 0) continue;   // タグは値を持たない
+        if (void* dst = world.get_component_impl(entity, p.index)) std::memcpy(dst, p.data, p.size);
     }
-    commands_.clear();
 }
 
 void CommandBuffer::clear() {
-    std::lock_guard lock(mutex_);
-    commands_.clear();
+    next_temp_index_.store(0, std::memory_order_relaxed);
+    // 以前の一時 Entity を見分けるため epoch を進める (一周しても最上位ビットは保つ)
+    temp_epoch_.store((temp_epoch_.load(std::memory_order_relaxed) + 1) & ~temp_generation_bit,
+                      std::memory_order_relaxed);
+    for (CommandStream* s = streams_.load(std::memory_order_acquire); s; s = s->next) {
+        s->size = 0;
+        s->records = 0;
+        s->segments.clear();
+    }
+}
+
+usize CommandBuffer::pending() const {
+    usize n = 0;
+    for (CommandStream* s = streams_.load(std::memory_order_acquire); s; s = s->next) n += s->records;
+    return n;
 }
 
-void CommandBuffer::push(const Command& cmd) {
-    std::lock_guard lock(mutex_);
-    commands_.push_back(cmd);
+usize CommandBuffer::bytes_used() const {
+    usize n = 0;
+    for (CommandStream* s = streams_.load(std::memory_order_acquire); s; s = s->next) n += s->size;
+    return n;
 }
 
 } // namespace engine::ecs
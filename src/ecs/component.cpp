@@ -0,0 +1,68 @@
+/**
+ * src/ecs/component.cpp — コンポーネントインデックス採番
+ */
+#include <engine/ecs/component.hpp>
+#include <engine/core/log.hpp>
+#include <atomic>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace engine::ecs {
+
+namespace {
+
+// 読み取りはロックなし: 採番のたびに表を複製して差し替える (copy-on-write)。
+// 旧版は読み手が参照中の可能性があるため破棄しない (型数は高々 max_component_types)。
+struct IndexTable {
+    std::unordered_map<TypeID, u32> map;
+};
+
+struct IndexRegistry {
+    std::mutex                               mutex;
+    std::atomic<const IndexTable*>           current{nullptr};
+    std::vector<std::unique_ptr<IndexTable>> versions;
+};
+
+IndexRegistry& registry() {
+    static IndexRegistry r;
+    return r;
+}
+
+} // namespace
+
+u32 component_index(TypeID id) {
+    auto& reg = registry();
+    if (const IndexTable* t = reg.current.load(std::memory_order_acquire)) {
+        auto it = t->map.find(id);
+        if (it != t->map.end()) return it->second;
+    }
+
+    std::lock_guard lock(reg.mutex);
+    const IndexTable* cur = reg.current.load(std::memory_order_relaxed);
+    if (cur) {
+        auto it = cur->map.find(id);
+        if (it != cur->map.end()) return it->second;
+    }
+
+    u32 next = cur ? static_cast<u32>(cur->map.size()) : 0;
+    if (next >= max_component_types) {
+        ENG_FATAL("Component type limit exceeded (%u)", max_component_types);
+        std::abort();
+    }
+    auto fresh = cur ? std::make_unique<IndexTable>(*cur) : std::make_unique<IndexTable>();
+    fresh->map.emplace(id, next);
+    reg.current.store(fresh.get(), std::memory_order_release);
+    reg.versions.push_back(std::move(fresh));
+    return next;
+}
+
+ComponentMask make_component_mask(std::span<const TypeID> ids) {
+    ComponentMask mask;
+    for (TypeID id : ids) mask.set(component_index(id));
+    return mask;
+}
+
+} // namespace engine::ecs
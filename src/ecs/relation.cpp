@@ -0,0 +1,52 @@
+/**
+ * src/ecs/relation.cpp — 関係の索引実装
+ */
+#include <engine/ecs/relation.hpp>
+#include <engine/core/reflection.hpp>
+#include <algorithm>
+#include <cstddef>
+
+namespace engine::ecs {
+
+// スナップショットで名前引きできるように登録
+ENG_REFLECT_BEGIN(ChildOf)
+ENG_REFLECT_FIELD(ChildOf, target)
+ENG_REFLECT_END(ChildOf)
+
+void RelationIndex::link(Entity source, Entity target) {
+    const u32 s = source.index();
+    if (s < links_.size() && links_[s].target == target && target.valid()) return;
+    unlink(s);
+    if (!target.valid()) return;
+
+    const u32 t = target.index();
+    const usize needed = std::max(s, t) + 1;
+    if (links_.size() < needed) links_.resize(needed);
+
+    // 参照先のリスト先頭に挿入
+    Link& src = links_[s];
+    Link& dst = links_[t];
+    src.self   = source;
+    src.target = target;
+    src.prev   = none;
+    src.next   = dst.first;
+    if (dst.first != none) links_[dst.first].prev = s;
+    dst.first = s;
+    ++dst.count;
+}
+
+void RelationIndex::unlink(u32 source_index) {
+    if (source_index >= links_.size()) return;
+    Link& src = links_[source_index];
+    if (!src.target.valid()) return;
+
+    Link& dst = links_[src.target.index()];
+    if (src.prev != none) links_[src.prev].next = src.next;
+    else                  dst.first = src.next;
+    if (src.next != none) links_[src.next].prev = src.prev;
+    --dst.count;
+    src.target = Entity::null();
+    src.next = src.prev = none;
+}
+
+} // namespace engine::ecs
@@ -0,0 +1,572 @@
+/**
+ * src/ecs/snapshot.cpp — World スナップショットの保存 / 読み込み
+ */
+#include <engine/ecs/world.hpp>
+#include <engine/ecs/snapshot.hpp>
+#include <engine/core/reflection.hpp>
+#include <engine/core/log.hpp>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace engine::ecs {
+
+// ── 書き出し先 ──────────────────────────────────────────
+class SnapshotSink {
+public:
+    virtual ~SnapshotSink() = default;
+
+    virtual void reserve(usize bytes) = 0;
+    [[nodiscard]] virtual bool ok() const { return true; }
+
+    void put(const void* data, usize bytes) {
+        emit(data, bytes);
+        written_ += bytes;
+    }
+    /// 書き込み位置を align 境界までゼロで埋める
+    void pad_to(usize align) {
+        static constexpr u8 zeros[snapshot_page] = {};
+        const usize pad = (align - written_ % align) % align;
+        if (pad) put(zeros, pad);
+    }
+
+private:
+    virtual void emit(const void* data, usize bytes) = 0;
+    usize written_ = 0;
+};
+
+namespace {
+
+usize align_up(usize v, usize a) { return (v + a - 1) / a * a; }
+
+class VectorSink final : public SnapshotSink {
+public:
+    explicit VectorSink(std::vector<u8>& out) : out_(out) {}
+    void reserve(usize bytes) override { out_.reserve(out_.size() + bytes); }
+
+private:
+    void emit(const void* data, usize bytes) override {
+        const auto* p = static_cast<const u8*>(data);
+        out_.insert(out_.end(), p, p + bytes);
+    }
+    std::vector<u8>& out_;
+};
+
+class FileSink final : public SnapshotSink {
+public:
+    explicit FileSink(const std::string& path) : file_(path, std::ios::binary) {}
+    void reserve(usize) override {}
+    [[nodiscard]] bool ok() const override { return static_cast<bool>(file_); }
+
+private:
+    void emit(const void* data, usize bytes) override {
+        file_.write(static_cast<const char*>(data), static_cast<std::streamsize>(bytes));
+    }
+    std::ofstream file_;
+};
+
+// 境界検査付きの読み出し位置 (各セクションは 8 バイト境界)
+class SnapshotReader {
+public:
+    explicit SnapshotReader(std::span<const u8> data) : data_(data) {}
+
+    template <typename T>
+    const T* take(usize count) {
+        const usize bytes = sizeof(T) * count;
+        if (off_ > data_.size() || bytes > data_.size() - off_) {
+            failed_ = true;
+            return nullptr;
+        }
+        const T* p = reinterpret_cast<const T*>(data_.data() + off_);
+        off_ += align_up(bytes, 8);
+        return p;
+    }
+    [[nodiscard]] bool failed() const { return failed_; }
+
+private:
+    std::span<const u8> data_;
+    usize               off_    = 0;
+    bool                failed_ = false;
+};
+
+Result<void> corrupted(const char* what) {
+    ENG_WARN("World: snapshot is corrupted (%s)", what);
+    return std::unexpected(Error::CorruptedData);
+}
+
+// ファイル全体を私的写像する (書き込みはページ単位で複製され、ファイルには戻らない)
+Result<std::span<u8>> map_file_private(const std::string& path) {
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return std::unexpected(Error::IOError);
+    LARGE_INTEGER size{};
+    if (!GetFileSizeEx(file, &size) || static_cast<u64>(size.QuadPart) < sizeof(SnapshotHeader)) {
+        CloseHandle(file);
+        ENG_WARN("World: snapshot is corrupted (truncated)");
+        return std::unexpected(Error::CorruptedData);
+    }
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+    void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0) : nullptr;
+    if (mapping) CloseHandle(mapping);   // ビューが写像オブジェクトを保持する
+    CloseHandle(file);
+    if (!view) return std::unexpected(Error::IOError);
+    return std::span<u8>{static_cast<u8*>(view), static_cast<usize>(size.QuadPart)};
+#else
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return std::unexpected(Error::IOError);
+    struct stat st{};
+    if (::fstat(fd, &st) != 0 || static_cast<usize>(st.st_size) < sizeof(SnapshotHeader)) {
+        ::close(fd);
+        ENG_WARN("World: snapshot is corrupted (truncated)");
+        return std::unexpected(Error::CorruptedData);
+    }
+    void* view = ::mmap(nullptr, static_cast<usize>(st.st_size), PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    ::close(fd);   // 写像はファイル記述子を閉じても残る
+    if (view == MAP_FAILED) return std::unexpected(Error::IOError);
+    return std::span<u8>{static_cast<u8*>(view), static_cast<usize>(st.st_size)};
+#endif
+}
+
+} // namespace
+
+// ── 保存 ────────────────────────────────────────────────
+
+Result<void> World::save_snapshot(std::vector<u8>& out) const {
+    VectorSink sink{out};
+    return write_snapshot(sink);
+}
+
+Result<void> World::save_snapshot(const std::string& path) const {
+    FileSink sink{path};
+    if (!sink.ok()) return std::unexpected(Error::IOError);
+    auto result = write_snapshot(sink);
+    if (result && !sink.ok()) return std::unexpected(Error::IOError);
+    return result;
+}
+
+Result<void> World::write_snapshot(SnapshotSink& sink) const {
+    // ── 型表 (Archetype のカラムと疎集合に現れる型) ──
+    std::vector<ComponentInfo> types;
+    auto type_ref = [&](const ComponentInfo& info) {
+        for (u32 t = 0; t < types.size(); ++t) if (types[t].id == info.id) return t;
+        types.push_back(info);
+        return static_cast<u32>(types.size() - 1);
+    };
+    std::vector<const Archetype*> archs;
+    for (auto& [_, arch] : archetypes_) {
+        if (arch->count() == 0) continue;
+        archs.push_back(arch.get());
+        for (const ComponentInfo& ci : arch->component_infos()) type_ref(ci);
+    }
+    std::vector<const SparseSet*> sparse;
+    sparse_mask_.for_each_set(ComponentMask{}, [&](u32 idx) {
+        if (sparse_[idx]->size() == 0) return;
+        sparse.push_back(sparse_[idx].get());
+        type_ref(sparse_[idx]->info());
+    });
+
+    std::vector<SnapshotType> type_table(types.size());
+    std::string names;
+    for (u32 t = 0; t < types.size(); ++t) {
+        const TypeInfo* reflected = TypeRegistry::instance().find(types[t].id);
+        if (!reflected) {
+            ENG_WARN("World: component %016llx is not in TypeRegistry, snapshot aborted",
+                     static_cast<unsigned long long>(types[t].id));
+            return std::unexpected(Error::NotFound);
+        }
+        type_table[t] = SnapshotType{static_cast<u32>(names.size()), static_cast<u32>(reflected->name.size()),
+                                     static_cast<u32>(types[t].size), static_cast<u32>(types[t].alignment)};
+        names += reflected->name;
+    }
+
+    // ── 文字列表 ──
+    std::vector<u32> string_lengths;
+    string_lengths.reserve(strings_.size());
+    usize string_bytes = 0;
+    for (const std::string& text : strings_) {
+        string_lengths.push_back(static_cast<u32>(text.size()));
+        string_bytes += text.size();
+    }
+
+    // ── Entity 表 ──
+    const u32 record_count = static_cast<u32>(records_.size());
+    std::vector<u32> generations(record_count);
+    std::vector<u64> alive_bits((record_count + 63) / 64);
+    for (u32 i = 0; i < record_count; ++i) {
+        generations[i] = records_[i].generation;
+        if (records_[i].alive) alive_bits[i / 64] |= 1ULL << (i % 64);
+    }
+
+    // ── 配置を確定してから書き出す ──
+    SnapshotHeader header{};
+    header.magic           = snapshot_magic;
+    header.version         = snapshot_version;
+    header.type_count      = static_cast<u32>(types.size());
+    header.name_bytes      = static_cast<u32>(names.size());
+    header.record_count    = record_count;
+    header.free_count      = static_cast<u32>(free_indices_.size());
+    header.sparse_count    = static_cast<u32>(sparse.size());
+    header.archetype_count = static_cast<u32>(archs.size());
+    header.string_count    = static_cast<u32>(string_lengths.size());
+    header.string_bytes    = static_cast<u32>(string_bytes);
+
+    usize off = sizeof(SnapshotHeader) + type_table.size() * sizeof(SnapshotType) + align_up(names.size(), 8)
+              + align_up(string_lengths.size() * sizeof(u32), 8) + align_up(string_bytes, 8)
+              + align_up(generations.size() * sizeof(u32), 8) + alive_bits.size() * sizeof(u64)
+              + align_up(free_indices_.size() * sizeof(u32), 8);
+    for (const SparseSet* set : sparse) {
+        off += sizeof(SnapshotSparse) + align_up(set->size() * sizeof(Entity), 8)
+             + align_up(set->size() * set->info().size, 8);
+    }
+    std::vector<SnapshotArchetype> arch_table(archs.size());
+    for (const Archetype* arch : archs) {
+        off += sizeof(SnapshotArchetype) + arch->component_infos().size() * sizeof(SnapshotColumn);
+    }
+    for (usize a = 0; a < archs.size(); ++a) {
+        off = align_up(off, snapshot_page);
+        arch_table[a] = SnapshotArchetype{static_cast<u32>(archs[a]->component_infos().size()), archs[a]->count(),
+                                          archs[a]->chunk_count(), archs[a]->chunk_capacity(),
+                                          archs[a]->chunk_bytes(), off};
+        off += archs[a]->chunk_count() * archs[a]->chunk_bytes();
+    }
+    header.file_bytes = off;
+    sink.reserve(off);
+
+    sink.put(&header, sizeof(header));
+    sink.put(type_table.data(), type_table.size() * sizeof(SnapshotType));
+    sink.put(names.data(), names.size());
+    sink.pad_to(8);
+    sink.put(string_lengths.data(), string_lengths.size() * sizeof(u32));
+    sink.pad_to(8);
+    for (const std::string& text : strings_) sink.put(text.data(), text.size());
+    sink.pad_to(8);
+    sink.put(generations.data(), generations.size() * sizeof(u32));
+    sink.pad_to(8);
+    sink.put(alive_bits.data(), alive_bits.size() * sizeof(u64));
+    sink.put(free_indices_.data(), free_indices_.size() * sizeof(u32));
+    sink.pad_to(8);
+
+    for (const SparseSet* set : sparse) {
+        const SnapshotSparse desc{type_ref(set->info()), set->size()};
+        sink.put(&desc, sizeof(desc));
+        sink.put(set->entities().data(), set->size() * sizeof(Entity));
+        sink.pad_to(8);
+        if (set->info().size) sink.put(set->at(0), set->size() * set->info().size);
+        sink.pad_to(8);
+    }
+
+    for (usize a = 0; a < archs.size(); ++a) {
+        sink.put(&arch_table[a], sizeof(SnapshotArchetype));
+        const auto& comps = archs[a]->component_infos();
+        for (u32 c = 0; c < comps.size(); ++c) {
+            const SnapshotColumn col{type_ref(comps[c]), archs[a]->column_offset(c)};
+            sink.put(&col, sizeof(col));
+        }
+    }
+
+    // チャンク画像: 満杯のチャンクはそのまま、末尾チャンクは未使用行をゼロにして書く
+    std::vector<u8> scratch;
+    for (const Archetype* arch : archs) {
+        sink.pad_to(snapshot_page);
+        const auto& comps = arch->component_infos();
+        for (u32 c = 0; c < arch->chunk_count(); ++c) {
+            const u32 rows = arch->chunk_size(c);
+            if (rows == arch->chunk_capacity()) {
+                sink.put(arch->chunk_data(c), arch->chunk_bytes());
+                continue;
+            }
+            scratch.assign(arch->chunk_data(c), arch->chunk_data(c) + arch->chunk_bytes());
+            const u32 unused = arch->chunk_capacity() - rows;
+            std::memset(scratch.data() + rows * sizeof(Entity), 0, unused * sizeof(Entity));
+            for (u32 i = 0; i < comps.size(); ++i) {
+                if (comps[i].is_tag()) continue;
+                std::memset(scratch.data() + arch->column_offset(i) + rows * comps[i].size, 0, unused * comps[i].size);
+            }
+            sink.put(scratch.data(), scratch.size());
+        }
+    }
+    return {};
+}
+
+// ── 読み込み ────────────────────────────────────────────
+
+Result<void> World::load_snapshot(const std::string& path) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) return std::unexpected(Error::IOError);
+    const auto size = file.tellg();
+    file.seekg(0, std::ios::beg);
+    std::vector<u8> data(static_cast<usize>(size));
+    if (!file.read(reinterpret_cast<char*>(data.data()), size)) return std::unexpected(Error::IOError);
+    return load_snapshot(data);
+}
+
+Result<void> World::load_snapshot(std::span<const u8> data) {
+    return read_snapshot(data, false);
+}
+
+Result<void> World::map_snapshot(const std::string& path) {
+    if (alive_count_ != 0 || records_.size() != 1 || snapshot_map_) {
+        ENG_WARN("World: map_snapshot requires an empty world");
+        return std::unexpected(Error::InvalidState);
+    }
+    auto mapped = map_file_private(path);
+    if (!mapped) return std::unexpected(mapped.error());
+    snapshot_map_       = mapped->data();
+    snapshot_map_bytes_ = mapped->size();
+    auto result = read_snapshot(*mapped, true);
+    // 失敗時は何も取り込んでいないので、写像を解除して次の読み込みに備える
+    if (!result) unmap_snapshot();
+    return result;
+}
+
+void World::unmap_snapshot() {
+    if (!snapshot_map_) return;
+#ifdef _WIN32
+    UnmapViewOfFile(snapshot_map_);
+#else
+    ::munmap(snapshot_map_, snapshot_map_bytes_);
+#endif
+    snapshot_map_       = nullptr;
+    snapshot_map_bytes_ = 0;
+}
+
+Result<void> World::read_snapshot(std::span<const u8> data, bool in_place) {
+    if (alive_count_ != 0 || records_.size() != 1) {
+        ENG_WARN("World: load_snapshot requires an empty world");
+        return std::unexpected(Error::InvalidState);
+    }
+    if (reinterpret_cast<std::uintptr_t>(data.data()) % 8 != 0) return std::unexpected(Error::InvalidArgument);
+
+    SnapshotReader in{data};
+    const SnapshotHeader* header = in.take<SnapshotHeader>(1);
+    if (!header || header->magic != snapshot_magic) return corrupted("bad header");
+    if (header->version != snapshot_version) {
+        ENG_WARN("World: snapshot version %u is not supported", header->version);
+        return std::unexpected(Error::NotSupported);
+    }
+    if (header->file_bytes > data.size()) return corrupted("truncated");
+
+    // ── 型表: 名前 → このプロセスの TypeID ──
+    const SnapshotType* type_table = in.take<SnapshotType>(header->type_count);
+    const char* names = in.take<char>(header->name_bytes);
+    if (in.failed() || header->record_count == 0) return corrupted("type table");
+    std::vector<ComponentInfo> types(header->type_count);
+    for (u32 t = 0; t < header->type_count; ++t) {
+        const SnapshotType& st = type_table[t];
+        if (usize{st.name_offset} + st.name_length > header->name_bytes) return corrupted("type name");
+        const std::string_view name{names + st.name_offset, st.name_length};
+        const TypeInfo* reflected = TypeRegistry::instance().find(name);
+        if (!reflected) {
+            ENG_WARN("World: snapshot component '%.*s' is not in TypeRegistry",
+                     static_cast<int>(name.size()), name.data());
+            return std::unexpected(Error::NotFound);
+        }
+        // 空の型は sizeof が 1 でも格納サイズ 0
+        if (st.size != reflected->size && !(st.size == 0 && reflected->size == 1)) {
+            ENG_WARN("World: snapshot component '%.*s' has size %u, expected %zu",
+                     static_cast<int>(name.size()), name.data(), st.size, reflected->size);
+            return std::unexpected(Error::CorruptedData);
+        }
+        types[t] = ComponentInfo{reflected->id, st.size, reflected->alignment, reflected->name.data(),
+                                 component_index(reflected->id)};
+    }
+
+    // ── 検証: World に触れる前に画像全体を確かめる (失敗しても World は空のまま) ──
+    const u32*  string_lengths = in.take<u32>(header->string_count);
+    const char* string_data    = in.take<char>(header->string_bytes);
+    if (in.failed()) return corrupted("string table");
+    usize string_total = 0;
+    for (u32 k = 0; k < header->string_count; ++k) string_total += string_lengths[k];
+    if (string_total != header->string_bytes) return corrupted("string table");
+
+    const u32 record_count = header->record_count;
+    const u32* generations = in.take<u32>(record_count);
+    const u64* alive_bits  = in.take<u64>((record_count + 63) / 64);
+    const u32* free_list   = in.take<u32>(header->free_count);
+    if (in.failed()) return corrupted("entity table");
+    auto alive_at = [&](u32 index) { return ((alive_bits[index / 64] >> (index % 64)) & 1) != 0; };
+    auto live = [&](Entity e) {
+        const u32 index = e.index();
+        return index != 0 && index < record_count && alive_at(index) && generations[index] == e.generation();
+    };
+    for (u32 k = 0; k < header->free_count; ++k) {
+        const u32 index = free_list[k];
+        if (index == 0 || index >= record_count || alive_at(index)) return corrupted("free list");
+    }
+    for (u32 i = 1; i < record_count; ++i) {
+        if (is_temp_generation(generations[i])) return corrupted("entity generation");
+    }
+    auto stored_in_table = [&](u32 idx) {
+        for (auto& [_, arch] : archetypes_) if (arch->signature().test(idx)) return true;
+        return false;
+    };
+
+    struct SparseSection {
+        const ComponentInfo* info;
+        const Entity*        entities;
+        const u8*            values;
+        u32                  count;
+    };
+    std::vector<SparseSection> sparse_sections;
+    ComponentMask to_sparse = sparse_mask_;        // 読み込み後に疎集合で持つ型
+    std::vector<u32> sparse_seen(record_count, 0); // 疎集合内の重複検出 (疎集合の番号 + 1)
+    for (u32 s = 0; s < header->sparse_count; ++s) {
+        const SnapshotSparse* desc = in.take<SnapshotSparse>(1);
+        if (!desc || desc->type >= types.size()) return corrupted("sparse set");
+        const ComponentInfo& info = types[desc->type];
+        const Entity* ents = in.take<Entity>(desc->count);
+        const u8* values = in.take<u8>(usize{desc->count} * info.size);
+        if (in.failed()) return corrupted("sparse set");
+        if (!is_sparse(info.index) && stored_in_table(info.index)) return std::unexpected(Error::InvalidState);
+        to_sparse.set(info.index);
+        for (u32 k = 0; k < desc->count; ++k) {
+            if (!live(ents[k]) || sparse_seen[ents[k].index()] == s + 1) return corrupted("sparse entity");
+            sparse_seen[ents[k].index()] = s + 1;
+        }
+        sparse_sections.push_back({&info, ents, values, desc->count});
+    }
+
+    struct ArchetypeSection {
+        const SnapshotArchetype* desc;
+        const SnapshotColumn*    cols;
+    };
+    std::vector<ArchetypeSection> arch_sections;
+    std::vector<bool> placed(record_count, false);   // 各 Entity はいずれか 1 つの行にだけ置かれる
+    for (u32 a = 0; a < header->archetype_count; ++a) {
+        const SnapshotArchetype* desc = in.take<SnapshotArchetype>(1);
+        if (!desc) return corrupted("archetype");
+        const SnapshotColumn* cols = in.take<SnapshotColumn>(desc->column_count);
+        if (in.failed() || desc->chunk_capacity == 0 || desc->chunk_bytes < desc->chunk_capacity * sizeof(Entity) ||
+            desc->data_offset > data.size() ||
+            desc->chunk_count > (data.size() - desc->data_offset) / desc->chunk_bytes ||
+            desc->entity_count > u64{desc->chunk_count} * desc->chunk_capacity) {
+            return corrupted("archetype");
+        }
+        for (u32 c = 0; c < desc->column_count; ++c) {
+            if (cols[c].type >= types.size()) return corrupted("column type");
+            const ComponentInfo& info = types[cols[c].type];
+            if (u64{cols[c].offset} + u64{desc->chunk_capacity} * info.size > desc->chunk_bytes) {
+                return corrupted("column offset");
+            }
+            for (u32 d = 0; d < c; ++d) {
+                if (types[cols[d].type].id == info.id) return corrupted("duplicate column");
+            }
+            if (to_sparse.test(info.index)) {
+                ENG_WARN("World: snapshot stores sparse component '%s' in a table", info.name);
+                return std::unexpected(Error::InvalidState);
+            }
+        }
+        u32 remaining = desc->entity_count;
+        for (u32 c = 0; c < desc->chunk_count && remaining > 0; ++c) {
+            const auto* ents = reinterpret_cast<const Entity*>(data.data() + desc->data_offset + c * desc->chunk_bytes);
+            const u32 rows = std::min(remaining, desc->chunk_capacity);
+            for (u32 i = 0; i < rows; ++i) {
+                if (!live(ents[i]) || placed[ents[i].index()]) return corrupted("chunk entity");
+                placed[ents[i].index()] = true;
+            }
+            remaining -= rows;
+        }
+        arch_sections.push_back({desc, cols});
+    }
+
+    // ── 文字列表 (読み込み前の登録は置き換える。番号は書き出し側と同じ) ──
+    strings_.clear();
+    string_ids_.clear();
+    for (u32 k = 0, at = 0; k < header->string_count; at += string_lengths[k++]) {
+        strings_.emplace_back(string_data + at, string_lengths[k]);
+        string_ids_.emplace(strings_.back(), k);
+    }
+
+    // ── Entity 表 ──
+    records_.assign(record_count, EntityRecord{});
+    alive_count_ = 0;
+    for (u32 i = 1; i < record_count; ++i) {
+        records_[i].generation = generations[i];
+        records_[i].alive = alive_at(i);
+        alive_count_ += records_[i].alive;
+    }
+    free_indices_.assign(free_list, free_list + header->free_count);
+    compact_ = {};   // 途中の compact は読み込み前の表を指すので最初からやり直す
+
+    // ── 疎集合 (読み込んだ要素は追加扱い) ──
+    const Tick tick = change_tick();
+    for (const SparseSection& sec : sparse_sections) {
+        const ComponentInfo& info = *sec.info;
+        if (!is_sparse(info.index)) set_storage_impl(info, StorageKind::SparseSet);
+        SparseSet& set = *sparse_[info.index];
+        for (u32 k = 0; k < sec.count; ++k) {
+            void* dst = set.insert(sec.entities[k], tick);
+            if (info.size) std::memcpy(dst, sec.values + k * info.size, info.size);
+        }
+    }
+
+    // ── Archetype: チャンク画像をそのまま使うか、カラム単位で複製 ──
+    std::vector<ComponentInfo> comps;
+    std::vector<u32> src_offsets;
+    std::vector<const u8*> columns;
+    for (const ArchetypeSection& sec : arch_sections) {
+        const SnapshotArchetype* desc = sec.desc;
+        comps.clear();
+        for (u32 c = 0; c < desc->column_count; ++c) comps.push_back(types[sec.cols[c].type]);
+        Archetype* arch = find_or_create_archetype(comps);
+        const auto& local = arch->component_infos();
+        src_offsets.assign(local.size(), 0);
+        for (u32 c = 0; c < desc->column_count; ++c) {
+            src_offsets[arch->column_index(types[sec.cols[c].type].id)] = sec.cols[c].offset;
+        }
+
+        // 写像の画像が読み込み側のチャンクと同じ配置なら、そのままチャンクとして取り込める
+        bool adopt = in_place && arch->count() == 0 && desc->chunk_bytes == arch->chunk_bytes() &&
+                     desc->chunk_capacity == arch->chunk_capacity() &&
+                     desc->data_offset % snapshot_page == 0 && desc->chunk_bytes % ChunkPool::chunk_align == 0;
+        for (u32 j = 0; adopt && j < local.size(); ++j) adopt = src_offsets[j] == arch->column_offset(j);
+
+        columns.resize(local.size());
+        u32 remaining = desc->entity_count;
+        for (u32 c = 0; c < desc->chunk_count && remaining > 0; ++c) {
+            const usize image_offset = desc->data_offset + c * desc->chunk_bytes;
+            const u8* image = data.data() + image_offset;
+            const u32 rows = std::min(remaining, desc->chunk_capacity);
+            const auto* ents = reinterpret_cast<const Entity*>(image);
+            u32 first = 0;
+            if (adopt) {
+                first = arch->adopt_chunk(snapshot_map_ + image_offset, rows, tick);
+            } else {
+                for (u32 j = 0; j < local.size(); ++j) columns[j] = image + src_offsets[j];
+                first = arch->append_rows(ents, columns, rows, tick);
+            }
+            for (u32 i = 0; i < rows; ++i) {
+                EntityRecord& rec = records_[ents[i].index()];
+                rec.archetype = arch;
+                rec.row = first + i;
+            }
+            remaining -= rows;
+        }
+    }
+
+    // ── 関係の索引を作り直す ──
+    relation_mask_.for_each_set(ComponentMask{}, [&](u32 idx) {
+        if (is_sparse(idx)) {
+            for (Entity e : sparse_[idx]->entities()) relink(e, idx);
+            return;
+        }
+        for (auto& [_, arch] : archetypes_) {
+            if (!arch->signature().test(idx)) continue;
+            for (u32 row = 0; row < arch->count(); ++row) relink(arch->entity(row), idx);
+        }
+    });
+    return {};
+}
+
+} // namespace engine::ecs
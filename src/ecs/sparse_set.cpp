@@ -0,0 +1,115 @@
+/**
+ * src/ecs/sparse_set.cpp — 疎集合コンポーネントストレージ実装
+ */
+#include <engine/ecs/sparse_set.hpp>
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <new>
+
+namespace engine::ecs {
+
+SparseSet::SparseSet(const ComponentInfo& info)
+    : info_(info), size_(info.size)
+{
+    if (info_.index == invalid_component_index) info_.index = component_index(info_.id);
+}
+
+SparseSet::~SparseSet() {
+    if (data_) ::operator delete(data_, std::align_val_t{info_.alignment});
+}
+
+void SparseSet::reserve_data(u32 capacity) {
+    if (capacity <= capacity_ || size_ == 0) {
+        capacity_ = std::max(capacity_, capacity);
+        return;
+    }
+    auto* fresh = static_cast<u8*>(::operator new(capacity * size_, std::align_val_t{info_.alignment}));
+    if (data_) {
+        std::memcpy(fresh, data_, entities_.size() * size_);
+        ::operator delete(data_, std::align_val_t{info_.alignment});
+    }
+    data_ = fresh;
+    capacity_ = capacity;
+}
+
+void* SparseSet::insert(Entity entity, Tick tick, bool* inserted) {
+    const u32 index = entity.index();
+    const u32 page = index / page_size;
+    if (page >= pages_.size()) pages_.resize(page + 1);
+    if (!pages_[page]) {
+        pages_[page] = std::make_unique<u32[]>(page_size);
+        std::fill_n(pages_[page].get(), page_size, npos);
+    }
+    u32& slot = pages_[page][index % page_size];
+    if (inserted) *inserted = slot == npos;
+    if (slot != npos) return at(slot);
+
+    const u32 d = size();
+    if (d == capacity_) reserve_data(std::max<u32>(64, capacity_ * 2));
+    slot = d;
+    entities_.push_back(entity);
+    ticks_.push_back(ColumnTicks{tick, tick});
+    void* value = at(d);
+    if (size_) std::memset(value, 0, size_);
+    return value;
+}
+
+bool SparseSet::erase(u32 index) {
+    const u32 d = dense_index(index);
+    if (d == npos) return false;
+    const u32 last = size() - 1;
+    if (d != last) {
+        // 末尾要素を空いた位置へ
+        const Entity moved = entities_[last];
+        entities_[d] = moved;
+        ticks_[d] = ticks_[last];
+        if (size_) std::memcpy(at(d), at(last), size_);
+        pages_[moved.index() / page_size][moved.index() % page_size] = d;
+    }
+    entities_.pop_back();
+    ticks_.pop_back();
+    pages_[index / page_size][index % page_size] = npos;
+    return true;
+}
+
+void SparseSet::clear() {
+    for (Entity e : entities_) pages_[e.index() / page_size][e.index() % page_size] = npos;
+    entities_.clear();
+    ticks_.clear();
+}
+
+usize SparseSet::shrink() {
+    usize freed = 0;
+    for (auto& page : pages_) {
+        if (page && std::all_of(page.get(), page.get() + page_size, [](u32 d) { return d == npos; })) {
+            page.reset();
+            freed += page_size * sizeof(u32);
+        }
+    }
+    while (!pages_.empty() && !pages_.back()) pages_.pop_back();
+
+    const usize entity_capacity = entities_.capacity();
+    entities_.shrink_to_fit();
+    freed += (entity_capacity - entities_.capacity()) * sizeof(Entity);
+    const usize tick_capacity = ticks_.capacity();
+    ticks_.shrink_to_fit();
+    freed += (tick_capacity - ticks_.capacity()) * sizeof(ColumnTicks);
+
+    if (size_ && capacity_ > size()) {
+        // 密配列を要素数ちょうどに確保し直す
+        const u32 count = size();
+        u8* fresh = count ? static_cast<u8*>(::operator new(count * size_, std::align_val_t{info_.alignment}))
+                          : nullptr;
+        if (count) std::memcpy(fresh, data_, count * size_);
+        ::operator delete(data_, std::align_val_t{info_.alignment});
+        freed += (capacity_ - count) * size_;
+        data_ = fresh;
+        capacity_ = count;
+    } else if (!size_) {
+        capacity_ = size();
+    }
+    return freed;
+}
+
+} // namespace engine::ecs
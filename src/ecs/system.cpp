@@ -5,6 +5,7 @@
 #include <engine/ecs/world.hpp>
 #include <engine/core/log.hpp>
 #include <algorithm>
+#include <chrono>
 #include <unordered_map>
 #include <unordered_set>
 #include <queue>
@@ -14,15 +15,38 @@ namespace engine::ecs {
 void SystemScheduler::add_system(SystemDesc desc) {
     ENG_DEBUG("System registered: '%s'", desc.name.c_str());
     systems_.push_back(std::move(desc));
+    timings_.emplace_back();
+    last_run_.push_back(0);
+    invalidate();
 }
 
 void SystemScheduler::add_trigger(ReactiveTrigger trigger) {
     ENG_DEBUG("Reactive trigger registered: '%s' on %016llx",
               trigger.name.c_str(), static_cast<unsigned long long>(trigger.component));
+    if (trigger.event != TriggerEvent::OnChange) {
+        const u32 index = component_index(trigger.component);
+        auto& table = trigger.event == TriggerEvent::OnAdd ? add_observers_ : remove_observers_;
+        if (table.size() <= index) table.resize(index + 1);
+        table[index].push_back(static_cast<u32>(triggers_.size()));
+        world_.observe(trigger.event, index);
+    }
     triggers_.push_back(std::move(trigger));
+    trigger_last_run_.push_back(0);
+    invalidate();
 }
 
-void SystemScheduler::run() {
+void SystemScheduler::invalidate() {
+    schedule_dirty_ = true;
+    edges_dirty_    = true;
+    graph_dirty_    = true;
+}
+
+// ── 実行順 ──────────────────────────────────────────────
+// 名前解決・隣接リスト・キューは登録時にだけ作り、毎フレームは order_ を辿るだけ
+
+void SystemScheduler::rebuild_schedule() {
+    if (!schedule_dirty_) return;
+
     // トポロジカルソート (依存順)
     std::unordered_map<std::string, u32> name_to_idx;
     for (u32 i = 0; i < systems_.size(); ++i) {
@@ -48,20 +72,195 @@ void SystemScheduler::run() {
         if (in_degree[i] == 0) q.push(i);
     }
 
-    std::vector<u32> order;
-    order.reserve(systems_.size());
+    order_.clear();
+    order_.reserve(systems_.size());
     while (!q.empty()) {
         u32 cur = q.front(); q.pop();
-        order.push_back(cur);
+        order_.push_back(cur);
         for (u32 next : adj[cur]) {
             if (--in_degree[next] == 0) q.push(next);
         }
     }
 
-    // 実行
-    for (u32 idx : order) {
+    if (order_.size() != systems_.size()) {
+        ENG_WARN("SystemScheduler: %u system(s) in a run_after cycle will not run",
+                 static_cast<unsigned>(systems_.size() - order_.size()));
+    }
+    schedule_dirty_ = false;
+}
+
+const std::vector<u32>& SystemScheduler::schedule() {
+    rebuild_schedule();
+    return order_;
+}
+
+void SystemScheduler::run_system(u32 idx, u32 source) {
+    using Clock = std::chrono::steady_clock;
+    auto t0 = Clock::now();
+    // 実行中の書き込みはこのシステムの tick で刻印され、changed / added は前回実行時が基準
+    ChangeTickScope previous = world_.begin_system_ticks(last_run_[idx]);
+    {
+        // 記録したコマンドは実行スレッドによらず実行順位の順に適用される
+        CommandBuffer& cb = world_.command_buffer();
+        SortKeyScope scope{cb, source, cb.sort_key()};
         systems_[idx].execute(world_);
     }
+    last_run_[idx] = world_.end_system_ticks(previous);
+    f64 us = std::chrono::duration<f64, std::micro>(Clock::now() - t0).count();
+
+    // 並列実行時も各スロットは1ジョブだけが書く
+    auto& t = timings_[idx];
+    t.last_us   = us;
+    t.max_us    = std::max(t.max_us, us);
+    t.total_us += us;
+    t.runs++;
+}
+
+void SystemScheduler::run() {
+    rebuild_schedule();
+    source_base_ = world_.command_buffer().claim_sort_sources(static_cast<u32>(order_.size()));
+    for (u32 pos = 0; pos < order_.size(); ++pos) run_system(order_[pos], source_base_ + pos);
+    world_.flush_observers();
+    run_change_triggers();
+}
+
+// ── OnChange トリガー ───────────────────────────────────
+// 前回の発火以降に書き込まれたチャンク (疎集合なら要素) の Entity だけにハンドラを呼ぶ
+
+void SystemScheduler::run_change_triggers() {
+    for (u32 i = 0; i < triggers_.size(); ++i) {
+        auto& trigger = triggers_[i];
+        if (trigger.event != TriggerEvent::OnChange) continue;
+
+        ChangeTickScope previous = world_.begin_system_ticks(trigger_last_run_[i]);
+        const Tick since = trigger_last_run_[i];
+        const u32 index = component_index(trigger.component);
+        change_batch_.clear();
+        if (const SparseSet* set = world_.sparse_set(index)) {
+            // 疎集合は要素ごとの tick で選ぶ
+            for (u32 d = 0; d < set->size(); ++d) {
+                if (set->ticks(d).changed > since) change_batch_.push_back(set->entities()[d]);
+            }
+        } else {
+            ComponentMask required;
+            required.set(index);
+            world_.visit_archetypes(required, ComponentMask{}, [&](Archetype& arch) {
+                const u32 col = static_cast<u32>(arch.column_of(index));
+                for (u32 c = 0; c < arch.chunk_count(); ++c) {
+                    if (arch.column_ticks(c, col).changed <= since) continue;
+                    auto ents = arch.chunk_entities(c);
+                    change_batch_.insert(change_batch_.end(), ents.begin(), ents.end());
+                }
+            });
+        }
+        // ハンドラ内の構造変更でチャンクが動いても影響しないよう、先に集めてから呼ぶ
+        if (!change_batch_.empty()) trigger.handler(world_, change_batch_);
+        trigger_last_run_[i] = world_.end_system_ticks(previous);
+    }
+}
+
+// ── OnAdd / OnRemove トリガー ───────────────────────────
+
+void SystemScheduler::dispatch_observers(TriggerEvent event, u32 comp_index,
+                                         std::span<const Entity> entities) {
+    auto& table = event == TriggerEvent::OnAdd ? add_observers_ : remove_observers_;
+    if (comp_index >= table.size() || entities.empty()) return;
+    for (u32 i : table[comp_index]) triggers_[i].handler(world_, entities);
+}
+
+void SystemScheduler::reset_timings() {
+    for (auto& t : timings_) t = SystemTiming{};
+}
+
+// ── 競合グラフ ──────────────────────────────────────────
+
+namespace {
+
+std::vector<TypeID> sorted_unique(std::vector<TypeID> v) {
+    std::sort(v.begin(), v.end());
+    v.erase(std::unique(v.begin(), v.end()), v.end());
+    return v;
+}
+
+bool intersects(const std::vector<TypeID>& a, const std::vector<TypeID>& b) {
+    auto ia = a.begin(), ib = b.begin();
+    while (ia != a.end() && ib != b.end()) {
+        if (*ia < *ib) ++ia;
+        else if (*ib < *ia) ++ib;
+        else return true;
+    }
+    return false;
+}
+
+} // namespace
+
+void SystemScheduler::build_edges() {
+    if (!edges_dirty_) return;
+    edges_.clear();
+
+    u32 n = static_cast<u32>(systems_.size());
+    std::vector<std::vector<TypeID>> reads(n), writes(n);
+    std::vector<bool> exclusive(n);
+    for (u32 i = 0; i < n; ++i) {
+        reads[i]  = sorted_unique(systems_[i].reads);
+        writes[i] = sorted_unique(systems_[i].writes);
+        exclusive[i] = reads[i].empty() && writes[i].empty();
+    }
+
+    // run_after による順序を基準に、先行するシステムとの競合を辺にする
+    rebuild_schedule();
+    const std::vector<u32>& order = order_;
+    std::unordered_map<std::string, u32> name_to_idx;
+    for (u32 i = 0; i < n; ++i) name_to_idx[systems_[i].name] = i;
+
+    for (u32 pb = 0; pb < order.size(); ++pb) {
+        u32 b = order[pb];
+        for (auto& dep : systems_[b].run_after) {
+            auto it = name_to_idx.find(dep);
+            if (it != name_to_idx.end()) edges_.emplace_back(it->second, b);
+        }
+        for (u32 pa = 0; pa < pb; ++pa) {
+            u32 a = order[pa];
+            bool conflict = exclusive[a] || exclusive[b] ||
+                            intersects(writes[a], writes[b]) ||
+                            intersects(writes[a], reads[b]) ||
+                            intersects(reads[a], writes[b]);
+            if (conflict) edges_.emplace_back(a, b);
+        }
+    }
+    std::sort(edges_.begin(), edges_.end());
+    edges_.erase(std::unique(edges_.begin(), edges_.end()), edges_.end());
+    edges_dirty_ = false;
+}
+
+const std::vector<std::pair<u32, u32>>& SystemScheduler::conflict_edges() {
+    build_edges();
+    return edges_;
+}
+
+void SystemScheduler::rebuild_graph(JobSystem& js) {
+    build_edges();
+    graph_ = std::make_unique<TaskGraph>(js);
+    graph_js_ = &js;
+
+    std::vector<Job*> jobs(systems_.size(), nullptr);
+    for (u32 pos = 0; pos < order_.size(); ++pos) {
+        const u32 idx = order_[pos];
+        jobs[idx] = graph_->add(systems_[idx].name, [this, idx, pos] { run_system(idx, source_base_ + pos); });
+    }
+    for (auto [before, after] : edges_) {
+        if (jobs[before] && jobs[after]) graph_->depends_on(jobs[after], jobs[before]);
+    }
+    graph_->compile();
+    graph_dirty_ = false;
+}
+
+void SystemScheduler::run_parallel(JobSystem& js) {
+    if (graph_dirty_ || graph_js_ != &js) rebuild_graph(js);
+    source_base_ = world_.command_buffer().claim_sort_sources(static_cast<u32>(order_.size()));
+    graph_->execute();
+    world_.flush_observers();
+    run_change_triggers();
 }
 
 std::vector<std::string> SystemScheduler::system_names() const {
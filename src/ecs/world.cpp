@@ -5,180 +5,516 @@
 #include <engine/core/log.hpp>
 #include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cstring>
+#include <functional>
+#include <utility>
 
 namespace engine::ecs {
 
+namespace {
+
+// 呼び出しスレッドで実行中のシステム (World ごとに 1 つまで)
+thread_local ChangeTickScope t_tick_scope;
+
+} // namespace
+
 World::World() {
     records_.reserve(1024);
     // index 0 は null entity 用に予約
     records_.push_back(EntityRecord{nullptr, 0, 0, false});
+    register_relation<ChildOf>(RelationCleanup::Despawn);
 }
 
-World::~World() = default;
+World::~World() {
+    unmap_snapshot();
+}
 
 // ── Entity 操作 ─────────────────────────────────────────
 
 Entity World::spawn() {
+    Entity e = allocate_entity();
+    ++alive_count_;
+    return e;
+}
+
+Entity World::allocate_entity() {
     u32 index;
     if (!free_indices_.empty()) {
         index = free_indices_.back();
         free_indices_.pop_back();
+        note_compact_touched(index);
     } else {
         index = static_cast<u32>(records_.size());
         records_.push_back(EntityRecord{});
     }
     auto& rec = records_[index];
-    rec.generation++;
+    // 一時 Entity 用の世代 (最上位ビット) は使わない
+    if (is_temp_generation(++rec.generation)) rec.generation = 1;
     rec.alive = true;
     rec.archetype = nullptr;
     rec.row = 0;
-    ++alive_count_;
     return Entity{index, rec.generation};
 }
 
+std::span<const Entity> World::spawn_batch_raw(u32 count, std::span<const ComponentInfo> comps) {
+    batch_entities_.clear();
+    batch_entities_.reserve(count);
+    if (count > free_indices_.size()) {
+        usize needed = records_.size() + (count - free_indices_.size());
+        if (needed > records_.capacity()) records_.reserve(std::max(needed, records_.capacity() * 2));
+    }
+    for (u32 i = 0; i < count; ++i) batch_entities_.push_back(allocate_entity());
+    alive_count_ += count;
+
+    // 疎集合のコンポーネントは Entity ごとに挿入し、残りで Archetype を決める
+    std::vector<ComponentInfo> table_comps;
+    table_comps.reserve(comps.size());
+    for (const ComponentInfo& info : comps) {
+        const u32 idx = info.index != invalid_component_index ? info.index : component_index(info.id);
+        if (!is_sparse(idx)) {
+            table_comps.push_back(info);
+            continue;
+        }
+        for (Entity e : batch_entities_) sparse_[idx]->insert(e, change_tick());
+        if (on_add_.active) {
+            ComponentMask bit;
+            bit.set(idx);
+            queue_events(on_add_, bit, ComponentMask{}, batch_entities_);
+        }
+    }
+
+    if (!table_comps.empty() && count > 0) {
+        // 構成 Archetype を 1 回だけ解決し、連続行へまとめて配置
+        Archetype* arch = find_or_create_archetype(table_comps);
+        u32 first = arch->add_entities(batch_entities_, change_tick());
+        for (u32 i = 0; i < count; ++i) {
+            auto& rec = records_[batch_entities_[i].index()];
+            rec.archetype = arch;
+            rec.row = first + i;
+        }
+        if (on_add_.active) queue_events(on_add_, arch->signature(), ComponentMask{}, batch_entities_);
+    }
+    return batch_entities_;
+}
+
 void World::despawn(Entity entity) {
     if (!alive(entity)) return;
+    if (relation_mask_.empty()) {
+        destroy_entity(entity);
+        return;
+    }
+    // 関係の連鎖 despawn は再帰せず作業列で辿る (深い階層でもスタックを消費しない)。
+    // 各 Entity は生存中に 1 回だけ片付くため、ChildOf の循環があっても終わる
+    const usize base = despawn_queue_.size();
+    despawn_queue_.push_back(entity);
+    while (despawn_queue_.size() > base) {
+        const Entity e = despawn_queue_.back();
+        despawn_queue_.pop_back();
+        if (!alive(e)) continue;
+        cleanup_relations(e);
+        destroy_entity(e);
+    }
+}
+
+void World::destroy_entity(Entity entity) {
     auto& rec = records_[entity.index()];
+    if (!sparse_mask_.empty()) remove_sparse(entity);
 
     // Archetype から除去
     if (rec.archetype) {
-        rec.archetype->remove_entity(rec.row);
-        // swap-remove で別の Entity が rec.row に来た可能性 → 更新
-        if (rec.row < rec.archetype->count()) {
-            Entity swapped = rec.archetype->entities()[rec.row];
-            records_[swapped.index()].row = rec.row;
+        if (on_remove_.active) {
+            queue_events(on_remove_, rec.archetype->signature(), ComponentMask{}, {&entity, 1});
         }
+        rec.archetype->remove_entity(rec.row);
+        patch_swapped(rec.archetype, rec.row);
     }
 
     rec.alive = false;
     rec.archetype = nullptr;
     free_indices_.push_back(entity.index());
+    note_compact_touched(entity.index());
     --alive_count_;
 }
 
+void World::remove_sparse(Entity e) {
+    sparse_mask_.for_each_set(ComponentMask{}, [&](u32 idx) {
+        if (sparse_[idx]->erase(e.index())) queue_event(on_remove_, idx, e);
+    });
+}
+
 bool World::alive(Entity entity) const {
     if (entity.index() >= records_.size()) return false;
     auto& rec = records_[entity.index()];
     return rec.alive && rec.generation == entity.generation();
 }
 
-// ── コンポーネント操作 (raw) ────────────────────────────
+// ── コンポーネント操作 (コンポーネントインデックス) ────
 
-void World::add_component_raw(Entity e, TypeID tid, usize size, usize align, const void* data) {
+void World::add_component_impl(Entity e, const ComponentInfo& info, const void* data) {
     if (!alive(e)) return;
-    auto& rec = records_[e.index()];
+    write_component(e, info, data);
+    if (relation_mask_.test(info.index)) relink(e, info.index);
+}
 
-    // 新しいコンポーネント構成を作成
-    std::vector<ComponentInfo> new_comps;
+void World::write_component(Entity e, const ComponentInfo& info, const void* data) {
+    auto& rec = records_[e.index()];
+    const usize size = info.size;
+
+    if (is_sparse(info.index)) {
+        // 疎集合: Archetype は変えない
+        SparseSet& set = *sparse_[info.index];
+        bool inserted = false;
+        void* dst = set.insert(e, change_tick(), &inserted);
+        if (data && size) std::memcpy(dst, data, size);
+        if (inserted)              queue_event(on_add_, info.index, e);
+        else if (!info.is_tag())   set.mark_changed(set.dense_index(e.index()), change_tick());
+        return;
+    }
 
     if (rec.archetype) {
-        // 既存コンポーネントをコピー
-        new_comps = rec.archetype->component_infos();
-        // 既に持っている場合は上書き
-        for (auto& c : new_comps) {
-            if (c.id == tid) {
-                rec.archetype->set_component(rec.row, tid, data);
-                return;
-            }
+        // 既に持っている場合は上書き (タグなら何もしない)
+        i32 col = rec.archetype->column_of(info.index);
+        if (col >= 0) {
+            if (info.is_tag()) return;
+            if (data) std::memcpy(rec.archetype->component_at(rec.row, static_cast<u32>(col)), data, size);
+            rec.archetype->mark_changed(rec.row, static_cast<u32>(col), change_tick());
+            return;
         }
     }
-    new_comps.push_back(ComponentInfo{tid, size, align, ""});
 
-    // 新しい Archetype を検索 or 作成
-    Archetype* new_arch = find_or_create_archetype(new_comps);
-
-    // 新しい Archetype にエンティティを追加
-    u32 new_row = new_arch->add_entity(e);
-
-    // 旧 Archetype からデータをコピー
+    // 遷移辺を 1 回引いて移動
+    const ArchetypeEdge& edge = add_edge(rec.archetype, info);
+    u32 new_row;
     if (rec.archetype) {
-        for (auto& ci : rec.archetype->component_infos()) {
-            const void* old_data = rec.archetype->get_component(rec.row, ci.id);
-            if (old_data) new_arch->set_component(new_row, ci.id, old_data);
-        }
-        // 旧 Archetype から削除
-        u32 old_row = rec.row;
         Archetype* old_arch = rec.archetype;
-        old_arch->remove_entity(old_row);
-        // swap-remove 後の更新
-        if (old_row < old_arch->count()) {
-            Entity swapped = old_arch->entities()[old_row];
-            records_[swapped.index()].row = old_row;
-        }
+        u32 old_row = rec.row;
+        new_row = old_arch->move_entity(old_row, edge, change_tick());
+        patch_swapped(old_arch, old_row);
+    } else {
+        new_row = edge.target->add_entity(e, change_tick());
     }
 
     // 新コンポーネントのデータ設定
-    new_arch->set_component(new_row, tid, data);
+    if (data && size) std::memcpy(edge.target->component_at(new_row, static_cast<u32>(edge.added_column)), data, size);
 
-    rec.archetype = new_arch;
+    rec.archetype = edge.target;
     rec.row = new_row;
+    queue_event(on_add_, info.index, e);
 }
 
-void World::remove_component_raw(Entity e, TypeID tid) {
+void World::readd_component(Entity e, u32 comp_index) {
+    queue_event(on_remove_, comp_index, e);
+    queue_event(on_add_, comp_index, e);
+    if (is_sparse(comp_index)) {
+        SparseSet& set = *sparse_[comp_index];
+        set.mark_added(set.dense_index(e.index()), change_tick());
+        return;
+    }
+    const EntityRecord& rec = records_[e.index()];
+    if (!rec.archetype) return;
+    const i32 col = rec.archetype->column_of(comp_index);
+    if (col >= 0) rec.archetype->mark_added(rec.row, static_cast<u32>(col), change_tick());
+}
+
+void World::remove_component_impl(Entity e, u32 comp_index) {
     if (!alive(e)) return;
+    if (relation_mask_.test(comp_index)) relations_[comp_index]->unlink(e.index());
+    if (is_sparse(comp_index)) {
+        if (sparse_[comp_index]->erase(e.index())) queue_event(on_remove_, comp_index, e);
+        return;
+    }
     auto& rec = records_[e.index()];
-    if (!rec.archetype || !rec.archetype->has_component(tid)) return;
+    if (!rec.archetype) return;
+    i32 col = rec.archetype->column_of(comp_index);
+    if (col < 0) return;
+    TypeID tid = rec.archetype->component_infos()[col].id;
 
-    // 新しいコンポーネント構成 (tid を除外)
-    std::vector<ComponentInfo> new_comps;
-    for (auto& ci : rec.archetype->component_infos()) {
-        if (ci.id != tid) new_comps.push_back(ci);
-    }
+    Archetype* old_arch = rec.archetype;
+    u32 old_row = rec.row;
+    queue_event(on_remove_, comp_index, e);
 
-    if (new_comps.empty()) {
+    if (old_arch->component_infos().size() == 1) {
         // コンポーネント無し → Archetype から除去のみ
-        u32 old_row = rec.row;
-        rec.archetype->remove_entity(old_row);
-        if (old_row < rec.archetype->count()) {
-            Entity swapped = rec.archetype->entities()[old_row];
-            records_[swapped.index()].row = old_row;
-        }
+        old_arch->remove_entity(old_row);
+        patch_swapped(old_arch, old_row);
         rec.archetype = nullptr;
         rec.row = 0;
         return;
     }
 
-    Archetype* new_arch = find_or_create_archetype(new_comps);
-    u32 new_row = new_arch->add_entity(e);
-
-    // データコピー (tid 以外)
-    for (auto& ci : new_comps) {
-        const void* old_data = rec.archetype->get_component(rec.row, ci.id);
-        if (old_data) new_arch->set_component(new_row, ci.id, old_data);
-    }
+    const ArchetypeEdge& edge = remove_edge(*old_arch, tid);
+    rec.row = old_arch->move_entity(old_row, edge, change_tick());
+    rec.archetype = edge.target;
+    patch_swapped(old_arch, old_row);
+}
 
-    // 旧 Archetype から削除
-    u32 old_row = rec.row;
-    Archetype* old_arch = rec.archetype;
-    old_arch->remove_entity(old_row);
-    if (old_row < old_arch->count()) {
-        Entity swapped = old_arch->entities()[old_row];
-        records_[swapped.index()].row = old_row;
+void World::patch_swapped(Archetype* arch, u32 row) {
+    // swap-remove で末尾の Entity が row に来た可能性 → 更新
+    if (row < arch->count()) {
+        records_[arch->entity(row).index()].row = row;
     }
-
-    rec.archetype = new_arch;
-    rec.row = new_row;
 }
 
-void* World::get_component_raw(Entity e, TypeID tid) {
+void* World::get_component_impl(Entity e, u32 comp_index) {
     if (!alive(e)) return nullptr;
+    if (is_sparse(comp_index)) {
+        // 可変アクセスは書き込みとみなす (疎集合は要素単位)
+        SparseSet& set = *sparse_[comp_index];
+        const u32 d = set.dense_index(e.index());
+        if (d == SparseSet::npos) return nullptr;
+        set.mark_changed(d, change_tick());
+        return set.at(d);
+    }
     auto& rec = records_[e.index()];
     if (!rec.archetype) return nullptr;
-    return rec.archetype->get_component(rec.row, tid);
+    i32 col = rec.archetype->column_of(comp_index);
+    if (col < 0) return nullptr;
+    // 可変アクセスは書き込みとみなす
+    rec.archetype->mark_changed(rec.row, static_cast<u32>(col), change_tick());
+    return rec.archetype->component_at(rec.row, static_cast<u32>(col));
 }
 
-const void* World::get_component_raw(Entity e, TypeID tid) const {
+const void* World::get_component_impl(Entity e, u32 comp_index) const {
     if (!alive(e)) return nullptr;
+    if (is_sparse(comp_index)) return sparse_[comp_index]->get(e.index());
     auto& rec = records_[e.index()];
     if (!rec.archetype) return nullptr;
-    return rec.archetype->get_component(rec.row, tid);
+    i32 col = rec.archetype->column_of(comp_index);
+    return col >= 0 ? rec.archetype->component_at(rec.row, static_cast<u32>(col)) : nullptr;
 }
 
-bool World::has_component_raw(Entity e, TypeID tid) const {
+bool World::has_component_impl(Entity e, u32 comp_index) const {
     if (!alive(e)) return false;
+    if (is_sparse(comp_index)) return sparse_[comp_index]->contains(e.index());
     auto& rec = records_[e.index()];
-    return rec.archetype && rec.archetype->has_component(tid);
+    return rec.archetype && rec.archetype->column_of(comp_index) >= 0;
+}
+
+// ── 変更 tick ───────────────────────────────────────────
+// システムは実行ごとに change_tick_ から 1 つ払い出した tick で書き込みを刻印し、
+// 前回実行時の tick より新しいチャンクを「変更あり」とみなす。
+// システム外の書き込みは常に未払い出しの tick (= 全ての実行 tick より新しい) を使う。
+
+Tick World::change_tick() const {
+    if (t_tick_scope.world == this) return t_tick_scope.this_run;
+    return change_tick_.load(std::memory_order_relaxed);
+}
+
+Tick World::last_change_tick() const {
+    if (t_tick_scope.world == this) return t_tick_scope.last_run;
+    return tracker_tick_;
+}
+
+void World::clear_trackers() {
+    tracker_tick_ = change_tick_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void World::advance_change_tick(Tick next) {
+    Tick cur = change_tick_.load(std::memory_order_relaxed);
+    while (cur < next && !change_tick_.compare_exchange_weak(cur, next, std::memory_order_relaxed)) {}
+}
+
+ChangeTickScope World::begin_system_ticks(Tick last_run) {
+    ChangeTickScope previous = t_tick_scope;
+    t_tick_scope = {this, change_tick_.fetch_add(1, std::memory_order_relaxed), last_run};
+    return previous;
+}
+
+Tick World::end_system_ticks(const ChangeTickScope& previous) {
+    Tick this_run = t_tick_scope.this_run;
+    t_tick_scope = previous;
+    return this_run;
+}
+
+// ── 構造変更の通知 ──────────────────────────────────────
+// 構造変更はイベントをコンポーネントごとの Entity 列に積むだけにし、
+// 通知はフラッシュ時にコンポーネント × イベントごとに 1 回のハンドラ呼び出しで行う。
+
+void World::observe(TriggerEvent event, u32 comp_index) {
+    ObserverQueue* q = event == TriggerEvent::OnAdd ? &on_add_
+                     : event == TriggerEvent::OnRemove ? &on_remove_ : nullptr;
+    if (!q) return;
+    q->observed.set(comp_index);
+    if (q->entities.size() <= comp_index) q->entities.resize(comp_index + 1);
+    q->active = true;
+}
+
+void World::queue_events(ObserverQueue& q, const ComponentMask& set, const ComponentMask& minus,
+                         std::span<const Entity> entities) {
+    (set & q.observed).for_each_set(minus, [&](u32 idx) {
+        q.entities[idx].insert(q.entities[idx].end(), entities.begin(), entities.end());
+        q.pending.set(idx);
+    });
+}
+
+void World::dispatch_queue(ObserverQueue& q, TriggerEvent event) {
+    const ComponentMask pending = q.pending;
+    q.pending = ComponentMask{};
+    pending.for_each_set(ComponentMask{}, [&](u32 idx) {
+        // 通知中に積まれたイベントは空になった側に溜まる (容量は交互に再利用)
+        observer_batch_.swap(q.entities[idx]);
+        scheduler_.dispatch_observers(event, idx, observer_batch_);
+        observer_batch_.clear();
+    });
+}
+
+void World::flush_observers() {
+    if (flushing_observers_) return;   // ハンドラ内からの再入は外側のループに任せる
+    flushing_observers_ = true;
+    constexpr u32 max_rounds = 64;
+    u32 round = 0;
+    for (; round < max_rounds && !(on_add_.pending.empty() && on_remove_.pending.empty()); ++round) {
+        dispatch_queue(on_add_, TriggerEvent::OnAdd);
+        dispatch_queue(on_remove_, TriggerEvent::OnRemove);
+    }
+    if (!(on_add_.pending.empty() && on_remove_.pending.empty())) {
+        ENG_WARN("World: observer chain exceeded %u rounds, remaining events deferred", max_rounds);
+    }
+    flushing_observers_ = false;
+}
+
+// ── 格納方式 ────────────────────────────────────────────
+
+void World::set_storage_impl(const ComponentInfo& info, StorageKind kind) {
+    const u32 idx = info.index;
+    const bool sparse = kind == StorageKind::SparseSet;
+    if (is_sparse(idx) == sparse) return;
+    // 格納済みのデータは移し替えない
+    bool in_use = is_sparse(idx) && sparse_[idx]->size() > 0;
+    for (auto& [_, arch] : archetypes_) in_use |= arch->signature().test(idx);
+    if (in_use) {
+        ENG_WARN("World: component %016llx is already stored, set_storage ignored",
+                 static_cast<unsigned long long>(info.id));
+        return;
+    }
+    if (sparse) {
+        if (sparse_.size() <= idx) sparse_.resize(idx + 1);
+        sparse_[idx] = std::make_unique<SparseSet>(info);
+        sparse_mask_.set(idx);
+    } else {
+        sparse_[idx].reset();
+        sparse_mask_.reset(idx);
+    }
+}
+
+// ── 関係 ────────────────────────────────────────────────
+// 索引は関係コンポーネントの付け外し / 上書きと同時に更新する。
+// 参照先が生存していない関係は索引に載せない (target_of は null を返す)。
+
+void World::register_relation_impl(const ComponentInfo& info, usize target_offset, RelationCleanup cleanup) {
+    const u32 idx = info.index;
+    if (relation_mask_.test(idx)) {
+        relations_[idx]->set_cleanup(cleanup);   // 索引はそのまま、以降の despawn の扱いだけ変える
+        return;
+    }
+    bool in_use = is_sparse(idx) && sparse_[idx]->size() > 0;
+    for (auto& [_, arch] : archetypes_) in_use |= arch->signature().test(idx);
+    if (in_use) {
+        ENG_WARN("World: component %016llx is already stored, register_relation ignored",
+                 static_cast<unsigned long long>(info.id));
+        return;
+    }
+    if (relations_.size() <= idx) relations_.resize(idx + 1);
+    relations_[idx] = std::make_unique<RelationIndex>(idx, target_offset, cleanup);
+    relation_mask_.set(idx);
+}
+
+void World::relink(Entity e, u32 comp_index) {
+    RelationIndex& rel = *relations_[comp_index];
+    const auto* comp = static_cast<const u8*>(std::as_const(*this).get_component_impl(e, comp_index));
+    if (!comp) {
+        rel.unlink(e.index());
+        return;
+    }
+    Entity target;
+    std::memcpy(&target, comp + rel.target_offset(), sizeof(Entity));
+    if (alive(target) && target != e) rel.link(e, target);
+    else                              rel.unlink(e.index());
+}
+
+void World::cleanup_relations(Entity e) {
+    relation_mask_.for_each_set(ComponentMask{}, [&](u32 idx) {
+        RelationIndex& rel = *relations_[idx];
+        // 自身の参照を先に外す (循環していても参照先から e へ戻らない)
+        rel.unlink(e.index());
+        if (rel.cleanup() == RelationCleanup::Despawn) {
+            // 参照元は作業列へ積むだけ。各参照元が片付くときに自身のリンクを外す
+            for (u32 s = rel.first_source(e.index()); s != RelationIndex::none; s = rel.next_source(s)) {
+                despawn_queue_.push_back(rel.source(s));
+            }
+            return;
+        }
+        // 参照元を先頭から 1 つずつ片付ける (片付けで索引から外れる)
+        for (u32 s = rel.first_source(e.index()); s != RelationIndex::none; s = rel.first_source(e.index())) {
+            remove_component_impl(rel.source(s), idx);
+        }
+    });
+}
+
+bool World::related_row_matches(const MixedTerms& t, const detail::ChunkFilter& filter, Entity e) const {
+    const EntityRecord& rec = records_[e.index()];
+    if (!archetype_terms_match(t, rec.archetype)) return false;
+    if (t.driver && !t.driver->contains(e.index())) return false;
+    if (!sparse_terms_match(t, e.index())) return false;
+    if (filter.empty()) return true;
+    return rec.archetype && filter.passes(*rec.archetype, rec.row / rec.archetype->chunk_capacity()) &&
+           sparse_filter_passes(filter, e.index());
+}
+
+bool World::sparse_filter_passes(const detail::ChunkFilter& filter, u32 index) const {
+    auto newer = [&](u32 idx, bool added) {
+        if (!is_sparse(idx)) return true;
+        const SparseSet& set = *sparse_[idx];
+        const u32 d = set.dense_index(index);
+        if (d == SparseSet::npos) return false;
+        return (added ? set.ticks(d).added : set.ticks(d).changed) > filter.since;
+    };
+    for (u32 idx : filter.changed) {
+        if (!newer(idx, false)) return false;
+    }
+    for (u32 idx : filter.added) {
+        if (!newer(idx, true)) return false;
+    }
+    return true;
+}
+
+World::MixedTerms World::split_terms(const ComponentMask& required, const ComponentMask& excluded) const {
+    MixedTerms t;
+    t.arch_required = required.minus(sparse_mask_);
+    t.arch_excluded = excluded.minus(sparse_mask_);
+    // 最小の必須疎集合を起点にする
+    (required & sparse_mask_).for_each_set(ComponentMask{}, [&](u32 idx) {
+        SparseSet* set = sparse_[idx].get();
+        if (!t.driver || set->size() < t.driver->size()) {
+            std::swap(set, t.driver);
+            t.driver_index = idx;
+        }
+        if (set) {
+            assert(t.with_count < MixedTerms::max_sparse_terms);
+            t.with[t.with_count++] = set;
+        }
+    });
+    (excluded & sparse_mask_).for_each_set(ComponentMask{}, [&](u32 idx) {
+        assert(t.without_count < MixedTerms::max_sparse_terms);
+        t.without[t.without_count++] = sparse_[idx].get();
+    });
+    return t;
+}
+
+// ── 文字列表 ────────────────────────────────────────────
+
+u32 World::intern(std::string_view text) {
+    if (auto it = string_ids_.find(text); it != string_ids_.end()) return it->second;
+    const u32 id = static_cast<u32>(strings_.size());
+    strings_.emplace_back(text);
+    string_ids_.emplace(strings_.back(), id);
+    return id;
+}
+
+u32 World::find_string(std::string_view text) const {
+    auto it = string_ids_.find(text);
+    return it != string_ids_.end() ? it->second : invalid_string;
 }
 
 // ── Archetype 検索/作成 ────────────────────────────────
@@ -195,12 +531,148 @@ Archetype* World::find_or_create_archetype(const std::vector<ComponentInfo>& com
     auto it = archetypes_.find(aid);
     if (it != archetypes_.end()) return it->second.get();
 
-    auto arch = std::make_unique<Archetype>(sorted);
+    auto arch = std::make_unique<Archetype>(sorted, chunk_pool_);
     auto* ptr = arch.get();
     archetypes_.emplace(aid, std::move(arch));
+
+    // 登録済みクエリとの照合は生成時の 1 回だけ
+    for (auto& q : queries_) {
+        if (archetype_matches(*ptr, q->required_mask.minus(sparse_mask_), q->excluded_mask.minus(sparse_mask_))) {
+            q->archetypes.push_back(ptr);
+        }
+    }
     return ptr;
 }
 
+// ── Archetype 遷移辺 ────────────────────────────────────
+// 初回の遷移時だけ find_or_create_archetype とカラム再配置表の計算を行い、
+// 両端の Archetype に add / remove 辺として登録する。
+
+namespace {
+
+std::vector<i32> column_map(const Archetype* from, const Archetype& to) {
+    std::vector<i32> map;
+    map.reserve(to.component_infos().size());
+    for (auto& ci : to.component_infos()) {
+        map.push_back(from ? from->column_index(ci.id) : -1);
+    }
+    return map;
+}
+
+} // namespace
+
+const ArchetypeEdge& World::add_edge(Archetype* src, const ComponentInfo& info) {
+    if (!src) {
+        auto it = root_edges_.find(info.id);
+        if (it != root_edges_.end()) return it->second;
+    } else if (auto* edge = src->add_edge(info.id)) {
+        return *edge;
+    }
+
+    std::vector<ComponentInfo> comps;
+    if (src) comps = src->component_infos();
+    comps.push_back(info);
+
+    ArchetypeEdge edge;
+    edge.target = find_or_create_archetype(comps);
+    edge.source_columns = column_map(src, *edge.target);
+    edge.added_column = edge.target->column_index(info.id);
+    if (!src) return root_edges_.emplace(info.id, std::move(edge)).first->second;
+
+    if (!edge.target->remove_edge(info.id)) {
+        edge.target->set_remove_edge(info.id, ArchetypeEdge{src, column_map(edge.target, *src), -1});
+    }
+    return src->set_add_edge(info.id, std::move(edge));
+}
+
+const ArchetypeEdge& World::remove_edge(Archetype& src, TypeID tid) {
+    if (auto* edge = src.remove_edge(tid)) return *edge;
+
+    std::vector<ComponentInfo> comps;
+    for (auto& ci : src.component_infos()) {
+        if (ci.id != tid) comps.push_back(ci);
+    }
+
+    ArchetypeEdge edge;
+    edge.target = find_or_create_archetype(comps);
+    edge.source_columns = column_map(&src, *edge.target);
+
+    if (!edge.target->add_edge(tid)) {
+        edge.target->set_add_edge(tid, ArchetypeEdge{&src, column_map(edge.target, src), src.column_index(tid)});
+    }
+    return src.set_remove_edge(tid, std::move(edge));
+}
+
+// ── 複数コンポーネントの一括遷移 ───────────────────────
+
+bool World::migrate_entity(Entity e, std::span<const ComponentInfo> adds, std::span<const u32> removes) {
+    if (!alive(e)) return false;
+    auto& rec = records_[e.index()];
+    Archetype* old_arch = rec.archetype;
+    const u32 old_row = rec.row;
+
+    // 疎集合の分はその場で付け外しし、Archetype の遷移からは外す
+    if (!sparse_mask_.empty()) {
+        for (u32 idx : removes) {
+            if (is_sparse(idx) && sparse_[idx]->erase(e.index())) queue_event(on_remove_, idx, e);
+        }
+        for (const ComponentInfo& info : adds) {
+            if (!is_sparse(info.index)) continue;
+            bool inserted = false;
+            sparse_[info.index]->insert(e, change_tick(), &inserted);
+            if (inserted) queue_event(on_add_, info.index, e);
+        }
+    }
+
+    ComponentMask sig = old_arch ? old_arch->signature() : ComponentMask{};
+    for (u32 idx : removes) sig.reset(idx);
+    for (const ComponentInfo& info : adds) if (!is_sparse(info.index)) sig.set(info.index);
+    if (old_arch ? sig == old_arch->signature() : sig.empty()) return false;
+
+    const ComponentMask old_sig = old_arch ? old_arch->signature() : ComponentMask{};
+    if (on_add_.active)    queue_events(on_add_, sig, old_sig, {&e, 1});
+    if (on_remove_.active) queue_events(on_remove_, old_sig, sig, {&e, 1});
+
+    if (sig.empty()) {
+        // コンポーネント無し → Archetype から除去のみ
+        old_arch->remove_entity(old_row);
+        patch_swapped(old_arch, old_row);
+        rec.archetype = nullptr;
+        rec.row = 0;
+        return true;
+    }
+
+    auto [it, inserted] = migrate_edges_.try_emplace(MigrationKey{old_arch, sig});
+    if (inserted) {
+        // 初回のみ遷移辺を辿って移動先を求める
+        Archetype* target = old_arch;
+        for (u32 idx : removes) {
+            if (!target) break;
+            i32 col = target->column_of(idx);
+            if (col < 0) continue;
+            target = target->component_infos().size() == 1
+                ? nullptr
+                : remove_edge(*target, target->component_infos()[col].id).target;
+        }
+        for (const ComponentInfo& info : adds) {
+            if (is_sparse(info.index)) continue;
+            if (!target || target->column_of(info.index) < 0) target = add_edge(target, info).target;
+        }
+        it->second.target = target;
+        it->second.source_columns = column_map(old_arch, *target);
+    }
+    const ArchetypeEdge& edge = it->second;
+
+    if (old_arch) {
+        rec.row = old_arch->move_entity(old_row, edge, change_tick());
+        patch_swapped(old_arch, old_row);
+    } else {
+        rec.row = edge.target->add_entity(e, change_tick());
+    }
+    rec.archetype = edge.target;
+    return true;
+}
+
 // ── Archetype クエリ ────────────────────────────────────
 
 std::vector<Archetype*> World::find_archetypes_with(
@@ -208,43 +680,289 @@ std::vector<Archetype*> World::find_archetypes_with(
     const std::vector<TypeID>& excluded)
 {
     std::vector<Archetype*> result;
+    visit_archetypes(make_component_mask(required), make_component_mask(excluded),
+                     [&](Archetype& arch) { result.push_back(&arch); });
+    return result;
+}
+
+// ── キャッシュ済みクエリ ────────────────────────────────
+
+Query World::register_query(std::vector<TypeID> required, std::vector<TypeID> excluded) {
+    auto normalize = [](std::vector<TypeID>& v) {
+        std::sort(v.begin(), v.end());
+        v.erase(std::unique(v.begin(), v.end()), v.end());
+    };
+    normalize(required);
+    normalize(excluded);
+
+    for (auto& q : queries_) {
+        if (q->required == required && q->excluded == excluded) return Query{q.get()};
+    }
+
+    auto state = std::make_unique<QueryState>();
+    state->world = this;
+    state->required = std::move(required);
+    state->excluded = std::move(excluded);
+    state->required_mask = make_component_mask(state->required);
+    state->excluded_mask = make_component_mask(state->excluded);
+    // 疎集合の条件は走査時に行ごとに判定し、Archetype 一覧は残りの条件で持つ
+    const ComponentMask required_table = state->required_mask.minus(sparse_mask_);
+    const ComponentMask excluded_table = state->excluded_mask.minus(sparse_mask_);
     for (auto& [_, arch] : archetypes_) {
-        bool match = true;
-        for (auto tid : required) {
-            if (!arch->has_component(tid)) { match = false; break; }
+        if (archetype_matches(*arch, required_table, excluded_table)) {
+            state->archetypes.push_back(arch.get());
         }
-        if (!match) continue;
-        for (auto tid : excluded) {
-            if (arch->has_component(tid)) { match = false; break; }
+    }
+    queries_.push_back(std::move(state));
+    return Query{queries_.back().get()};
+}
+
+Query QueryBuilder::cached() const {
+    return world_.register_query(required_, excluded_);
+}
+
+// ── コマンドバッファ適用 ────────────────────────────────
+
+CommandApplyStats World::flush_commands() {
+    return cmd_buffer_.apply(*this);
+}
+
+// ── メモリ整理 ──────────────────────────────────────────
+// 巡回開始時の Archetype 一覧を積み、1 回の呼び出しで予算内の単位だけ処理する。
+// チャンク本体は空になった時点で ChunkPool に戻っているので、OS への返却は
+// 巡回の最後にまとめて行う。records_ は世代番号を保持するため縮めない。
+
+namespace {
+constexpr u32   compact_record_slice = 4096;   // records_ 走査の 1 単位
+constexpr usize compact_trim_blocks  = 64;     // ChunkPool 返却の 1 単位
+}
+
+CompactStats World::compact(f64 budget_us, const CompactOptions& options) {
+    using Clock = std::chrono::steady_clock;
+    using Phase = CompactProgress::Phase;
+    const auto start = Clock::now();
+    bool first = true;   // 予算 0 でも 1 単位は進める
+    auto within_budget = [&] {
+        if (std::exchange(first, false)) return true;
+        return std::chrono::duration<f64, std::micro>(Clock::now() - start).count() < budget_us;
+    };
+
+    CompactStats stats;
+    CompactProgress& c = compact_;
+    if (c.phase == Phase::Idle) {
+        c.queue.clear();
+        c.queue.reserve(archetypes_.size());
+        for (auto& [id, _] : archetypes_) c.queue.push_back(id);
+        c.phase = Phase::Archetypes;
+    }
+
+    std::vector<Archetype*> doomed;
+    while (!stats.done && within_budget()) {
+        switch (c.phase) {
+            case Phase::Archetypes:
+                stats.bytes_reclaimed += compact_archetype_step(options, stats, doomed);
+                break;
+            case Phase::Records:
+                stats.bytes_reclaimed += compact_records_step();
+                break;
+            default:
+                stats.bytes_reclaimed += compact_pool_step(options, stats);
+                break;
         }
-        if (match && arch->count() > 0) {
-            result.push_back(arch.get());
+    }
+    if (!doomed.empty()) {
+        stats.bytes_reclaimed += free_archetypes(doomed);
+        stats.archetypes_freed = static_cast<u32>(doomed.size());
+    }
+    return stats;
+}
+
+usize World::compact_archetype_step(const CompactOptions& options, CompactStats& stats,
+                                    std::vector<Archetype*>& doomed) {
+    CompactProgress& c = compact_;
+    if (c.sorting) return compact_sort_step(stats);
+    if (c.queue.empty()) {
+        c.phase  = CompactProgress::Phase::Records;
+        c.cursor = static_cast<u32>(records_.size());
+        c.free.clear();
+        c.free.reserve(free_indices_.size());   // 途中で伸ばし直すと 1 単位が長くなる
+        c.touched.clear();
+        return 0;
+    }
+    auto it = archetypes_.find(c.queue.back());
+    c.queue.pop_back();
+    if (it == archetypes_.end()) return 0;
+    Archetype* arch = it->second.get();
+    ++stats.archetypes_visited;
+    if (arch->count() == 0 && options.free_empty_archetypes) {
+        doomed.push_back(arch);
+        return 0;
+    }
+    if (options.sort_rows) {
+        // 目標の行順だけを先に求め、行の入れ替えはチャンク単位で進める
+        c.sort_order.clear();
+        for (u32 chunk = 0; chunk < arch->chunk_count(); ++chunk) {
+            auto ents = arch->chunk_entities(chunk);
+            c.sort_order.insert(c.sort_order.end(), ents.begin(), ents.end());
+        }
+        auto by_index = [](Entity a, Entity b) { return a.index() < b.index(); };
+        if (!std::is_sorted(c.sort_order.begin(), c.sort_order.end(), by_index)) {
+            std::sort(c.sort_order.begin(), c.sort_order.end(), by_index);
+            c.sorting    = true;
+            c.sort_arch  = arch->id();
+            c.sort_count = arch->count();
+            c.sort_row   = 0;
+            return 0;
         }
     }
-    return result;
+    return arch->shrink();
 }
 
-// ── コマンドバッファ適用 ────────────────────────────────
+usize World::compact_sort_step(CompactStats& stats) {
+    CompactProgress& c = compact_;
+    auto it = archetypes_.find(c.sort_arch);
+    Archetype* arch = it != archetypes_.end() ? it->second.get() : nullptr;
+    // 呼び出しの間に行が増減・移動していたら打ち切る (行順は性能のためだけ)
+    bool ok = arch && arch->count() == c.sort_count;
+    const u32 end = ok ? std::min(c.sort_count, c.sort_row + arch->chunk_capacity()) : 0;
+    for (; ok && c.sort_row < end; ++c.sort_row) {
+        const Entity e = c.sort_order[c.sort_row];
+        EntityRecord& rec = records_[e.index()];
+        if (!alive(e) || rec.archetype != arch || rec.row < c.sort_row) {
+            ok = false;
+            break;
+        }
+        const u32 row = rec.row;
+        if (row == c.sort_row) continue;
+        arch->swap_rows(c.sort_row, row);
+        records_[arch->entity(row).index()].row = row;
+        rec.row = c.sort_row;
+    }
+    if (ok && c.sort_row < c.sort_count) return 0;   // 次の単位で続きから
+    c.sorting = false;
+    if (ok) ++stats.archetypes_sorted;
+    return arch ? arch->shrink() : 0;
+}
 
-void World::flush_commands() {
-    cmd_buffer_.apply(*this);
+usize World::compact_records_step() {
+    // 空き番号は小さい index から再利用する (生存 Entity を records_ の先頭側に寄せる)。
+    // ソートの代わりに records_ を末尾から走査して降順に積み直す
+    CompactProgress& c = compact_;
+    const u32 stop = c.cursor > compact_record_slice + 1 ? c.cursor - compact_record_slice : 1;
+    while (c.cursor > stop) {
+        --c.cursor;
+        if (!records_[c.cursor].alive) c.free.push_back(c.cursor);
+    }
+    if (c.cursor > 1) return 0;
+
+    // 走査後に spawn / despawn された index だけを突き合わせる (free は降順に整列済み)
+    auto& fresh = c.free;
+    std::sort(c.touched.begin(), c.touched.end(), std::greater<>{});
+    c.touched.erase(std::unique(c.touched.begin(), c.touched.end()), c.touched.end());
+    // 再利用された index を外す。降順なので最初に見つかった位置より後ろだけを詰める
+    auto first_reused = fresh.end();
+    for (u32 index : c.touched) {
+        if (!records_[index].alive) continue;
+        auto pos = std::lower_bound(fresh.begin(), fresh.end(), index, std::greater<>{});
+        if (pos != fresh.end() && *pos == index) first_reused = std::min(first_reused, pos);
+    }
+    fresh.erase(std::remove_if(first_reused, fresh.end(), [&](u32 index) { return records_[index].alive; }),
+                fresh.end());
+    // 走査後に解放された index を足す
+    const auto kept = static_cast<std::ptrdiff_t>(fresh.size());
+    for (u32 index : c.touched) {
+        if (!records_[index].alive && !std::binary_search(fresh.begin(), fresh.begin() + kept, index, std::greater<>{})) {
+            fresh.push_back(index);
+        }
+    }
+
+    const usize before = free_indices_.capacity();
+    free_indices_.swap(fresh);
+    std::vector<u32>{}.swap(c.free);
+    c.touched.clear();
+    c.phase  = CompactProgress::Phase::Sparse;
+    c.sparse = 0;
+    return before > free_indices_.capacity() ? (before - free_indices_.capacity()) * sizeof(u32) : 0;
+}
+
+usize World::compact_pool_step(const CompactOptions& options, CompactStats& stats) {
+    CompactProgress& c = compact_;
+    if (c.phase == CompactProgress::Phase::Sparse) {
+        while (c.sparse < sparse_.size() && !sparse_mask_.test(c.sparse)) ++c.sparse;
+        if (c.sparse < sparse_.size()) return sparse_[c.sparse++]->shrink();
+
+        usize freed = 0;
+        auto shrink = [&](auto& v) {
+            const usize before = v.capacity();
+            v.shrink_to_fit();
+            freed += (before - v.capacity()) * sizeof(v[0]);
+        };
+        shrink(batch_entities_);
+        shrink(observer_batch_);
+        shrink(c.queue);
+        shrink(c.sort_order);
+        shrink(c.touched);
+        c.phase = CompactProgress::Phase::Pool;
+        return freed;
+    }
+    if (options.trim_chunk_pool && chunk_pool_.chunks_free() > 0) {
+        return chunk_pool_.trim(compact_trim_blocks);
+    }
+    c.phase = CompactProgress::Phase::Idle;
+    stats.done = true;
+    return 0;
+}
+
+usize World::free_archetypes(std::span<Archetype* const> doomed_in) {
+    std::vector<Archetype*> doomed(doomed_in.begin(), doomed_in.end());
+    std::sort(doomed.begin(), doomed.end());
+    auto is_doomed = [&](const Archetype* arch) {
+        return std::binary_search(doomed.begin(), doomed.end(), arch);
+    };
+
+    for (auto& [_, arch] : archetypes_) {
+        if (!is_doomed(arch.get())) arch->drop_edges_to(doomed);
+    }
+    std::erase_if(root_edges_, [&](const auto& entry) { return is_doomed(entry.second.target); });
+    std::erase_if(migrate_edges_, [&](const auto& entry) {
+        return is_doomed(entry.first.source) || is_doomed(entry.second.target);
+    });
+    for (auto& q : queries_) std::erase_if(q->archetypes, is_doomed);
+
+    usize freed = 0;
+    for (Archetype* arch : doomed) {
+        freed += sizeof(Archetype) + arch->heap_bytes();
+        archetypes_.erase(arch->id());
+    }
+    ENG_DEBUG("World: freed %zu empty archetypes", doomed.size());
+    return freed;
 }
 
 // ── QueryBuilder::execute ───────────────────────────────
 
+Tick QueryBuilder::filter_since() const {
+    return has_since_ ? since_ : world_.last_change_tick();
+}
+
 std::vector<QueryMatch> QueryBuilder::execute() const {
-    auto archetypes = world_.find_archetypes_with(required_, excluded_);
     std::vector<QueryMatch> matches;
-    matches.reserve(archetypes.size());
-    for (auto* arch : archetypes) {
-        QueryMatch m;
-        m.archetype = arch;
-        m.count = arch->count();
-        for (auto tid : required_) {
-            m.columns.push_back(arch->column(tid)->raw());
+    std::vector<i32> cols(required_.size());
+    const detail::ChunkFilter filter{changed_, added_, filter_since()};
+    const ComponentMask& sparse = world_.sparse_mask();
+    world_.visit_archetypes(required_mask_.minus(sparse), excluded_mask_.minus(sparse), [&](Archetype& arch) {
+        for (usize i = 0; i < required_.size(); ++i) cols[i] = arch.column_index(required_[i]);
+        for (u32 c = 0; c < arch.chunk_count(); ++c) {
+            if (!filter.empty() && !filter.passes(arch, c)) continue;
+            QueryMatch m;
+            m.archetype = &arch;
+            m.chunk = c;
+            m.count = arch.chunk_size(c);
+            for (i32 col : cols) {
+                m.columns.push_back(col >= 0 ? arch.chunk_column_at(c, static_cast<u32>(col)) : nullptr);
+            }
+            matches.push_back(std::move(m));
         }
-        matches.push_back(std::move(m));
-    }
+    });
     return matches;
 }
 
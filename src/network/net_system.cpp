@@ -28,8 +28,14 @@ public:
 
     void register_sync(const SyncComponentDesc&) override {}
 
-    Snapshot take_snapshot(u64 frame, ecs::World&) override {
-        return Snapshot{frame, {}};
+    Snapshot take_snapshot(u64 frame, ecs::World& world) override {
+        Snapshot snapshot{frame, {}};
+        if (auto saved = world.save_snapshot(snapshot.state_data); !saved) {
+            ENG_WARN("NetSystem: snapshot of frame %llu failed (%s)",
+                     static_cast<unsigned long long>(frame), error_string(saved.error()));
+            snapshot.state_data.clear();
+        }
+        return snapshot;
     }
 
     void rollback(const Snapshot&, ecs::World&) override {}
@@ -14,6 +14,8 @@ extern "C" {
 #include <memory>
 #include <cstring>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 using namespace engine;
 using namespace engine::ecs;
@@ -121,7 +123,7 @@ static Value entity_to_value(Entity e) {
 static Value fn_engine_init(int argc, Value* argv) {
     (void)argc; (void)argv;
     g_world = std::make_unique<World>();
-    g_scene = std::make_unique<SceneGraph>();
+    g_scene = std::make_unique<SceneGraph>(*g_world);
     g_input = std::make_unique<InputSystem>();
     g_actions = std::make_unique<ActionMap>();
     g_vfs = std::make_unique<VFS>();
@@ -169,8 +171,19 @@ static Value fn_entity_spawn(int argc, Value* argv) {
 static Value fn_entity_despawn(int argc, Value* argv) {
     if (!g_world) return hajimu_null();
     Entity e = resolve_entity(argv);
+    // ChildOf の子孫は連鎖 despawn されるので、先に部分木を集めておき、その ID だけを表から外す
+    // (表全体を走査しない。循環していても各 Entity は 1 回だけ積む)
+    std::vector<Entity> subtree{e};
+    std::unordered_set<u64> seen{e.id};
+    for (usize k = 0; k < subtree.size(); ++k) {
+        g_world->each_source<ChildOf>(subtree[k], [&](Entity child) {
+            if (seen.insert(child.id).second) subtree.push_back(child);
+        });
+    }
     g_world->despawn(e);
-    g_entities.erase(e.id);
+    for (Entity gone : subtree) {
+        if (!g_world->alive(gone)) g_entities.erase(gone.id);
+    }
     return hajimu_null();
 }
 
@@ -599,8 +612,10 @@ static Value fn_sc_mask_make(int argc, Value* argv) {
 static Value fn_sc_world_clear(int argc, Value* argv) {
     (void)argc; (void)argv;
     if (g_world) {
-        // World を再作成して全 Entity を削除
+        // World を再作成して全 Entity を削除 (シーングラフは World 上にあるので作り直す)
+        g_scene.reset();
         g_world = std::make_unique<World>();
+        g_scene = std::make_unique<SceneGraph>(*g_world);
     }
     g_entities.clear();
     sc_clear_entities();
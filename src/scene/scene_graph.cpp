@@ -3,100 +3,93 @@
  */
 #include <engine/scene/scene_graph.hpp>
 #include <engine/core/log.hpp>
-#include <algorithm>
+#include <engine/core/reflection.hpp>
+#include <cstddef>
 
 namespace engine::scene {
 
+using ecs::ChildOf;
+
+// スナップショットで名前引きできるように登録
+ENG_REFLECT_BEGIN(SceneNode)
+ENG_REFLECT_FIELD(SceneNode, active)
+ENG_REFLECT_END(SceneNode)
+
+ENG_REFLECT_BEGIN(SceneName)
+ENG_REFLECT_FIELD(SceneName, id)
+ENG_REFLECT_END(SceneName)
+
 Entity SceneGraph::add_node(Entity entity, const std::string& name, Entity parent) {
-    SceneNode node;
-    node.entity = entity;
-    node.name = name;
-    node.parent = parent;
-
-    if (parent.valid()) {
-        auto it = nodes_.find(parent.id);
-        if (it != nodes_.end()) {
-            it->second.children.push_back(entity);
-        }
+    if (!world_.alive(entity)) return Entity::null();
+    world_.add_component(entity, SceneNode{true});
+    if (!name.empty()) {
+        world_.add_component(entity, SceneName{world_.intern(name)});
     } else {
-        roots_.push_back(entity);
+        world_.remove_component<SceneName>(entity);
     }
-
-    nodes_[entity.id] = std::move(node);
+    if (parent.valid()) reparent(entity, parent);
     return entity;
 }
 
 void SceneGraph::reparent(Entity entity, Entity new_parent) {
-    auto it = nodes_.find(entity.id);
-    if (it == nodes_.end()) return;
-    auto& node = it->second;
-
-    // 旧親から除去
-    if (node.parent.valid()) {
-        auto pit = nodes_.find(node.parent.id);
-        if (pit != nodes_.end()) {
-            auto& children = pit->second.children;
-            children.erase(std::remove_if(children.begin(), children.end(),
-                [&](Entity e) { return e == entity; }), children.end());
-        }
-    } else {
-        roots_.erase(std::remove_if(roots_.begin(), roots_.end(),
-            [&](Entity e) { return e == entity; }), roots_.end());
+    if (!contains(entity)) return;
+    if (!new_parent.valid()) {
+        world_.remove_relation<ChildOf>(entity);
+        return;
     }
-
-    // 新親に追加
-    node.parent = new_parent;
-    if (new_parent.valid()) {
-        auto nit = nodes_.find(new_parent.id);
-        if (nit != nodes_.end()) {
-            nit->second.children.push_back(entity);
+    // 循環の防止: new_parent から親を辿って entity に当たれば無視
+    // (子のないノードは自身以外の祖先になり得ないので辿らない)
+    const bool may_cycle = new_parent == entity || child_count(entity) > 0;
+    for (Entity p = new_parent; may_cycle && p.valid(); p = parent(p)) {
+        if (p == entity) {
+            ENG_WARN("SceneGraph: reparent would create a cycle, ignored");
+            return;
         }
-    } else {
-        roots_.push_back(entity);
     }
+    world_.add_relation<ChildOf>(entity, new_parent);
 }
 
 void SceneGraph::remove_node(Entity entity) {
-    auto it = nodes_.find(entity.id);
-    if (it == nodes_.end()) return;
-
-    // 子を再帰的に削除
-    auto children_copy = it->second.children;
-    for (auto child : children_copy) {
-        remove_node(child);
-    }
-
-    // 親から除去
-    if (it->second.parent.valid()) {
-        auto pit = nodes_.find(it->second.parent.id);
-        if (pit != nodes_.end()) {
-            auto& children = pit->second.children;
-            children.erase(std::remove_if(children.begin(), children.end(),
-                [&](Entity e) { return e == entity; }), children.end());
+    if (!contains(entity)) return;
+
+    // 子孫は作業リストで辿る (深い階層でも再帰せず、配列も 1 本を使い回す)。
+    // 子は親から外す前に積むので、索引の変更と走査が重ならない
+    std::vector<Entity> pending{entity};
+    while (!pending.empty()) {
+        const Entity node = pending.back();
+        pending.pop_back();
+        if (contains(node)) {
+            each_child(node, [&](Entity c) { pending.push_back(c); });
+            world_.remove_component<SceneName>(node);
+            world_.remove_component<SceneNode>(node);
         }
-    } else {
-        roots_.erase(std::remove_if(roots_.begin(), roots_.end(),
-            [&](Entity e) { return e == entity; }), roots_.end());
+        world_.remove_relation<ChildOf>(node);
     }
-
-    nodes_.erase(it);
 }
 
-SceneNode* SceneGraph::find(Entity entity) {
-    auto it = nodes_.find(entity.id);
-    return it != nodes_.end() ? &it->second : nullptr;
+std::string_view SceneGraph::name(Entity entity) const {
+    if (!contains(entity)) return {};
+    const SceneName* tag = std::as_const(world_).get_component<SceneName>(entity);
+    return tag ? world_.string(tag->id) : std::string_view{};
 }
 
-const SceneNode* SceneGraph::find(Entity entity) const {
-    auto it = nodes_.find(entity.id);
-    return it != nodes_.end() ? &it->second : nullptr;
+Entity SceneGraph::find_by_name(std::string_view name) const {
+    // 一度も登録されていない名前のノードはない
+    const u32 id = name.empty() ? ecs::invalid_string : world_.find_string(name);
+    if (id == ecs::invalid_string) return Entity::null();
+    Entity found = Entity::null();
+    named_nodes_.each<const SceneName>([&](Entity e, const SceneName& tag) {
+        if (!found.valid() && tag.id == id) found = e;
+    });
+    return found;
 }
 
-Entity SceneGraph::find_by_name(const std::string& name) const {
-    for (auto& [_, node] : nodes_) {
-        if (node.name == name) return node.entity;
-    }
-    return Entity::null();
+std::vector<Entity> SceneGraph::roots() const {
+    std::vector<Entity> out;
+    world_.query().without<ChildOf>().each<const SceneNode>([&](Entity e, const SceneNode&) {
+        out.push_back(e);
+    });
+    return out;
 }
 
 void SceneGraph::traverse(Entity root, std::function<void(Entity, u32)> visitor) const {
@@ -110,12 +103,7 @@ void SceneGraph::traverse(Entity root, std::function<void(Entity, u32)> visitor)
 
         visitor(entity, depth);
 
-        auto it = nodes_.find(entity.id);
-        if (it != nodes_.end()) {
-            for (auto& child : it->second.children) {
-                stack.push_back({child, depth + 1});
-            }
-        }
+        each_child(entity, [&](Entity child) { stack.push_back({child, depth + 1}); });
     }
 }
 
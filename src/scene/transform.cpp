@@ -4,10 +4,24 @@
 #include <engine/scene/transform.hpp>
 #include <engine/scene/scene_graph.hpp>
 #include <engine/ecs/world.hpp>
+#include <engine/core/reflection.hpp>
 #include <cmath>
+#include <cstddef>
 
 namespace engine::scene {
 
+// スナップショットで名前引きできるように登録
+ENG_REFLECT_BEGIN(Transform)
+ENG_REFLECT_FIELD(Transform, position)
+ENG_REFLECT_FIELD(Transform, rotation)
+ENG_REFLECT_FIELD(Transform, scale)
+ENG_REFLECT_END(Transform)
+
+ENG_REFLECT_BEGIN(WorldTransform)
+ENG_REFLECT_FIELD(WorldTransform, matrix)
+ENG_REFLECT_FIELD(WorldTransform, dirty)
+ENG_REFLECT_END(WorldTransform)
+
 Mat4 Transform::local_matrix() const {
     // Scale → Rotate(Quaternion) → Translate の順
     // クォータニオン → 回転行列変換
@@ -116,11 +130,9 @@ static void update_recursive(SceneGraph& graph, ecs::World& world,
         wtf->dirty = false;
     }
 
-    auto* node = graph.find(entity);
-    if (!node) return;
-    for (auto child : node->children) {
+    graph.each_child(entity, [&](ecs::Entity child) {
         update_recursive(graph, world, child, world_mat);
-    }
+    });
 }
 
 void update_world_transforms(SceneGraph& graph, ecs::World& world) {
@@ -2,10 +2,21 @@
  * tests/test_ecs.cpp — ECS ユニットテスト
  */
 #include <engine/core/types.hpp>
+#include <engine/core/reflection.hpp>
 #include <engine/ecs/entity.hpp>
+#include <engine/ecs/snapshot.hpp>
 #include <engine/ecs/world.hpp>
+#include <engine/network/net_system.hpp>
+#include <engine/scene/scene_graph.hpp>
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <cstddef>
 #include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
 
 using namespace engine;
 using namespace engine::ecs;
@@ -24,6 +35,34 @@ struct Health {
     i32 max_hp;
 };
 
+struct Comp8 {
+    u8 bytes[8];
+};
+
+struct EnemyTag {};
+struct FrozenTag {};
+
+struct Stunned {
+    f32 remaining;
+};
+
+struct Targets {
+    Entity target;
+};
+
+// スナップショットは TypeRegistry の名前で型を引く (Comp8 は未登録のまま)
+ENG_REFLECT_BEGIN(Position)
+ENG_REFLECT_FIELD(Position, x)
+ENG_REFLECT_END(Position)
+ENG_REFLECT_BEGIN(Velocity)
+ENG_REFLECT_END(Velocity)
+ENG_REFLECT_BEGIN(Health)
+ENG_REFLECT_END(Health)
+ENG_REFLECT_BEGIN(EnemyTag)
+ENG_REFLECT_END(EnemyTag)
+ENG_REFLECT_BEGIN(Stunned)
+ENG_REFLECT_END(Stunned)
+
 static int tests_passed = 0;
 static int tests_failed = 0;
 
@@ -170,6 +209,1435 @@ TEST(many_entities) {
     ASSERT(world.entity_count() == 1000);
 }
 
+TEST(scheduler_conflict_edges) {
+    World world;
+    auto& sched = world.scheduler();
+    auto noop = [](World&) {};
+    sched.add_system({"move",    {type_id<Velocity>()}, {type_id<Position>()}, {}, noop});  // 0
+    sched.add_system({"regen",   {},                    {type_id<Health>()},   {}, noop});  // 1
+    sched.add_system({"render",  {type_id<Position>()}, {},                    {}, noop});  // 2
+    sched.add_system({"damage",  {type_id<Position>()}, {type_id<Health>()},   {}, noop});  // 3
+    sched.add_system({"cleanup", {},                    {},                    {"regen"}, noop});  // 4 (排他)
+
+    const auto& edges = sched.conflict_edges();
+    auto has = [&](u32 a, u32 b) {
+        for (auto& e : edges) if (e.first == a && e.second == b) return true;
+        return false;
+    };
+    ASSERT(has(0, 2));    // W(Position) → R(Position)
+    ASSERT(has(0, 3));
+    ASSERT(has(1, 3));    // W(Health) 同士
+    ASSERT(!has(0, 1));   // 無関係
+    ASSERT(!has(2, 3));   // 読み取り同士
+    for (u32 i = 0; i < 4; ++i) ASSERT(has(i, 4));
+}
+
+TEST(scheduler_run_parallel) {
+    World world;
+    std::vector<Entity> entities;
+    for (int i = 0; i < 100; ++i) {
+        Entity e = world.spawn();
+        world.add_component(e, Position{0, 0, 0});
+        world.add_component(e, Velocity{1, 0, 0});
+        entities.push_back(e);
+    }
+
+    JobSystem js(4);
+    std::atomic<int> stage{0};
+    bool order_ok = true;
+    auto& sched = world.scheduler();
+    sched.add_system({"integrate", {type_id<Velocity>()}, {type_id<Position>()}, {}, [&](World& w) {
+        w.query().with<Position, Velocity>().for_each<Position, Velocity>(
+            [](Entity, Position& p, Velocity& v) { p.x += v.vx; });
+        stage.fetch_add(1);
+    }});
+    sched.add_system({"check", {type_id<Position>()}, {}, {}, [&](World&) {
+        if (stage.load() != 1) order_ok = false;
+    }});
+
+    for (int frame = 0; frame < 10; ++frame) {
+        stage.store(0);
+        sched.run_parallel(js);
+        ASSERT(order_ok);
+    }
+    for (Entity e : entities) ASSERT(world.get_component<Position>(e)->x == 10.0f);
+}
+
+TEST(scheduler_parallel_command_order) {
+    World world;
+    JobSystem js(4);
+    Entity target = world.spawn();
+    world.add_component(target, Health{-1, 0});
+    auto& sched = world.scheduler();
+    constexpr i32 S = 8;
+    for (i32 i = 0; i < S; ++i) {
+        // 読み取りのみで競合しない → 並列に走り、どのスレッドで記録するかは毎回変わる
+        sched.add_system({"record" + std::to_string(i), {type_id<Velocity>()}, {}, {}, [i, target](World& w) {
+            std::this_thread::sleep_for(std::chrono::microseconds((S - i) * 50));
+            CommandBuffer& cb = w.command_buffer();
+            cb.set_component(target, Health{i, 0});
+            cb.add_component(cb.spawn(), Health{i, 1});
+        }});
+    }
+    const std::vector<u32> order = sched.schedule();
+
+    for (int frame = 0; frame < 10; ++frame) {
+        sched.run_parallel(js);
+        world.flush_commands();
+        // 最後の書き込みと spawn の順は実行順位どおり (逐次 run と同じ)
+        ASSERT(world.get_component<Health>(target)->hp == static_cast<i32>(order.back()));
+        std::vector<std::pair<u32, i32>> spawned;
+        world.query().each<const Health>([&](Entity e, const Health& h) {
+            if (h.max_hp == 1) spawned.push_back({e.index(), h.hp});
+        });
+        std::sort(spawned.begin(), spawned.end());
+        ASSERT(spawned.size() == S * static_cast<usize>(frame + 1));
+        for (usize k = 0; k < S; ++k) {
+            ASSERT(spawned[spawned.size() - S + k].second == static_cast<i32>(order[k]));
+        }
+    }
+}
+
+TEST(scheduler_cached_schedule_and_timings) {
+    World world;
+    auto& sched = world.scheduler();
+    std::vector<int> ran;
+    sched.add_system({"c", {}, {type_id<Health>()},   {"b"}, [&](World&) { ran.push_back(2); }});
+    sched.add_system({"b", {}, {type_id<Velocity>()}, {"a"}, [&](World&) { ran.push_back(1); }});
+    sched.add_system({"a", {}, {type_id<Position>()}, {},    [&](World&) { ran.push_back(0); }});
+
+    const auto& order = sched.schedule();
+    ASSERT(order.size() == 3);
+    ASSERT(order[0] == 2 && order[1] == 1 && order[2] == 0);
+    const u32* cached = sched.schedule().data();
+
+    for (int frame = 0; frame < 3; ++frame) sched.run();
+    ASSERT(sched.schedule().data() == cached);   // 再計算されない
+    ASSERT(ran.size() == 9);
+    ASSERT(ran[0] == 0 && ran[1] == 1 && ran[2] == 2);
+
+    ASSERT(sched.timings().size() == 3);
+    for (auto& t : sched.timings()) {
+        ASSERT(t.runs == 3);
+        ASSERT(t.max_us >= t.last_us);
+        ASSERT(t.average_us() <= t.max_us);
+    }
+    sched.reset_timings();
+    ASSERT(sched.timings()[0].runs == 0);
+
+    // 登録で無効化される
+    sched.add_system({"d", {}, {type_id<Health>()}, {"c"}, [&](World&) { ran.push_back(3); }});
+    ASSERT(sched.schedule().size() == 4);
+    ASSERT(sched.schedule().back() == 3);
+}
+
+TEST(chunked_storage_stable_and_pooled) {
+    World world;
+    std::vector<Entity> entities;
+    for (int i = 0; i < 5000; ++i) {
+        Entity e = world.spawn();
+        world.add_component(e, Position{static_cast<f32>(i), 0, 0});
+        world.add_component(e, Health{i, 100});
+        entities.push_back(e);
+    }
+    // 追加で既存データは移動しない
+    Position* first = world.get_component<Position>(entities[0]);
+    for (int i = 0; i < 5000; ++i) {
+        Entity e = world.spawn();
+        world.add_component(e, Position{0, 0, 0});
+        world.add_component(e, Health{0, 0});
+    }
+    ASSERT(world.get_component<Position>(entities[0]) == first);
+    usize in_use = world.chunk_pool().chunks_in_use();
+    ASSERT(in_use > 2);
+
+    // チャンクを跨いだ swap-remove 後もデータが保たれる
+    for (int i = 0; i < 5000; i += 2) world.despawn(entities[i]);
+    for (int i = 1; i < 5000; i += 2) {
+        ASSERT(world.get_component<Position>(entities[i])->x == static_cast<f32>(i));
+        ASSERT(world.get_component<Health>(entities[i])->hp == i);
+    }
+
+    int count = 0;
+    for (auto& m : world.query().with<Position, Health>().execute()) {
+        ASSERT(m.count <= m.archetype->chunk_capacity());
+        count += m.count;
+    }
+    ASSERT(count == 7500);
+    ASSERT(world.chunk_pool().chunks_in_use() < in_use);
+    ASSERT(world.chunk_pool().chunks_free() > 0);   // 空チャンクはプールへ戻る
+}
+
+TEST(archetype_transition_edges) {
+    World world;
+    Entity a = world.spawn();
+    Entity b = world.spawn();
+    world.add_component(a, Health{7, 10});
+    world.add_component(a, Position{1, 2, 3});
+    world.add_component(b, Velocity{4, 5, 6});
+    world.add_component(b, Position{9, 9, 9});
+    u32 archetypes = world.archetype_count();
+
+    for (int i = 0; i < 100; ++i) {
+        world.add_component(a, Velocity{static_cast<f32>(i), 0, 0});
+        world.remove_component<Position>(a);
+        world.add_component(a, Position{1, 2, 3});
+        world.remove_component<Velocity>(a);
+    }
+    ASSERT(world.get_component<Health>(a)->hp == 7);
+    ASSERT(world.get_component<Position>(a)->z == 3.0f);
+    ASSERT(!world.has_component<Velocity>(a));
+    ASSERT(world.get_component<Velocity>(b)->vy == 5.0f);   // 同居 Entity も無傷
+    ASSERT(world.get_component<Position>(b)->x == 9.0f);
+    // {Health,Velocity,Position}, {Health,Velocity} の 2 つだけ増える
+    ASSERT(world.archetype_count() == archetypes + 2);
+
+    world.remove_component<Health>(a);
+    world.remove_component<Position>(a);
+    ASSERT(world.alive(a));
+    ASSERT(!world.has_component<Position>(a));
+}
+
+TEST(spawn_batch_contiguous) {
+    World world;
+    // 既存 Entity で末尾チャンクを途中まで埋めておく
+    Entity pre = world.spawn();
+    world.add_component(pre, Position{-1, -1, -1});
+    world.add_component(pre, Velocity{0, 0, 0});
+    Entity gone = world.spawn();
+    world.despawn(gone);   // 空きインデックスも再利用される
+
+    auto batch = world.spawn_batch<Position, Velocity>(3000, [](u32 i, Position& p, Velocity& v) {
+        p = Position{static_cast<f32>(i), 0, 0};
+        v = Velocity{1, 0, 0};
+    });
+    ASSERT(batch.size() == 3000);
+    ASSERT(world.entity_count() == 3001);
+    ASSERT(batch[0].index() == gone.index());
+    for (u32 i = 0; i < batch.size(); ++i) {
+        ASSERT(world.alive(batch[i]));
+        ASSERT(world.get_component<Position>(batch[i])->x == static_cast<f32>(i));
+        ASSERT(world.get_component<Velocity>(batch[i])->vx == 1.0f);
+    }
+    ASSERT(world.get_component<Position>(pre)->x == -1.0f);
+    ASSERT(world.archetype_count() == 2);   // {Position}, {Position, Velocity} のみ
+
+    auto zeros = world.spawn_batch<Health>(10);
+    ASSERT(zeros.size() == 10);
+    ASSERT(world.get_component<Health>(zeros[9])->hp == 0);
+    ASSERT(world.spawn_batch<Health>(0).empty());
+}
+
+TEST(query_each_template) {
+    World world;
+    world.spawn_batch<Position, Velocity>(5000, [](u32 i, Position& p, Velocity& v) {
+        p = Position{0, 0, 0};
+        v = Velocity{static_cast<f32>(i % 4), 0, 0};
+    });
+    world.spawn_batch<Position, Velocity, Health>(100);
+    world.spawn_batch<Position>(50);
+
+    // Entity なし形式 (ベクトル化可能なループ)
+    world.each<Position, Velocity>([](Position& p, const Velocity& v) { p.x += v.vx; });
+
+    f32 sum = 0;
+    int count = 0;
+    world.query().without<Health>().each<Position, Velocity>([&](Entity e, Position& p, Velocity&) {
+        ASSERT(world.alive(e));
+        sum += p.x;
+        count++;
+    });
+    ASSERT(count == 5000);
+    ASSERT(sum == 1250.0f * (0 + 1 + 2 + 3));
+
+    int only_pos = 0;
+    world.each<Position>([&](Position&) { only_pos++; });
+    ASSERT(only_pos == 5150);
+}
+
+TEST(cached_query_incremental) {
+    World world;
+    world.spawn_batch<Position>(10);
+    world.spawn_batch<Position, Velocity>(20);
+
+    Query moving = world.query().with<Position, Velocity>().without<Health>().cached();
+    ASSERT(moving.valid());
+    ASSERT(moving.archetypes().size() == 1);
+    ASSERT(moving.entity_count() == 20);
+
+    // 後から生成された Archetype も追加される
+    world.spawn_batch<Position, Velocity, Health>(5);          // 除外
+    auto more = world.spawn_batch<Velocity, Position, Comp8>(7);
+    ASSERT(moving.archetypes().size() == 2);
+    ASSERT(moving.entity_count() == 27);
+
+    int n = 0;
+    moving.each<Position, Velocity>([&](Entity, Position& p, Velocity&) { p.y = 1; n++; });
+    ASSERT(n == 27);
+    ASSERT(world.get_component<Position>(more[3])->y == 1.0f);
+
+    // 同一条件 (順序違い) は同じ登録を共有
+    Query same = world.query().without<Health>().with<Velocity, Position>().cached();
+    ASSERT(same.archetypes().data() == moving.archetypes().data());
+    ASSERT(world.cached_query<Position>().entity_count() == 42);
+}
+
+TEST(component_index_and_signature) {
+    u32 ip = component_index<Position>();
+    u32 iv = component_index<Velocity>();
+    ASSERT(ip != iv);
+    ASSERT(component_index(type_id<Position>()) == ip);   // TypeID 経由でも同じ連番
+    ASSERT(ip < max_component_types);
+
+    ComponentMask pv;
+    pv.set(ip);
+    pv.set(iv);
+    ComponentMask p;
+    p.set(ip);
+    ComponentMask h;
+    h.set(component_index<Health>());
+    ASSERT(pv.contains_all(p));
+    ASSERT(!p.contains_all(pv));
+    ASSERT(!pv.intersects(h));
+    ASSERT(ComponentMask{}.empty());
+
+    World world;
+    Entity e = world.spawn();
+    world.add_component(e, Velocity{1, 2, 3});
+    world.add_component(e, Position{4, 5, 6});
+    auto* arch = world.find_archetypes_with({type_id<Position>()}, {})[0];
+    ASSERT(arch->signature() == pv);
+    ASSERT(arch->column_of(ip) >= 0);
+    ASSERT(arch->column_of(component_index<Health>()) == -1);
+    ASSERT(world.get_component_raw_public(e, type_id<Velocity>()) == world.get_component<Velocity>(e));
+}
+
+TEST(par_each_chunks_and_worker_buffers) {
+    JobSystem js(4);
+    World world;
+    constexpr u32 N = 50000;
+    auto spawned = world.spawn_batch<Position, Velocity>(N, [](u32 i, Position& p, Velocity& v) {
+        p = {0, 0, 0};
+        v = {static_cast<f32>(i), 1, 0};
+    });
+    std::vector<Entity> ents(spawned.begin(), spawned.end());
+    world.spawn_batch<Position>(100);   // Velocity 無しは対象外
+
+    std::atomic<u32> visited{0};
+    world.par_each<Position, Velocity>([&](Position& p, const Velocity& v) {
+        p.x += v.vx;
+        visited.fetch_add(1, std::memory_order_relaxed);
+    }, js);
+    ASSERT(visited.load() == N);
+    ASSERT(world.get_component<Position>(ents[1234])->x == 1234.0f);
+
+    // 構造変更はスレッド別バッファに積み、flush で適用
+    Query moving = world.query().with<Position, Velocity>().cached();
+    moving.par_each<Velocity>([](CommandBuffer& cb, Entity e, Velocity& v) {
+        if (static_cast<u32>(v.vx) % 10 == 0) cb.add_component(e, Health{7, 7});
+    }, js);
+    ASSERT(world.cached_query<Health>().entity_count() == 0);
+    world.flush_commands();
+    ASSERT(world.cached_query<Health>().entity_count() == N / 10);
+    ASSERT(world.get_component<Health>(ents[20])->hp == 7);
+    ASSERT(!world.has_component<Health>(ents[21]));
+    ASSERT(moving.entity_count() == N);
+
+    // par_each の前後に同じスレッドで記録したコマンドとは記録順に適用される
+    CommandBuffer& cb = world.command_buffer();
+    cb.add_component(ents[0], Comp8{});
+    moving.par_each<Velocity>([](CommandBuffer& c, Entity e, Velocity&) {
+        c.remove_component<Comp8>(e);
+        c.add_component(e, FrozenTag{});
+    }, js);
+    for (Entity e : ents) cb.remove_component<FrozenTag>(e);
+    world.flush_commands();
+    ASSERT(!world.has_component<Comp8>(ents[0]));
+    ASSERT(world.cached_query<FrozenTag>().entity_count() == 0);
+}
+
+TEST(command_buffer_streams_merge_by_sort_key) {
+    World world;
+    CommandBuffer& cb = world.command_buffer();
+
+    // 可変長レコード: ヘッダ + 実サイズ (8 バイト境界)
+    Entity e = world.spawn();
+    cb.add_component(e, Position{1, 2, 3});
+    ASSERT(cb.pending() == 1);
+    ASSERT(cb.bytes_used() == sizeof(CommandHeader) + 16);
+    cb.set_component(e, Position{4, 5, 6});   // 同一ストリーム内は記録順
+    world.flush_commands();
+    ASSERT(cb.pending() == 0);
+    ASSERT(world.get_component<Position>(e)->x == 4.0f);
+
+    // 各スレッドが逆順に開始しても、適用順はソートキー順
+    constexpr u32 T = 4;
+    std::vector<std::thread> threads;
+    for (u32 t = T; t-- > 0;) {
+        threads.emplace_back([&cb, t] {
+            cb.set_sort_key(t);
+            for (u32 i = 0; i < 100; ++i) {
+                Entity spawned = cb.spawn();
+                cb.add_component(spawned, Health{static_cast<i32>(t), static_cast<i32>(i)});
+            }
+        });
+        threads.back().join();
+    }
+    ASSERT(cb.pending() == T * 200);
+    world.flush_commands();
+
+    std::vector<std::pair<u32, i32>> order;
+    world.each<Health>([&](Entity ent, Health& h) { order.push_back({ent.index(), h.hp * 1000 + h.max_hp}); });
+    ASSERT(order.size() == T * 100);
+    std::sort(order.begin(), order.end());   // Entity index は適用順に採番される
+    for (u32 k = 0; k < order.size(); ++k) {
+        ASSERT(order[k].second == static_cast<i32>((k / 100) * 1000 + k % 100));
+    }
+
+    // 1 回の apply で 65536 を超える spawn も、すべての一時 Entity が正式 Entity に解決される
+    constexpr u32 burst = 70000;
+    for (u32 i = 0; i < burst; ++i) cb.add_component(cb.spawn(), Velocity{static_cast<f32>(i), 0, 0});
+    const CommandApplyStats st = world.flush_commands();
+    ASSERT(st.spawned == burst && st.discarded == 0);
+    u32 seen = 0;
+    f64 sum = 0;
+    world.each<const Velocity>([&](const Velocity& v) { ++seen; sum += v.vx; });
+    ASSERT(seen == burst && sum == f64{burst} * (burst - 1) / 2);
+
+    // 以前の apply / clear の一時 Entity は、今回の spawn 数より小さい index でも破棄される
+    Entity stale = cb.spawn();
+    world.flush_commands();
+    Entity cleared = cb.spawn();
+    cb.clear();
+    Entity fresh = cb.spawn();
+    ASSERT(fresh.index() == stale.index() && fresh != stale && fresh != cleared);
+    cb.add_component(fresh, Health{-1, 0});
+    cb.add_component(stale, Health{-2, 0});
+    cb.add_component(cleared, Health{-3, 0});
+    const CommandApplyStats again = world.flush_commands();
+    ASSERT(again.spawned == 1 && again.discarded == 2);
+    u32 hp_counts[4] = {};
+    world.each<const Health>([&](const Health& h) {
+        if (h.hp < 0) ++hp_counts[-h.hp];
+    });
+    ASSERT(hp_counts[1] == 1 && hp_counts[2] == 0 && hp_counts[3] == 0);
+}
+
+TEST(command_buffer_coalesced_playback) {
+    World world;
+    CommandBuffer& cb = world.command_buffer();
+    Entity e = world.spawn();
+    world.add_component(e, Comp8{});
+
+    // 3 回の追加 + 上書き → 移動は 1 回
+    cb.add_component(e, Position{1, 1, 1});
+    cb.add_component(e, Velocity{2, 2, 2});
+    cb.set_component(e, Position{3, 3, 3});
+    cb.add_component(e, Health{5, 5});
+    cb.remove_component<Comp8>(e);
+    CommandApplyStats stats = world.flush_commands();
+    ASSERT(stats.commands == 5);
+    ASSERT(stats.entities == 1);
+    ASSERT(stats.migrations == 1);
+    ASSERT(stats.migrations_saved == 3);
+    ASSERT(world.get_component<Position>(e)->x == 3.0f);
+    ASSERT(world.get_component<Velocity>(e)->vy == 2.0f);
+    ASSERT(world.get_component<Health>(e)->hp == 5);
+    ASSERT(!world.has_component<Comp8>(e));
+
+    // 追加 → 削除は移動なし、上書きのみも移動なし
+    cb.add_component(e, Comp8{});
+    cb.remove_component<Comp8>(e);
+    cb.set_component(e, Health{9, 9});
+    stats = world.flush_commands();
+    ASSERT(stats.migrations == 0);
+    ASSERT(stats.migrations_saved == 2);
+    ASSERT(world.get_component<Health>(e)->hp == 9);
+
+    // 上書き → 追加は記録順どおり追加の値が残る
+    cb.set_component(e, Health{1, 1});
+    cb.add_component(e, Health{2, 2});
+    cb.add_component(e, Comp8{});
+    cb.remove_component<Comp8>(e);
+    world.flush_commands();
+    ASSERT(world.get_component<Health>(e)->hp == 2);
+
+    // 新規 Entity + despawn で追加がすべて打ち消される
+    Entity temp = cb.spawn();
+    cb.add_component(temp, Position{});
+    cb.add_component(temp, Velocity{});
+    cb.despawn(temp);
+    cb.add_component(e, Comp8{});
+    u32 before = world.entity_count();
+    stats = world.flush_commands();
+    ASSERT(stats.spawned == 1);
+    ASSERT(stats.despawned == 1);
+    ASSERT(stats.discarded == 2);
+    ASSERT(stats.migrations == 1);
+    ASSERT(stats.migrations_saved == 2);
+    ASSERT(world.entity_count() == before);
+    ASSERT(world.has_component<Comp8>(e));
+
+    // 新規 Entity は最終 Archetype に直接入る
+    Entity spawned = cb.spawn();
+    cb.add_component(spawned, Position{7, 0, 0});
+    cb.add_component(spawned, Velocity{});
+    stats = world.flush_commands();
+    ASSERT(stats.migrations == 1);
+    ASSERT((world.cached_query<Position, Velocity>().entity_count() == 2));
+
+    // despawn / 関係の変更は記録位置で適用 (他の Entity への波及が逐次適用と一致する)
+    Entity parent = world.spawn();
+    Entity child = world.spawn();
+    world.add_component(parent, Health{1, 1});
+    cb.remove_component<Health>(parent);
+    cb.add_component(child, ChildOf{parent});
+    cb.despawn(parent);
+    world.flush_commands();
+    ASSERT(!world.alive(parent) && !world.alive(child));   // 連鎖 despawn
+
+    Entity gone = world.spawn();
+    Entity orphan = world.spawn();
+    cb.add_component(orphan, Position{});
+    cb.despawn(gone);
+    cb.add_component(orphan, ChildOf{gone});   // 参照先は既に破棄済み
+    world.flush_commands();
+    ASSERT(world.alive(orphan) && world.has_component<Position>(orphan));
+    ASSERT(!world.target_of<ChildOf>(orphan).valid());
+
+    // 同じバッファで生成した親を参照する関係は正式な Entity へ張り替える
+    Entity parent_tmp = cb.spawn();
+    Entity child_tmp = cb.spawn();
+    cb.add_component(parent_tmp, Position{});
+    cb.add_component(child_tmp, ChildOf{parent_tmp});
+    stats = world.flush_commands();
+    ASSERT(stats.spawned == 2 && stats.discarded == 0);
+    Entity new_child;
+    world.each<const ChildOf>([&](Entity e, const ChildOf&) {
+        if (e != orphan) new_child = e;
+    });
+    Entity new_parent = world.target_of<ChildOf>(new_child);
+    ASSERT(new_parent.valid() && world.has_component<Position>(new_parent));
+    ASSERT(world.get_component<ChildOf>(new_child)->target == new_parent);
+    ASSERT(world.source_count<ChildOf>(new_parent) == 1);
+
+    // 即時の上書きでも同様
+    Entity other_tmp = cb.spawn();
+    cb.set_component(new_child, ChildOf{other_tmp});
+    world.flush_commands();
+    ASSERT(world.target_of<ChildOf>(new_child).valid());
+    ASSERT(world.target_of<ChildOf>(new_child) != new_parent);
+}
+
+TEST(change_ticks_and_filters) {
+    World world;
+    auto spawned = world.spawn_batch<Position, Velocity>(3000);
+    std::vector<Entity> ents(spawned.begin(), spawned.end());
+    auto count_changed = [&] {
+        u32 n = 0;
+        world.query().changed<Position>().each<const Position>([&](const Position&) { ++n; });
+        return n;
+    };
+    ASSERT(count_changed() == 3000);   // 生成直後は全チャンクが追加 / 変更扱い
+
+    world.clear_trackers();
+    ASSERT(count_changed() == 0);
+    // const アクセスでは tick は進まない
+    world.each<const Position, const Velocity>([](const Position&, const Velocity&) {});
+    ASSERT(world.query().changed<Velocity>().execute().empty());
+
+    // 1 行の書き込みでそのチャンクだけが対象になる
+    world.get_component<Position>(ents[2500])->x = 1.0f;
+    Archetype* arch = world.find_archetypes_with({type_id<Position>()}, {})[0];
+    u32 n = 0;
+    bool seen = false;
+    world.query().changed<Position>().each<const Position>([&](Entity e, const Position&) {
+        ++n;
+        seen |= e == ents[2500];
+    });
+    ASSERT(seen);
+    ASSERT(n == arch->chunk_size(2500 / arch->chunk_capacity()));
+    ASSERT(world.query().changed<Velocity>().execute().empty());
+
+    // added は追加されたコンポーネントのみ
+    world.clear_trackers();
+    world.add_component(ents[10], Health{1, 1});
+    u32 added = 0;
+    world.query().added<Health>().each<const Health>([&](const Health&) { ++added; });
+    ASSERT(added == 1);
+    // 移動で持ち越したコンポーネントは追加扱いにならない
+    ASSERT(world.query().added<Position>().execute().empty());
+    ASSERT(world.query().added<Health>().since(world.change_tick()).execute().empty());
+
+    // システムは前回実行以降の変更だけを見る / OnChange トリガー
+    u32 writes = 0, seen_by_reader = 0, triggered = 0;
+    bool write_this_frame = true;
+    world.scheduler().add_system({"writer", {}, {type_id<Position>()}, {}, [&](World& w) {
+        if (!write_this_frame) return;
+        w.get_component<Position>(ents[0])->y += 1.0f;
+        ++writes;
+    }});
+    world.scheduler().add_system({"reader", {type_id<Position>()}, {}, {"writer"}, [&](World& w) {
+        w.query().changed<Position>().each<const Position>([&](const Position&) { ++seen_by_reader; });
+    }});
+    world.scheduler().add_trigger({"on_change", type_id<Health>(), TriggerEvent::OnChange,
+                                   [&](World&, std::span<const Entity> es) {
+                                       triggered += static_cast<u32>(es.size());
+                                   }});
+    world.scheduler().run();        // 初回は全件
+    ASSERT(triggered == 1);
+    seen_by_reader = 0;
+    triggered = 0;
+    world.scheduler().run();
+    u32 first_chunk = arch->chunk_size(0);
+    ASSERT(seen_by_reader == first_chunk);
+    ASSERT(triggered == 0);
+
+    write_this_frame = false;
+    seen_by_reader = 0;
+    world.get_component<Health>(ents[10])->hp = 5;
+    world.scheduler().run();
+    ASSERT(seen_by_reader == 0);
+    ASSERT(triggered == 1);
+}
+
+TEST(change_ticks_cross_32bit_boundary) {
+    // 長時間稼働で tick が 32bit の範囲を超えても比較が逆転しない
+    World world;
+    world.advance_change_tick(0xFFFF'FFFFull - 3);
+    auto spawned = world.spawn_batch<Position, Health>(3000);
+    std::vector<Entity> ents(spawned.begin(), spawned.end());
+    Archetype* arch = world.find_archetypes_with({type_id<Position>()}, {})[0];
+    auto count_changed = [&] {
+        u32 n = 0;
+        world.query().changed<Position>().each<const Position>([&](const Position&) { ++n; });
+        return n;
+    };
+    u32 triggered = 0;
+    world.scheduler().add_trigger({"on_change", type_id<Health>(), TriggerEvent::OnChange,
+                                   [&](World&, std::span<const Entity> es) {
+                                       triggered += static_cast<u32>(es.size());
+                                   }});
+    world.scheduler().run();   // 生成分を消化
+    world.clear_trackers();
+
+    // 境界の直前に書き込み、境界をまたいでから基準を取り直す
+    world.get_component<Position>(ents[0])->x = 1.0f;
+    world.get_component<Health>(ents[0])->hp = 1;
+    ASSERT(count_changed() == arch->chunk_size(0));
+    for (u32 i = 0; i < 8; ++i) world.clear_trackers();
+    ASSERT(world.change_tick() > 0xFFFF'FFFFull);
+    ASSERT(count_changed() == 0);
+    triggered = 0;
+    world.scheduler().run();
+    ASSERT(triggered == arch->chunk_size(0));
+    triggered = 0;
+    world.scheduler().run();
+    ASSERT(triggered == 0);   // 境界前の書き込みで毎フレーム再発火しない
+
+    // 境界を越えた後の書き込みも拾う
+    world.clear_trackers();
+    world.get_component<Position>(ents[2999])->x = 2.0f;
+    world.get_component<Health>(ents[2999])->hp = 2;
+    const u32 last_chunk = arch->chunk_size(2999 / arch->chunk_capacity());
+    ASSERT(count_changed() == last_chunk);
+    world.scheduler().run();
+    ASSERT(triggered == last_chunk);
+}
+
+TEST(observers_dispatch_batched_spans) {
+    World world;
+    u32 add_calls = 0, add_entities = 0, remove_calls = 0, remove_entities = 0;
+    std::vector<Entity> removed;
+    world.scheduler().add_trigger({"health_added", type_id<Health>(), TriggerEvent::OnAdd,
+                                   [&](World& w, std::span<const Entity> es) {
+                                       ++add_calls;
+                                       add_entities += static_cast<u32>(es.size());
+                                       for (Entity e : es) ASSERT(!w.alive(e) || w.has_component<Health>(e));
+                                   }});
+    world.scheduler().add_trigger({"health_removed", type_id<Health>(), TriggerEvent::OnRemove,
+                                   [&](World&, std::span<const Entity> es) {
+                                       ++remove_calls;
+                                       remove_entities += static_cast<u32>(es.size());
+                                       removed.insert(removed.end(), es.begin(), es.end());
+                                   }});
+
+    // CommandBuffer: 1000 件の追加が 1 回のハンドラ呼び出しになる
+    auto spawned = world.spawn_batch<Position>(1000);
+    std::vector<Entity> ents(spawned.begin(), spawned.end());
+    CommandBuffer& cb = world.command_buffer();
+    for (Entity e : ents) cb.add_component(e, Health{10, 10});
+    cb.add_component(ents[0], Velocity{});   // 監視していないコンポーネント
+    world.flush_commands();
+    ASSERT(add_calls == 1);
+    ASSERT(add_entities == 1000);
+
+    // 直接の構造変更はフラッシュまで溜まる
+    world.remove_component<Health>(ents[1]);
+    world.despawn(ents[2]);
+    world.despawn(ents[3]);
+    world.remove_component<Health>(ents[1]);   // 既に持たない → 通知なし
+    ASSERT(remove_calls == 0);
+    world.flush_observers();
+    ASSERT(remove_calls == 1);
+    ASSERT(remove_entities == 3);
+    ASSERT(removed[0] == ents[1]);
+    ASSERT(removed[1] == ents[2]);
+    ASSERT(removed[2] == ents[3]);
+
+    // spawn_batch / 合成適用での追加 + 削除も通知される
+    world.spawn_batch<Health, Velocity>(50);
+    Entity e = ents[10];
+    cb.remove_component<Health>(e);
+    cb.add_component(e, Comp8{});
+    world.flush_commands();
+    ASSERT(add_calls == 2);
+    ASSERT(add_entities == 1050);
+    ASSERT(remove_entities == 4);
+    ASSERT(removed.back() == e);
+
+    // ハンドラ内の構造変更で生じたイベントも同じフラッシュで通知される
+    world.scheduler().add_trigger({"velocity_added", type_id<Velocity>(), TriggerEvent::OnAdd,
+                                   [](World& w, std::span<const Entity> es) {
+                                       std::vector<Entity> copy(es.begin(), es.end());
+                                       for (Entity x : copy) w.add_component(x, Health{1, 1});
+                                   }});
+    Entity fresh = world.spawn();
+    world.add_component(fresh, Velocity{});
+    world.scheduler().run();   // フレーム末で通知
+    ASSERT(world.has_component<Health>(fresh));
+    ASSERT(add_calls == 3);
+    ASSERT(add_entities == 1051);
+
+    // 同じフラッシュ内の削除 → 再追加は移動しないが、逐次適用と同じく両方通知され追加扱いになる
+    Entity reset = ents[20];
+    world.clear_trackers();
+    const u32 adds_before = add_entities, removes_before = remove_entities;
+    cb.remove_component<Health>(reset);
+    cb.add_component(reset, Health{3, 3});
+    const CommandApplyStats st = world.flush_commands();
+    ASSERT(st.migrations == 0);
+    ASSERT(remove_entities == removes_before + 1 && removed.back() == reset);
+    ASSERT(add_entities == adds_before + 1);
+    ASSERT(world.get_component<Health>(reset)->hp == 3);
+    bool readded = false;
+    world.query().added<Health>().each<const Health>([&](Entity x, const Health&) { readded |= x == reset; });
+    ASSERT(readded);
+}
+
+TEST(tag_components_have_no_storage) {
+    static_assert(component_size_v<EnemyTag> == 0);
+    World world;
+    auto plain = world.spawn_batch<Position>(10);
+    auto tagged = world.spawn_batch<Position, EnemyTag>(10, [](u32 i, Position& p, EnemyTag&) {
+        p = {static_cast<f32>(i), 0, 0};
+    });
+    std::vector<Entity> enemies(tagged.begin(), tagged.end());
+    Archetype* a = world.find_archetypes_with({type_id<Position>()}, {type_id<EnemyTag>()})[0];
+    Archetype* b = world.find_archetypes_with({type_id<EnemyTag>()}, {})[0];
+    ASSERT(a != b);
+    ASSERT(a->chunk_capacity() == b->chunk_capacity());   // タグは行サイズに影響しない
+    ASSERT(b->has_component(type_id<EnemyTag>()));
+    (void)plain;
+
+    // 署名によるフィルタ
+    u32 n = 0;
+    f32 sum = 0;
+    world.query().with<EnemyTag>().each<const Position>([&](const Position& p) { ++n; sum += p.x; });
+    ASSERT(n == 10);
+    ASSERT(sum == 45.0f);
+    n = 0;
+    world.query().without<EnemyTag>().each<const Position>([&](const Position&) { ++n; });
+    ASSERT(n == 10);
+    n = 0;
+    world.each<Position, EnemyTag>([&](Position&, EnemyTag&) { ++n; });
+    ASSERT(n == 10);
+
+    // 付け外しでデータ列は保たれる (直接 / CommandBuffer)
+    world.add_component(enemies[3], FrozenTag{});
+    world.add_component(enemies[3], FrozenTag{});   // 既に持つタグは何もしない
+    ASSERT(world.has_component<FrozenTag>(enemies[3]));
+    ASSERT(world.get_component<Position>(enemies[3])->x == 3.0f);
+    world.remove_component<EnemyTag>(enemies[3]);
+    ASSERT(!world.has_component<EnemyTag>(enemies[3]));
+    ASSERT(world.get_component<Position>(enemies[3])->x == 3.0f);
+
+    world.clear_trackers();
+    CommandBuffer& cb = world.command_buffer();
+    cb.add_component(enemies[5], FrozenTag{});
+    cb.remove_component<EnemyTag>(enemies[5]);
+    cb.set_component(enemies[5], Position{50, 0, 0});
+    CommandApplyStats stats = world.flush_commands();
+    ASSERT(stats.migrations == 1);
+    ASSERT(world.has_component<FrozenTag>(enemies[5]));
+    ASSERT(!world.has_component<EnemyTag>(enemies[5]));
+    ASSERT(world.get_component<Position>(enemies[5])->x == 50.0f);
+    ASSERT(world.query().added<FrozenTag>().execute().size() == 1);
+
+    // 全カラムがタグだけの Archetype
+    Entity only_tag = world.spawn();
+    world.add_component(only_tag, EnemyTag{});
+    ASSERT(world.has_component<EnemyTag>(only_tag));
+    world.despawn(only_tag);
+    ASSERT(!world.alive(only_tag));
+}
+
+TEST(sparse_set_storage_and_mixed_queries) {
+    World world;
+    world.set_storage<Stunned>(StorageKind::SparseSet);
+    world.set_storage<FrozenTag>(StorageKind::SparseSet);
+    ASSERT(world.is_sparse(component_index<Stunned>()));
+
+    auto spawned = world.spawn_batch<Position, Velocity>(5000, [](u32 i, Position& p, Velocity&) {
+        p = {static_cast<f32>(i), 0, 0};
+    });
+    std::vector<Entity> ents(spawned.begin(), spawned.end());
+    const u32 archetypes = world.archetype_count();
+    Archetype* arch = world.find_archetypes_with({type_id<Position>()}, {})[0];
+    const u32 row = 1234;   // ents[1234] の行
+
+    // 付け外しで Archetype も行も変わらない
+    for (u32 i = 0; i < 5000; i += 10) world.add_component(ents[i], Stunned{static_cast<f32>(i)});
+    ASSERT(world.archetype_count() == archetypes);
+    ASSERT(arch->entity(row) == ents[1234]);
+    ASSERT(world.has_component<Stunned>(ents[1230]));
+    ASSERT(!world.has_component<Stunned>(ents[1231]));
+    ASSERT(world.get_component<Stunned>(ents[1230])->remaining == 1230.0f);
+    world.remove_component<Stunned>(ents[1230]);
+    ASSERT(!world.has_component<Stunned>(ents[1230]));
+    ASSERT(world.sparse_set(component_index<Stunned>())->size() == 499);
+
+    // 疎集合を起点にした混在クエリ
+    u32 n = 0;
+    world.each<Position, Stunned>([&](Entity e, Position& p, Stunned& s) {
+        ASSERT(p.x == s.remaining);
+        ASSERT(e.index() == ents[static_cast<u32>(p.x)].index());
+        ++n;
+        s.remaining -= 1.0f;
+    });
+    ASSERT(n == 499);
+    ASSERT(world.get_component<Stunned>(ents[10])->remaining == 9.0f);
+
+    // 疎集合の除外 / 2 つの疎集合の組み合わせ
+    world.add_component(ents[20], FrozenTag{});
+    world.add_component(ents[21], FrozenTag{});
+    n = 0;
+    world.query().without<Stunned>().each<const Position>([&](const Position&) { ++n; });
+    ASSERT(n == 5000 - 499);
+    n = 0;
+    world.query().with<FrozenTag>().each<const Stunned>([&](const Stunned&) { ++n; });
+    ASSERT(n == 1);
+    n = 0;
+    world.query().with<Stunned>().without<FrozenTag>().for_each<Position>([&](Entity, Position&) { ++n; });
+    ASSERT(n == 498);
+
+    // キャッシュ済みクエリ / par_each + CommandBuffer
+    Query stunned = world.query().with<Position, Stunned>().cached();
+    n = 0;
+    stunned.each<const Stunned>([&](const Stunned&) { ++n; });
+    ASSERT(n == 499);
+    world.par_each<const Stunned>([](CommandBuffer& cb, Entity e, const Stunned& s) {
+        if (s.remaining < 100.0f) cb.remove_component<Stunned>(e);
+    });
+    CommandApplyStats stats = world.flush_commands();
+    ASSERT(stats.migrations == 0);
+    ASSERT(world.sparse_set(component_index<Stunned>())->size() == 488);
+
+    // 合成適用 (Archetype 側と疎集合側を同時に変更)
+    CommandBuffer& cb = world.command_buffer();
+    cb.add_component(ents[3], Stunned{7});
+    cb.add_component(ents[3], Health{1, 1});
+    stats = world.flush_commands();
+    ASSERT(stats.migrations == 1);
+    ASSERT(world.get_component<Stunned>(ents[3])->remaining == 7.0f);
+    ASSERT(world.has_component<Health>(ents[3]));
+
+    // 疎集合のみの Entity / despawn で疎集合からも外れる
+    Entity loose = world.spawn();
+    world.add_component(loose, Stunned{1});
+    n = 0;
+    world.query().with<Stunned>().without<Position>().each<Stunned>([&](Stunned&) { ++n; });
+    ASSERT(n == 1);
+    world.despawn(loose);
+    world.despawn(ents[20]);
+    ASSERT(world.sparse_set(component_index<Stunned>())->size() == 489);
+    ASSERT(world.sparse_set(component_index<FrozenTag>())->size() == 1);
+
+    // 使用後の格納方式変更は無視される
+    world.set_storage<Position>(StorageKind::SparseSet);
+    ASSERT(!world.is_sparse(component_index<Position>()));
+}
+
+TEST(sparse_set_change_ticks) {
+    World world;
+    world.set_storage<Stunned>(StorageKind::SparseSet);
+    auto spawned = world.spawn_batch<Position>(1000);
+    std::vector<Entity> ents(spawned.begin(), spawned.end());
+    for (u32 i = 0; i < 1000; i += 4) world.add_component(ents[i], Stunned{1});
+    auto count = [&](QueryBuilder q) {
+        u32 n = 0;
+        q.each<const Stunned>([&](const Stunned&) { ++n; });
+        return n;
+    };
+    ASSERT(count(world.query().added<Stunned>()) == 250);
+    world.clear_trackers();
+    ASSERT(count(world.query().changed<Stunned>()) == 0);
+    ASSERT(count(world.query().added<Stunned>()) == 0);
+
+    // 疎集合は要素単位で追跡する (同じチャンクの隣も拾わない)
+    world.get_component<Stunned>(ents[8])->remaining = 2;
+    world.add_component(ents[9], Stunned{3});
+    ASSERT(count(world.query().changed<Stunned>()) == 2);
+    ASSERT(count(world.query().added<Stunned>()) == 1);
+    ASSERT(count(world.query().changed<Stunned>().with<Position>()) == 2);
+    ASSERT(world.query().changed<Position>().execute().empty());
+
+    // each の非 const 項も要素ごとに刻む
+    world.clear_trackers();
+    world.query().with<Position>().each<Stunned>([](Entity e, Stunned& s) {
+        if (e.index() % 100 == 0) s.remaining = 0;
+    });
+    ASSERT(count(world.query().changed<Stunned>()) == 251);
+    world.clear_trackers();
+    JobSystem js(JobSystemDesc{.worker_count = 2});
+    world.query().changed<Stunned>().par_each<Stunned>([](Stunned&) {}, js);
+    ASSERT(count(world.query().changed<Stunned>()) == 0);
+    world.par_each<Position, Stunned>([](Position&, Stunned&) {}, js);
+    ASSERT(count(world.query().changed<Stunned>()) == 251);
+
+    // 疎集合起点の par_each は Entity の属するチャンクだけを刻み、changed フィルタも守る
+    {
+        World big;
+        big.set_storage<Stunned>(StorageKind::SparseSet);
+        auto many = big.spawn_batch<Position>(20000);
+        Entity lone = many[12345];
+        big.add_component(lone, Stunned{1});
+        big.clear_trackers();
+        auto changed_positions = [&] {
+            u32 n = 0;
+            big.query().changed<Position>().each<const Position>([&](const Position&) { ++n; });
+            return n;
+        };
+        u32 visited = 0;
+        big.query().changed<Position>().par_each<Position, const Stunned>(
+            [&](Position&, const Stunned&) { ++visited; }, js);
+        ASSERT(visited == 0 && changed_positions() == 0);
+        big.par_each<Position, const Stunned>([](Position& p, const Stunned&) { p.x = 1.0f; }, js);
+        Archetype* arch = big.find_archetypes_with({type_id<Position>()}, {})[0];
+        ASSERT(changed_positions() == arch->chunk_size(12345 / arch->chunk_capacity()));
+    }
+
+    // OnChange トリガー
+    u32 triggered = 0;
+    world.scheduler().add_trigger({"on_stunned", type_id<Stunned>(), TriggerEvent::OnChange,
+                                   [&](World&, std::span<const Entity> es) {
+                                       triggered += static_cast<u32>(es.size());
+                                   }});
+    world.scheduler().run();
+    ASSERT(triggered == 251);
+    triggered = 0;
+    world.scheduler().run();
+    ASSERT(triggered == 0);
+    world.get_component<Stunned>(ents[40])->remaining = 5;
+    world.scheduler().run();
+    ASSERT(triggered == 1);
+}
+
+TEST(relations_child_of_index) {
+    World world;
+    world.register_relation<Targets>();   // 既定の後始末は Remove
+
+    Entity root = world.spawn();
+    Entity a = world.spawn();
+    Entity b = world.spawn();
+    world.add_component(root, Position{0, 0, 0});
+    auto kids = world.spawn_batch<Position, ChildOf>(100, [&](u32 i, Position& p, ChildOf& c) {
+        p = {static_cast<f32>(i), 0, 0};
+        c.target = i % 2 ? a : b;
+    });
+    std::vector<Entity> ents(kids.begin(), kids.end());
+    world.add_relation<ChildOf>(a, root);
+    world.add_relation<ChildOf>(b, root);
+
+    // 参照元の列挙と件数
+    ASSERT(world.source_count<ChildOf>(root) == 2);
+    ASSERT(world.source_count<ChildOf>(a) == 50);
+    ASSERT(world.target_of<ChildOf>(ents[1]) == a);
+    u32 n = 0;
+    world.each_source<ChildOf>(a, [&](Entity e) { ASSERT(world.target_of<ChildOf>(e) == a); ++n; });
+    ASSERT(n == 50);
+
+    // 上書き / 削除で索引が追従する
+    world.add_component(ents[1], ChildOf{b});
+    ASSERT(world.source_count<ChildOf>(a) == 49 && world.source_count<ChildOf>(b) == 51);
+    world.remove_relation<ChildOf>(ents[3]);
+    ASSERT(world.source_count<ChildOf>(a) == 48);
+    ASSERT(!world.target_of<ChildOf>(ents[3]).valid());
+
+    // CommandBuffer 経由 (追加後に同じ Entity で上書き)
+    CommandBuffer& cb = world.command_buffer();
+    cb.add_component(ents[3], ChildOf{b});
+    cb.set_component(ents[3], ChildOf{a});
+    cb.add_component(ents[5], ChildOf{b});
+    world.flush_commands();
+    ASSERT(world.target_of<ChildOf>(ents[3]) == a);
+    ASSERT(world.target_of<ChildOf>(ents[5]) == b);
+    ASSERT(world.source_count<ChildOf>(a) == 48 && world.source_count<ChildOf>(b) == 52);
+
+    // targeting: 参照元だけを走査 (他の条件と併用)
+    n = 0;
+    world.query().targeting<ChildOf>(a).each<Position>([&](Entity e, Position&) {
+        ASSERT(world.target_of<ChildOf>(e) == a);
+        ++n;
+    });
+    ASSERT(n == 48);
+    world.add_component(ents[7], EnemyTag{});
+    n = 0;
+    world.query().targeting<ChildOf>(a).with<EnemyTag>().each<const Position>([&](const Position& p) {
+        ASSERT(p.x == 7.0f);
+        ++n;
+    });
+    ASSERT(n == 1);
+    std::atomic<u32> par{0};
+    world.query().targeting<ChildOf>(b).par_each<Position>([&](Position&) { par.fetch_add(1); });
+    ASSERT(par.load() == 52);
+
+    // Remove 後始末: 参照先の despawn で関係だけ外れる
+    Entity enemy = world.spawn();
+    world.add_relation<Targets>(ents[0], enemy);
+    world.add_relation<Targets>(ents[2], enemy);
+    ASSERT(world.source_count<Targets>(enemy) == 2);
+    world.despawn(enemy);
+    ASSERT(world.alive(ents[0]) && !world.has_component<Targets>(ents[0]));
+
+    // Despawn 後始末: 親の despawn で子孫ごと消える
+    const u32 before = world.entity_count();
+    world.despawn(a);
+    ASSERT(!world.alive(ents[7]) && world.alive(ents[0]));
+    ASSERT(world.entity_count() == before - 49);
+    ASSERT(world.source_count<ChildOf>(root) == 1);
+    world.despawn(root);
+    ASSERT(world.entity_count() == 0);
+
+    // 生存していない参照先には張らない / 再利用 index に古い子が残らない
+    Entity p = world.spawn();
+    Entity c = world.spawn();
+    world.despawn(p);
+    world.add_relation<ChildOf>(c, p);
+    ASSERT(!world.target_of<ChildOf>(c).valid());
+    Entity reused = world.spawn();
+    ASSERT(reused.index() == p.index() && world.source_count<ChildOf>(reused) == 0);
+
+    // 循環した ChildOf も despawn で終わる (各 Entity は 1 回だけ片付く)
+    world.despawn(reused);
+    world.despawn(c);
+    Entity x = world.spawn();
+    Entity y = world.spawn();
+    Entity z = world.spawn();
+    world.add_relation<ChildOf>(x, y);
+    world.add_relation<ChildOf>(y, z);
+    world.add_relation<ChildOf>(z, x);
+    world.despawn(x);
+    ASSERT(world.entity_count() == 0);
+
+    // 深い階層も再帰せずに片付く
+    Entity top = world.spawn();
+    Entity last = top;
+    for (u32 i = 0; i < 200000; ++i) {
+        Entity next = world.spawn();
+        world.add_relation<ChildOf>(next, last);
+        last = next;
+    }
+    world.despawn(top);
+    ASSERT(world.entity_count() == 0 && !world.alive(last));
+    Entity fresh = world.spawn();
+    ASSERT(world.source_count<ChildOf>(fresh) == 0);
+}
+
+TEST(child_of_cleanup_can_detach_instead_of_despawn) {
+    // 既定では親の despawn で部分木ごと消える
+    World cascading;
+    Entity parent = cascading.spawn();
+    Entity child = cascading.spawn();
+    Entity grandchild = cascading.spawn();
+    cascading.add_relation<ChildOf>(child, parent);
+    cascading.add_relation<ChildOf>(grandchild, child);
+    cascading.despawn(parent);
+    ASSERT(!cascading.alive(child) && !cascading.alive(grandchild));
+
+    // Remove に切り替えると従来どおり子は残り、親子関係だけが外れる
+    World world;
+    world.register_relation<ChildOf>(RelationCleanup::Remove);
+    scene::SceneGraph graph{world};
+    Entity root = graph.add_node(world.spawn(), "root");
+    Entity arm  = graph.add_node(world.spawn(), "arm", root);
+    Entity hand = graph.add_node(world.spawn(), "hand", arm);
+    world.despawn(root);
+    ASSERT(world.alive(arm) && world.alive(hand));
+    ASSERT(!world.has_component<ChildOf>(arm) && world.target_of<ChildOf>(hand) == arm);
+    ASSERT(graph.roots().size() == 1 && graph.roots()[0] == arm);
+
+    // 切り替えは以降の despawn に効き、索引は保たれる
+    world.register_relation<ChildOf>(RelationCleanup::Despawn);
+    ASSERT(world.source_count<ChildOf>(arm) == 1);
+    world.despawn(arm);
+    ASSERT(!world.alive(hand));
+}
+
+TEST(scene_graph_on_child_of) {
+    World world;
+    scene::SceneGraph graph{world};
+    Entity root = graph.add_node(world.spawn(), "root");
+    Entity arm  = graph.add_node(world.spawn(), "arm", root);
+    Entity hand = graph.add_node(world.spawn(), "hand", arm);
+    Entity other = graph.add_node(world.spawn(), "other");
+
+    ASSERT(graph.node_count() == 4);
+    ASSERT(graph.roots().size() == 2);
+    ASSERT(graph.parent(hand) == arm && graph.child_count(root) == 1);
+    ASSERT(graph.find_by_name("hand") == hand && graph.name(arm) == "arm");
+
+    std::vector<u32> depths;
+    graph.traverse(root, [&](Entity, u32 depth) { depths.push_back(depth); });
+    ASSERT((depths == std::vector<u32>{0, 1, 2}));
+
+    // 循環する付け替えは無視
+    graph.reparent(root, hand);
+    ASSERT(!graph.parent(root).valid());
+    graph.reparent(arm, other);
+    ASSERT(graph.child_count(root) == 0 && graph.child_count(other) == 1);
+
+    // グラフから外しても Entity は残る
+    graph.remove_node(arm);
+    ASSERT(graph.node_count() == 2 && world.alive(hand) && !graph.contains(hand));
+    ASSERT(graph.roots().size() == 2);
+    ASSERT(graph.find(root) && graph.find(root)->active && !graph.find(hand));
+
+    // 同名ノードが消えたら残りの同名ノードが見つかる
+    Entity hand2 = graph.add_node(world.spawn(), "hand", root);
+    ASSERT(graph.find_by_name("hand") == hand2);
+    Entity hand3 = graph.add_node(world.spawn(), "hand", other);
+    ASSERT(graph.find_by_name("hand") == hand2);
+    world.despawn(root);   // 子孫ごと消える
+    ASSERT(graph.find_by_name("hand") == hand3);
+    ASSERT(graph.node_count() == 2 && !graph.find_by_name("root").valid());
+
+    // 深い階層の削除も再帰しない
+    Entity top = graph.add_node(world.spawn(), "top");
+    Entity tip = top;
+    for (u32 i = 0; i < 100000; ++i) tip = graph.add_node(world.spawn(), "", tip);
+    graph.remove_node(top);
+    ASSERT(graph.node_count() == 2 && !graph.contains(tip) && !graph.parent(tip).valid());
+}
+
+TEST(compact_after_mass_despawn) {
+    World world;
+    auto movers = world.spawn_batch<Position, Velocity>(20000, [](u32 i, Position& p, Velocity&) {
+        p = {static_cast<f32>(i), 0, 0};
+    });
+    std::vector<Entity> ents(movers.begin(), movers.end());
+    auto wave = world.spawn_batch<Position, Health>(20000);
+    std::vector<Entity> enemies(wave.begin(), wave.end());
+    Query cached = world.query().with<Position>().cached();
+    ASSERT(cached.archetypes().size() == 2);
+
+    // CommandBuffer の合成移動で移動辺キャッシュにも Health 側を載せる
+    CommandBuffer& cb = world.command_buffer();
+    cb.add_component(ents[0], Health{1, 1});
+    cb.add_component(ents[0], EnemyTag{});
+    world.flush_commands();
+    cb.remove_component<Health>(ents[0]);
+    cb.remove_component<EnemyTag>(ents[0]);
+    world.flush_commands();
+
+    for (Entity e : enemies) world.despawn(e);
+    for (u32 i = 0; i < 20000; i += 2) world.despawn(ents[i]);
+    const usize reserved = world.chunk_pool().bytes_reserved();
+    const u32 archetypes = world.archetype_count();
+
+    // 予算 0 でも 1 回に 1 Archetype ずつ進む
+    CompactStats total;
+    u32 calls = 0;
+    for (CompactStats st; !st.done; ++calls) {
+        st = world.compact(0.0, {.sort_rows = true});
+        total.bytes_reclaimed += st.bytes_reclaimed;
+        total.archetypes_freed += st.archetypes_freed;
+        total.archetypes_sorted += st.archetypes_sorted;
+        ASSERT(st.archetypes_visited <= 1);
+    }
+    ASSERT(calls >= archetypes);
+    ASSERT(world.archetype_count() == 1);
+    ASSERT(total.archetypes_freed == archetypes - 1);
+    ASSERT(cached.archetypes().size() == 1);
+    ASSERT(world.chunk_pool().chunks_free() == 0);
+    ASSERT(world.chunk_pool().bytes_reserved() < reserved);
+    ASSERT(total.bytes_reclaimed >= reserved - world.chunk_pool().bytes_reserved());
+
+    // 並べ替え後も行と値が一致する
+    ASSERT(total.archetypes_sorted == 1);
+    Archetype* arch = cached.archetypes()[0];
+    for (u32 row = 1; row < arch->count(); ++row) ASSERT(arch->entity(row - 1).index() < arch->entity(row).index());
+    for (u32 i = 1; i < 20000; i += 2) ASSERT(world.get_component<Position>(ents[i])->x == static_cast<f32>(i));
+
+    // 破棄した Archetype への遷移は作り直される
+    world.add_component(ents[1], Health{5, 5});
+    ASSERT(world.get_component<Health>(ents[1])->hp == 5);
+    cb.add_component(ents[3], Health{7, 7});
+    cb.add_component(ents[3], EnemyTag{});
+    world.flush_commands();
+    ASSERT(world.has_component<EnemyTag>(ents[3]) && world.get_component<Health>(ents[3])->hp == 7);
+    ASSERT(cached.entity_count() == 10000);
+
+    // 空き番号は小さい index から再利用される
+    Entity reused = world.spawn();
+    ASSERT(reused.index() == ents[0].index());
+}
+
+TEST(compact_resumes_across_structural_changes) {
+    World world;
+    auto spawned = world.spawn_batch<Position>(30000, [](u32 i, Position& p) { p = {static_cast<f32>(i), 0, 0}; });
+    std::vector<Entity> live(spawned.begin(), spawned.end());
+    for (u32 i = 0; i < 30000; i += 2) world.despawn(live[i]);
+    std::erase_if(live, [&](Entity e) { return !world.alive(e); });
+    auto check = [&](Entity e) { return world.get_component<Position>(e)->x == static_cast<f32>(e.index() - 1); };
+    // 並べ替えを引き起こすため、空き番号を使って行順を崩す
+    for (u32 i = 0; i < 100; ++i) {
+        Entity e = world.spawn();
+        world.add_component(e, Position{static_cast<f32>(e.index() - 1), 0, 0});
+        live.push_back(e);
+    }
+
+    // 予算 0 で 1 単位ずつ進めながら、呼び出しの間に spawn / despawn を挟む
+    u32 calls = 0;
+    for (CompactStats st; !st.done; ++calls) {
+        st = world.compact(0.0, {.sort_rows = true});
+        for (u32 k = 0; k < 3; ++k) {
+            Entity e = world.spawn();
+            world.add_component(e, Position{static_cast<f32>(e.index() - 1), 0, 0});
+            live.push_back(e);
+        }
+        for (u32 k = 0; k < 2; ++k) {
+            const usize pick = (calls * 7919u + k * 104729u) % live.size();
+            world.despawn(live[pick]);
+            live[pick] = live.back();
+            live.pop_back();
+        }
+    }
+    ASSERT(calls > 10);
+    ASSERT(world.entity_count() == live.size());
+    for (Entity e : live) ASSERT(world.alive(e) && check(e));
+
+    // 突き合わせ後の空き番号は重複も生存中の index も含まない
+    std::vector<u8> bytes;
+    ASSERT(world.save_snapshot(bytes).has_value());
+    World loaded;
+    ASSERT(loaded.load_snapshot(bytes).has_value());
+    std::vector<u32> indices;
+    for (u32 i = 0; i < 20000; ++i) indices.push_back(world.spawn().index());
+    std::sort(indices.begin(), indices.end());
+    ASSERT(std::adjacent_find(indices.begin(), indices.end()) == indices.end());
+    for (Entity e : live) ASSERT(world.alive(e) && check(e));
+}
+
+TEST(snapshot_round_trip) {
+    World world;
+    world.set_storage<Stunned>(StorageKind::SparseSet);
+    auto spawned = world.spawn_batch<Position, Velocity>(3000, [](u32 i, Position& p, Velocity& v) {
+        p = {static_cast<f32>(i), 1, 2};
+        v = {0, static_cast<f32>(i), 0};
+    });
+    std::vector<Entity> ents(spawned.begin(), spawned.end());
+    for (u32 i = 0; i < 3000; i += 7) {
+        world.add_component(ents[i], Health{static_cast<i32>(i), 100});
+        world.add_component(ents[i], EnemyTag{});
+    }
+    for (u32 i = 0; i < 3000; i += 11) world.add_component(ents[i], Stunned{static_cast<f32>(i)});
+    for (u32 i = 1; i < 10; ++i) world.add_relation<ChildOf>(ents[i], ents[0]);
+    Entity bare = world.spawn();
+    for (u32 i = 2000; i < 2500; ++i) world.despawn(ents[i]);
+
+    std::vector<u8> bytes;
+    ASSERT(world.save_snapshot(bytes).has_value());
+
+    World loaded;
+    ASSERT(loaded.load_snapshot(bytes).has_value());
+    ASSERT(loaded.entity_count() == world.entity_count());
+    ASSERT(loaded.alive(bare) && !loaded.alive(ents[2000]));
+    ASSERT(loaded.is_sparse(component_index<Stunned>()));
+    for (u32 i = 0; i < 3000; ++i) {
+        if (i >= 2000 && i < 2500) continue;
+        const Position* p = loaded.get_component<Position>(ents[i]);
+        ASSERT(p && p->x == static_cast<f32>(i) && p->z == 2.0f);
+        ASSERT(loaded.get_component<Velocity>(ents[i])->vy == static_cast<f32>(i));
+        ASSERT(loaded.has_component<EnemyTag>(ents[i]) == (i % 7 == 0));
+        if (i % 7 == 0) ASSERT(loaded.get_component<Health>(ents[i])->hp == static_cast<i32>(i));
+        if (i % 11 == 0) ASSERT(loaded.get_component<Stunned>(ents[i])->remaining == static_cast<f32>(i));
+        else             ASSERT(!loaded.has_component<Stunned>(ents[i]));
+    }
+    // 関係の索引と空き番号の順序も復元される
+    ASSERT(loaded.source_count<ChildOf>(ents[0]) == 9);
+    ASSERT(loaded.target_of<ChildOf>(ents[5]) == ents[0]);
+    ASSERT(loaded.spawn() == world.spawn());
+
+    // 読み込んだ行は追加扱い
+    u32 n = 0;
+    loaded.query().added<Health>().each<const Health>([&](const Health&) { ++n; });
+    ASSERT(n == 357);
+
+    // ファイル経由
+    const std::string path = "/tmp/engine_test_snapshot.bin";
+    ASSERT(world.save_snapshot(path).has_value());
+    World from_file;
+    ASSERT(from_file.load_snapshot(path).has_value());
+    ASSERT(from_file.get_component<Position>(ents[2999])->x == 2999.0f);
+    std::remove(path.c_str());
+
+    // 失敗: 空でない World / 壊れたデータ / 未登録の型
+    auto busy = loaded.load_snapshot(bytes);
+    ASSERT(!busy && busy.error() == Error::InvalidState);
+    World truncated;
+    auto cut = truncated.load_snapshot(std::span<const u8>(bytes.data(), bytes.size() / 2));
+    ASSERT(!cut && cut.error() == Error::CorruptedData);
+    world.add_component(ents[1], Comp8{});
+    std::vector<u8> rejected;
+    auto unknown = world.save_snapshot(rejected);
+    ASSERT(!unknown && unknown.error() == Error::NotFound);
+}
+
+TEST(snapshot_failed_load_leaves_world_empty) {
+    std::vector<u8> bytes;
+    {
+        World world;
+        world.set_storage<Stunned>(StorageKind::SparseSet);
+        auto spawned = world.spawn_batch<Position>(5000, [](u32 i, Position& p) { p = {static_cast<f32>(i), 0, 0}; });
+        std::vector<Entity> ents(spawned.begin(), spawned.end());
+        for (u32 i = 0; i < 5000; i += 2) world.add_component(ents[i], Velocity{});
+        for (u32 i = 0; i < 5000; i += 3) world.add_component(ents[i], Stunned{1});
+        ASSERT(world.save_snapshot(bytes).has_value());
+    }
+    // 末尾の Archetype の途中で切り、ヘッダのサイズも合わせる (先頭の Archetype までは正しい)
+    std::vector<u8> cut(bytes.begin(), bytes.begin() + static_cast<std::ptrdiff_t>(bytes.size() - 4096));
+    reinterpret_cast<SnapshotHeader*>(cut.data())->file_bytes = cut.size();
+    const std::string path = "/tmp/engine_test_snapshot_cut.bin";
+    FILE* f = std::fopen(path.c_str(), "wb");
+    ASSERT(f && std::fwrite(cut.data(), 1, cut.size(), f) == cut.size());
+    std::fclose(f);
+
+    auto unchanged = [](const World& w) {
+        return w.entity_count() == 0 && w.archetype_count() == World{}.archetype_count() &&
+               w.chunk_pool().chunks_in_use() == 0 && !w.is_sparse(component_index<Stunned>());
+    };
+    World world;
+    auto copied = world.load_snapshot(cut);
+    ASSERT(!copied && copied.error() == Error::CorruptedData);
+    ASSERT(unchanged(world));
+    auto from_file = world.load_snapshot(path);
+    ASSERT(!from_file && from_file.error() == Error::CorruptedData);
+    ASSERT(unchanged(world));
+    ASSERT(world.load_snapshot(bytes).has_value() && world.entity_count() == 5000);
+
+    // 写像の失敗も World を空のまま残し、写像は解除される
+    World mapped;
+    auto bad = mapped.map_snapshot(path);
+    ASSERT(!bad && bad.error() == Error::CorruptedData);
+    ASSERT(unchanged(mapped));
+    f = std::fopen(path.c_str(), "wb");
+    ASSERT(f && std::fwrite(bytes.data(), 1, bytes.size(), f) == bytes.size());
+    std::fclose(f);
+    ASSERT(mapped.map_snapshot(path).has_value() && mapped.entity_count() == 5000);
+    std::remove(path.c_str());
+}
+
+TEST(snapshot_scene_graph_round_trip) {
+    World world;
+    scene::SceneGraph graph{world};
+    Entity root = graph.add_node(world.spawn(), "ルート");
+    Entity arm  = graph.add_node(world.spawn(), "arm", root);
+    Entity hand = graph.add_node(world.spawn(), "hand", arm);
+    Entity anon = graph.add_node(world.spawn(), "", root);
+    graph.find(arm)->active = false;
+    // 長い名前も切り詰めず、先頭が同じ名前とも区別する
+    std::string long_name;
+    for (u32 i = 0; i < 100; ++i) long_name += "名";
+    Entity wide  = graph.add_node(world.spawn(), long_name);
+    Entity wide2 = graph.add_node(world.spawn(), long_name + "2");
+    ASSERT(graph.name(wide) == long_name && graph.find_by_name(long_name) == wide);
+    ASSERT(graph.find_by_name(long_name + "2") == wide2);
+    ASSERT(!graph.find_by_name(long_name.substr(0, 63)).valid());
+
+    std::vector<u8> bytes;
+    ASSERT(world.save_snapshot(bytes).has_value());
+    auto net = network::create_net_system();
+    ASSERT(!net->take_snapshot(1, world).state_data.empty());
+
+    // 読み込み前に作ったグラフも、後から作ったグラフも同じ内容を引ける
+    World loaded;
+    scene::SceneGraph early{loaded};
+    ASSERT(loaded.load_snapshot(bytes).has_value());
+    scene::SceneGraph late{loaded};
+    for (scene::SceneGraph* g : {&early, &late}) {
+        ASSERT(g->node_count() == 6 && g->roots().size() == 3);
+        ASSERT(g->find_by_name("ルート") == root && g->name(hand) == "hand");
+        ASSERT(g->parent(hand) == arm && g->child_count(root) == 2);
+        ASSERT(g->contains(anon) && g->name(anon).empty());
+        ASSERT(!g->find(arm)->active && g->find(hand)->active);
+        ASSERT(g->name(wide) == long_name && g->find_by_name(long_name + "2") == wide2);
+    }
+}
+
+TEST(snapshot_map_in_place) {
+    const std::string path = "/tmp/engine_test_snapshot_map.bin";
+    std::vector<Entity> ents;
+    {
+        World world;
+        auto spawned = world.spawn_batch<Position, Velocity>(2000, [](u32 i, Position& p, Velocity& v) {
+            p = {static_cast<f32>(i), 0, 0};
+            v = {1, 1, 1};
+        });
+        ents.assign(spawned.begin(), spawned.end());
+        for (u32 i = 0; i < 2000; i += 3) world.add_component(ents[i], EnemyTag{});
+        world.add_relation<ChildOf>(ents[1], ents[0]);
+        ASSERT(world.save_snapshot(path).has_value());
+    }
+
+    World mapped;
+    ASSERT(mapped.map_snapshot(path).has_value());
+    ASSERT(mapped.entity_count() == 2000);
+    ASSERT(mapped.chunk_pool().chunks_in_use() == 0);   // 全チャンクが写像のまま
+    ASSERT(mapped.get_component<Position>(ents[1234])->x == 1234.0f);
+    ASSERT(mapped.has_component<EnemyTag>(ents[3]) && !mapped.has_component<EnemyTag>(ents[4]));
+    ASSERT(mapped.target_of<ChildOf>(ents[1]) == ents[0]);
+
+    // 書き込みは私的な複製に入り、ファイルと他の写像には見えない
+    mapped.get_component<Position>(ents[5])->x = -1.0f;
+    World other;
+    ASSERT(other.map_snapshot(path).has_value());
+    ASSERT(other.get_component<Position>(ents[5])->x == 5.0f);
+    ASSERT(mapped.get_component<Position>(ents[5])->x == -1.0f);
+
+    // 構造変更: 写像チャンクからの移動 / swap-remove / 追加 / compact
+    for (u32 i = 0; i < 2000; i += 2) mapped.add_component(ents[i], Health{static_cast<i32>(i), 1});
+    for (u32 i = 1; i < 1500; i += 2) mapped.despawn(ents[i]);
+    Entity fresh = mapped.spawn();
+    mapped.add_component(fresh, Position{7, 7, 7});
+    mapped.add_component(fresh, Velocity{});
+    CompactStats st;
+    while (!st.done) st = mapped.compact(1000.0, {.sort_rows = true});
+    ASSERT(mapped.entity_count() == 2000 - 750 + 1);
+    ASSERT(mapped.get_component<Health>(ents[1000])->hp == 1000);
+    ASSERT(mapped.get_component<Position>(ents[1999])->x == 1999.0f);
+    ASSERT(mapped.get_component<Position>(fresh)->x == 7.0f);
+    ASSERT(!mapped.alive(ents[1]) && mapped.alive(ents[1501]));
+
+    // 失敗: 空でない World / 存在しないファイル
+    auto busy = mapped.map_snapshot(path);
+    ASSERT(!busy && busy.error() == Error::InvalidState);
+    World missing;
+    auto none = missing.map_snapshot("/tmp/engine_test_snapshot_missing.bin");
+    ASSERT(!none && none.error() == Error::IOError);
+    std::remove(path.c_str());
+}
+
 // ── メイン ──────────────────────────────────────────────
 
 int main() {
@@ -0,0 +1,312 @@
+/**
+ * tests/test_task_graph.cpp — JobSystem / TaskGraph ユニットテスト
+ */
+#include <engine/core/types.hpp>
+#include <engine/core/task_graph.hpp>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace engine;
+
+// ── ヒープ確保カウンタ (ゼロアロケーション検証用) ──────
+static std::atomic<u64> g_alloc_count{0};
+
+void* operator new(std::size_t size) {
+    g_alloc_count.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc{};
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+#define TEST(name) \
+    static void test_##name(); \
+    struct TestRunner_##name { TestRunner_##name() { \
+        printf("  テスト: %s ... ", #name); \
+        try { test_##name(); printf("OK\n"); tests_passed++; } \
+        catch (...) { printf("FAIL\n"); tests_failed++; } \
+    }} runner_##name; \
+    static void test_##name()
+
+#define ASSERT(cond) do { if (!(cond)) { \
+    printf("ASSERT FAILED: %s (line %d)\n", #cond, __LINE__); \
+    throw 1; \
+}} while(0)
+
+// ── テスト ──────────────────────────────────────────────
+
+TEST(deque_owner_lifo_thief_fifo) {
+    WorkStealingDeque<int> dq(2);   // 拡張パスも通す
+    int items[8];
+    for (auto& i : items) dq.push(&i);
+    ASSERT(dq.size_approx() == 8);
+    ASSERT(dq.pop() == &items[7]);
+    ASSERT(dq.steal() == &items[0]);
+    ASSERT(dq.size_approx() == 6);
+    for (int k = 0; k < 6; ++k) ASSERT(dq.pop() != nullptr);
+    ASSERT(dq.pop() == nullptr);
+    ASSERT(dq.steal() == nullptr);
+}
+
+TEST(job_system_runs_all_jobs) {
+    JobSystem js(4);
+    constexpr u32 N = 10000;
+    std::vector<Job> jobs(N);
+    std::atomic<u32> counter{0};
+    for (auto& j : jobs) {
+        j.func = [&] { counter.fetch_add(1, std::memory_order_relaxed); };
+        js.submit(&j);
+    }
+    js.wait_all();
+    ASSERT(counter.load() == N);
+}
+
+TEST(job_system_nested_submit) {
+    // ワーカー内からの submit はローカルデックへ積まれ、他ワーカーに盗まれる
+    JobSystem js(4);
+    constexpr u32 N = (1u << 12) - 1;
+    std::vector<Job> jobs(N);
+    std::atomic<u32> counter{0};
+    for (u32 i = 0; i < N; ++i) {
+        jobs[i].func = [&, i] {
+            counter.fetch_add(1, std::memory_order_relaxed);
+            u32 l = 2 * i + 1, r = 2 * i + 2;
+            if (l < N) js.submit(&jobs[l]);
+            if (r < N) js.submit(&jobs[r]);
+        };
+    }
+    js.submit(&jobs[0]);
+    js.wait_all();
+    ASSERT(counter.load() == N);
+}
+
+TEST(job_system_wakes_parked_workers) {
+    JobSystem js(JobSystemDesc{2, 0});
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (js.parked_count() < 2) {
+        ASSERT(std::chrono::steady_clock::now() < deadline);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    // パーク中でも submit だけで起床する (呼び出し側は手伝わない)
+    Job job;
+    job.func = [] {};
+    js.submit(&job);
+    while (!job.completed.load(std::memory_order_acquire)) {
+        ASSERT(std::chrono::steady_clock::now() < deadline);
+        std::this_thread::yield();
+    }
+}
+
+// 外部スレッドは手伝わずに完了だけを待つ
+static bool spin_until(const std::atomic<bool>& flag, int timeout_ms = 5000) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    while (!flag.load(std::memory_order_acquire)) {
+        if (std::chrono::steady_clock::now() > deadline) return false;
+        std::this_thread::yield();
+    }
+    return true;
+}
+
+TEST(priority_high_runs_before_normal) {
+    JobSystem js(JobSystemDesc{1, 0});
+    // 唯一のワーカーが blocker を実行中と確定してから投入する (全ジョブが投入口に揃う)
+    std::atomic<bool> started{false};
+    std::atomic<bool> gate{false};
+    Job blocker;
+    blocker.func = [&] {
+        started.store(true, std::memory_order_release);
+        while (!gate.load(std::memory_order_acquire)) std::this_thread::yield();
+    };
+    js.submit(&blocker);
+    ASSERT(spin_until(started));
+
+    std::vector<int> order;
+    std::vector<Job> normal(8), high(8);
+    for (auto& j : normal) { j.func = [&] { order.push_back(1); }; js.submit(&j); }
+    for (auto& j : high)   { j.func = [&] { order.push_back(0); }; js.submit(&j, JobPriority::High); }
+    gate.store(true, std::memory_order_release);
+    ASSERT(spin_until(normal.back().completed));
+    for (auto& j : normal) ASSERT(spin_until(j.completed));
+
+    ASSERT(order.size() == 16);
+    for (int i = 0; i < 8; ++i) ASSERT(order[i] == 0);
+    for (int i = 8; i < 16; ++i) ASSERT(order[i] == 1);
+}
+
+TEST(priority_background_workers_are_dedicated) {
+    JobSystem js(JobSystemDesc{1, 0, 1});
+    ASSERT(js.worker_count() == 1);
+    ASSERT(js.background_worker_count() == 1);
+
+    // Background 専用ワーカーを塞ぐ
+    std::atomic<bool> gate{false};
+    Job streaming, queued_bg, frame;
+    streaming.func = [&] { while (!gate.load(std::memory_order_acquire)) std::this_thread::yield(); };
+    queued_bg.func = [] {};
+    frame.func = [] {};
+    js.submit(&streaming, JobPriority::Background);
+    js.submit(&queued_bg, JobPriority::Background);
+    js.submit(&frame, JobPriority::High);
+
+    // フレームワーカーは High を即処理し、Background には手を出さない
+    ASSERT(spin_until(frame.completed));
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    ASSERT(!queued_bg.completed.load());
+
+    gate.store(true, std::memory_order_release);
+    ASSERT(spin_until(queued_bg.completed));
+}
+
+TEST(task_graph_dependencies) {
+    JobSystem js(2);
+    TaskGraph graph(js);
+    std::atomic<int> step{0};
+    int a_at = -1, b_at = -1, c_at = -1;
+    Job* a = graph.add("a", [&] { a_at = step.fetch_add(1); });
+    Job* b = graph.add("b", [&] { b_at = step.fetch_add(1); });
+    Job* c = graph.add("c", [&] { c_at = step.fetch_add(1); });
+    graph.depends_on(b, a);
+    graph.depends_on(c, b);
+    graph.execute();
+    ASSERT(a_at == 0);
+    ASSERT(b_at == 1);
+    ASSERT(c_at == 2);
+}
+
+TEST(task_graph_compiled_reexecute) {
+    constexpr u32 N = 2000;
+    // どのスレッドがどれだけ積んでもデック / 投入口は拡張されない
+    JobSystem js(JobSystemDesc{.worker_count = 4, .initial_capacity = N});
+    TaskGraph graph(js);
+    std::vector<Job*> nodes(N);
+    std::vector<u32> stamp(N);
+    std::atomic<u32> clock{0};
+    for (u32 i = 0; i < N; ++i) {
+        nodes[i] = graph.add("node", [&, i] { stamp[i] = clock.fetch_add(1); });
+        if (i > 0) graph.depends_on(nodes[i], nodes[(i - 1) / 2]);
+        if (i > 1) graph.depends_on(nodes[i], nodes[i - 2]);
+    }
+    graph.compile();
+    ASSERT(graph.compiled());
+    ASSERT(graph.add("late", [] {}) == nullptr);
+
+    graph.execute();   // ウォームアップ (グラフ自身の構造)
+    u64 before = g_alloc_count.load();
+    for (int frame = 0; frame < 5; ++frame) {
+        u32 base = clock.load();
+        graph.execute();
+        ASSERT(clock.load() == base + N);
+        for (u32 i = 1; i < N; ++i) {
+            ASSERT(stamp[i] > stamp[(i - 1) / 2]);
+            if (i > 1) ASSERT(stamp[i] > stamp[i - 2]);
+        }
+    }
+    ASSERT(g_alloc_count.load() == before);
+
+    graph.clear();
+    ASSERT(!graph.compiled());
+    ASSERT(graph.job_count() == 0);
+}
+
+TEST(parallel_for_covers_range_once) {
+    JobSystem js(4);
+    constexpr u32 N = 100003;
+    std::vector<std::atomic<u8>> hits(N);
+    js.parallel_for(0, N, 0, [&](u32 b, u32 e) {
+        for (u32 i = b; i < e; ++i) hits[i].fetch_add(1, std::memory_order_relaxed);
+    });
+    for (auto& h : hits) ASSERT(h.load() == 1);
+
+    // 空範囲 / grain > 範囲
+    u32 calls = 0;
+    js.parallel_for(5, 5, 16, [&](u32, u32) { ++calls; });
+    js.parallel_for(0, 3, 16, [&](u32 b, u32 e) { calls += e - b; });
+    ASSERT(calls == 3);
+}
+
+TEST(parallel_for_nested) {
+    JobSystem js(4);
+    std::atomic<u64> total{0};
+    js.parallel_for(0, 64, 1, [&](u32 ob, u32 oe) {
+        for (u32 o = ob; o < oe; ++o) {
+            js.parallel_for(0, 1000, 64, [&](u32 b, u32 e) {
+                total.fetch_add(e - b, std::memory_order_relaxed);
+            });
+        }
+    });
+    ASSERT(total.load() == 64 * 1000);
+}
+
+TEST(parallel_reduce_sum) {
+    JobSystem js(4);
+    constexpr u32 N = 1000000;
+    u64 sum = js.parallel_reduce<u64>(0, N, 1024, 0,
+        [](u32 b, u32 e) { u64 s = 0; for (u32 i = b; i < e; ++i) s += i; return s; },
+        [](u64 a, u64 b) { return a + b; });
+    ASSERT(sum == static_cast<u64>(N) * (N - 1) / 2);
+
+    // 非可換だが結合的な演算で左→右順序を確認
+    std::string order = js.parallel_reduce<std::string>(0, 26, 1, std::string{},
+        [](u32 b, u32 e) { std::string s; for (u32 i = b; i < e; ++i) s += char('a' + i); return s; },
+        [](std::string a, std::string b) { return a + b; });
+    ASSERT(order == "abcdefghijklmnopqrstuvwxyz");
+}
+
+TEST(job_func_inline_and_heap) {
+    int hits = 0;
+    JobFunc small = [&hits] { ++hits; };
+    struct Big { u8 pad[128]; int* hits; void operator()() const { ++*hits; } };
+    JobFunc big = Big{{}, &hits};
+    JobFunc moved = std::move(big);
+    ASSERT(!big);
+    small();
+    moved();
+    ASSERT(hits == 2);
+    JobFunc empty = std::function<void()>{};
+    ASSERT(!empty);
+}
+
+TEST(task_graph_rebuild_zero_alloc) {
+    constexpr u32 N = 10000;
+    // 1 フレームの全ジョブが 1 つのデック / 投入口に積まれても拡張しない
+    JobSystem js(JobSystemDesc{.worker_count = 2, .initial_capacity = N});
+    TaskGraph graph(js);
+    std::vector<Job*> nodes(N);
+    std::atomic<u32> counter{0};
+
+    auto frame = [&] {
+        for (u32 i = 0; i < N; ++i) {
+            nodes[i] = graph.add("node", [&counter] {
+                counter.fetch_add(1, std::memory_order_relaxed);
+            });
+            if (i > 0) graph.depends_on(nodes[i], nodes[(i - 1) / 2]);
+        }
+        graph.execute();
+        graph.clear();
+    };
+
+    frame();         // ウォームアップ (グラフ自身のプール)
+    u64 before = g_alloc_count.load();
+    for (int i = 0; i < 5; ++i) frame();
+    ASSERT(g_alloc_count.load() == before);
+    ASSERT(counter.load() == N * 6);
+}
+
+// ── メイン ──────────────────────────────────────────────
+
+int main() {
+    printf("=== engine_core TaskGraph テスト ===\n");
+    // テストはグローバルコンストラクタで自動実行済み
+    printf("\n結果: %d passed, %d failed\n", tests_passed, tests_failed);
+    return tests_failed > 0 ? 1 : 0;
+}